@@ -0,0 +1,103 @@
+#include "bench.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+double now_seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void drop_file_cache(const char* path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return;
+	}
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+void remove_directory(const char* directory) {
+	DIR* dir = opendir(directory);
+	if (dir == NULL) {
+		return;
+	}
+	char path[512];
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] != '.') {
+			snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+			unlink(path);
+		}
+	}
+	closedir(dir);
+	rmdir(directory);
+}
+
+int compare_doubles(const void* a, const void* b) {
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+double percentile(const double* sorted, size_t count, double fraction) {
+	if (count == 0) {
+		return 0.0;
+	}
+	// Nearest rank, so p99 of fewer than 100 runs is the slowest one
+	size_t rank = (size_t)(fraction * count + 0.999999);
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+long peak_rss_kb() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+typedef struct bench_mode_t {
+	const char* name;
+	const char* usage;
+	int (*run)(int argc, char** argv);
+} bench_mode_t;
+
+static const bench_mode_t modes[] = {
+	{"decode", "decode <images...>    stdio vs mmap read+decode, cold and warm page cache", bench_decode},
+	{"mips", "mips <images...>      mip chain on the CPU per instruction set vs glGenerateMipmap", bench_mips},
+	{"list", "list [counts...]      directory listing time and memory, 1k/10k/100k files by default", bench_list},
+	{"sniff", "sniff [count]         content sniffing throughput in files/s, 100k files by default", bench_sniff},
+	{"thumbs", "thumbs <directory>    thumbnails/s per thread and cache hit rate, cold and warm", bench_thumbs},
+	{"gif", "gif <files...>        streaming GIF decode in frames/s and peak RSS vs holding every frame", bench_gif},
+	{"compress", "compress <images...>  BC1/BC3 encode time per thread count, memory saved, PSNR and cached reload", bench_compress},
+	{"jpeg", "jpeg [images...]      single JPEG decode time per thread count, with and without restart markers", bench_jpeg},
+	{"suite", "suite [runs]          decode, list, upload and draw over a generated corpus, JSON on stdout", bench_suite},
+};
+
+static void usage(const char* program) {
+	printf("Usage: %s <mode> [args]\n", program);
+	printf("Modes:\n");
+	for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+		printf("  %s\n", modes[i].usage);
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		usage(argv[0]);
+		return -1;
+	}
+	for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+		if (strcmp(argv[1], modes[i].name) == 0) {
+			return modes[i].run(argc - 2, argv + 2);
+		}
+	}
+	usage(argv[0]);
+	return -1;
+}
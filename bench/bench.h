@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+double now_seconds();
+// Evicts the file from the page cache so the next read comes from disk
+void drop_file_cache(const char* path);
+// Deletes the files in directory, then the directory itself
+void remove_directory(const char* directory);
+int compare_doubles(const void* a, const void* b);
+// fraction of 0.5 is the median, sorted ascending
+double percentile(const double* sorted, size_t count, double fraction);
+long peak_rss_kb();
+
+// Headless OpenGL 3.3 core context, made current on the calling thread
+int gl_context_init();
+void gl_context_destroy();
+const char* gl_renderer();
+
+int bench_decode(int argc, char** argv);
+int bench_mips(int argc, char** argv);
+int bench_list(int argc, char** argv);
+int bench_sniff(int argc, char** argv);
+int bench_thumbs(int argc, char** argv);
+int bench_gif(int argc, char** argv);
+int bench_compress(int argc, char** argv);
+int bench_jpeg(int argc, char** argv);
+int bench_suite(int argc, char** argv);
@@ -0,0 +1,86 @@
+#include "bench.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "compress.h"
+#include "mipmap.h"
+
+static int decode_levels(const char* path, image_t* image) {
+	if (decode_image(path, 0, 0, image) != 0) {
+		return -1;
+	}
+	if (build_mipmaps(image) != 0) {
+		free_image(image);
+		return -1;
+	}
+	return 0;
+}
+
+// Encodes the whole mip chain of each image with one thread and with one per
+// core, then stores the blocks in an empty cache under /tmp and times loading
+// them back, which is what opening the image again costs. Images under
+// COMPRESS_MIN_PIXELS are encoded but the viewer never caches them.
+int bench_compress(int argc, char** argv) {
+	if (argc == 0) {
+		fprintf(stderr, "compress: no files given\n");
+		return -1;
+	}
+	char cache[] = "/tmp/imeye_bench_blocks_XXXXXX";
+	if (mkdtemp(cache) == NULL) {
+		perror("mkdtemp");
+		return -1;
+	}
+	compressor_t compressor;
+	compressor_init(&compressor, INT32_MAX, cache);
+	size_t threads = compressor.threads;
+
+	printf("%-32s %6s %10s %10s %10s %6s %9s %10s %10s %10s\n", "file", "format", "size", "raw", "blocks", "ratio",
+	       "PSNR", "1 thread", "threads", "cached");
+	for (int i = 0; i < argc; i++) {
+		image_t image;
+		compress_report_t single, report;
+		if (decode_levels(argv[i], &image) != 0) {
+			fprintf(stderr, "compress: can't decode %s\n", argv[i]);
+			continue;
+		}
+		char size[32];
+		snprintf(size, sizeof(size), "%dx%d", image.full_width, image.full_height);
+		int result = compress_levels(&image, 1, &single);
+		free_image(&image);
+		if (result != 0 || decode_levels(argv[i], &image) != 0) {
+			continue;
+		}
+		result = compress_levels(&image, threads, &report);
+		free_image(&image);
+		if (result != 0) {
+			continue;
+		}
+
+		// Through the viewer's path, so the file is the one it would write
+		char cached[16] = "-";
+		unsigned char key[16];
+		compress_report_t loaded;
+		if (block_key(argv[i], key) == 0 && decode_levels(argv[i], &image) == 0) {
+			result = compressor_compress(&compressor, key, &image, &loaded);
+			free_image(&image);
+			if (result == 0) {
+				drop_file_cache(argv[i]);
+				if (compressor_load(&compressor, key, &image, &loaded) == 0) {
+					snprintf(cached, sizeof(cached), "%.1fms", loaded.seconds * 1e3);
+					free_image(&image);
+				}
+			}
+		}
+
+		printf("%-32s %6s %10s %7.1f MB %7.1f MB %5.1fx %6.2f dB %8.1fms %8.1fms %10s\n", argv[i],
+		       compression_name(report.compression), size, report.raw_bytes / (1024.0 * 1024.0),
+		       report.compressed_bytes / (1024.0 * 1024.0), (double)report.raw_bytes / report.compressed_bytes,
+		       report.psnr, single.seconds * 1e3, report.seconds * 1e3, cached);
+	}
+	printf("%zu threads\n", threads);
+	compressor_destroy(&compressor);
+	remove_directory(cache);
+	return 0;
+}
@@ -0,0 +1,99 @@
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <stb/stb_image.h>
+
+#include "image.h"
+
+#define DECODE_RUNS 5
+
+typedef double (*decode_fn)(const char* path, bool cold);
+
+// What decode_image() used to do: stbi_load() through stdio
+static double decode_stdio(const char* path, bool cold) {
+	if (cold) {
+		drop_file_cache(path);
+	}
+	int w, h, channels;
+	double start = now_seconds();
+	stbi_set_flip_vertically_on_load_thread(1);
+	unsigned char* pixels = stbi_load(path, &w, &h, &channels, 0);
+	double elapsed = now_seconds() - start;
+	if (pixels == NULL) {
+		return -1.0;
+	}
+	stbi_image_free(pixels);
+	return elapsed;
+}
+
+static double decode_mmap(const char* path, bool cold) {
+	if (cold) {
+		drop_file_cache(path);
+	}
+	image_t image;
+	double start = now_seconds();
+	if (decode_image(path, 0, 0, &image) != 0) {
+		return -1.0;
+	}
+	double elapsed = now_seconds() - start;
+	free_image(&image);
+	return elapsed;
+}
+
+// All the window waits for before opening
+static double probe_header(const char* path, bool cold) {
+	if (cold) {
+		drop_file_cache(path);
+	}
+	int32_t w, h;
+	double start = now_seconds();
+	if (probe_image(path, &w, &h) != 0) {
+		return -1.0;
+	}
+	return now_seconds() - start;
+}
+
+static double median_time(decode_fn decode, const char* path, bool cold) {
+	double times[DECODE_RUNS];
+	for (size_t i = 0; i < DECODE_RUNS; i++) {
+		times[i] = decode(path, cold);
+		if (times[i] < 0.0) {
+			return -1.0;
+		}
+	}
+	qsort(times, DECODE_RUNS, sizeof(double), compare_doubles);
+	return times[DECODE_RUNS / 2];
+}
+
+int bench_decode(int argc, char** argv) {
+	if (argc == 0) {
+		fprintf(stderr, "decode: no images given\n");
+		return -1;
+	}
+
+	printf("%-40s %10s %12s %12s %12s %12s %12s\n", "file", "MB", "probe cold", "stdio cold", "mmap cold", "stdio warm",
+	       "mmap warm");
+	for (int i = 0; i < argc; i++) {
+		struct stat st;
+		if (stat(argv[i], &st) != 0) {
+			fprintf(stderr, "Could not stat %s\n", argv[i]);
+			continue;
+		}
+		// Warm up the page cache before the warm runs
+		decode_mmap(argv[i], false);
+		double probe_cold = median_time(probe_header, argv[i], true);
+		double stdio_cold = median_time(decode_stdio, argv[i], true);
+		double mmap_cold = median_time(decode_mmap, argv[i], true);
+		double stdio_warm = median_time(decode_stdio, argv[i], false);
+		double mmap_warm = median_time(decode_mmap, argv[i], false);
+		if (probe_cold < 0.0 || stdio_cold < 0.0 || mmap_cold < 0.0 || stdio_warm < 0.0 || mmap_warm < 0.0) {
+			fprintf(stderr, "Failed to decode %s\n", argv[i]);
+			continue;
+		}
+		printf("%-40s %10.1f %10.2fms %10.1fms %10.1fms %10.1fms %10.1fms\n", argv[i], st.st_size / (1024.0 * 1024.0),
+		       probe_cold * 1e3, stdio_cold * 1e3, mmap_cold * 1e3, stdio_warm * 1e3, mmap_warm * 1e3);
+	}
+	return 0;
+}
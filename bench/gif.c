@@ -0,0 +1,42 @@
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gif.h"
+
+// Decodes one play of each GIF frame by frame, the way the player does. The
+// peak RSS stays near the size of a few frames however many there are, the
+// last column is what holding every frame at once would take.
+int bench_gif(int argc, char** argv) {
+	if (argc == 0) {
+		fprintf(stderr, "gif: no files given\n");
+		return -1;
+	}
+	printf("%-32s %8s %10s %12s %12s %12s %14s\n", "file", "frames", "size", "frames/s", "ms/frame", "peak RSS", "all frames");
+	for (int i = 0; i < argc; i++) {
+		gif_decoder_t* gif = malloc(sizeof(gif_decoder_t));
+		if (gif == NULL || gif_open(argv[i], gif) != 0) {
+			free(gif);
+			fprintf(stderr, "gif: can't open %s\n", argv[i]);
+			continue;
+		}
+		size_t frames = 0;
+		image_t frame;
+		int32_t delay;
+		double start = now_seconds();
+		while (gif_next_frame(gif, &frame, &delay) == 1) {
+			free_image(&frame);
+			frames++;
+		}
+		double elapsed = now_seconds() - start;
+		char size[32];
+		snprintf(size, sizeof(size), "%dx%d", gif->width, gif->height);
+		double all_frames = (double)frames * gif->width * gif->height * 4;
+		printf("%-32s %8zu %10s %12.1f %12.3f %9.1f MB %11.1f MB\n", argv[i], frames, size, frames / elapsed,
+		       frames > 0 ? elapsed * 1e3 / frames : 0.0, peak_rss_kb() / 1024.0, all_frames / (1024.0 * 1024.0));
+		gif_close(gif);
+		free(gif);
+	}
+	return 0;
+}
@@ -0,0 +1,70 @@
+#include "bench.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/glew.h>
+#include <stdio.h>
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLContext context = EGL_NO_CONTEXT;
+
+// Surfaceless so the benchmarks run without a window system, on llvmpipe when there is no GPU
+int gl_context_init() {
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+	    (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (get_platform_display == NULL) {
+		fprintf(stderr, "EGL_EXT_platform_base is not supported\n");
+		return -1;
+	}
+	display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+		fprintf(stderr, "Failed to initialize a surfaceless EGL display\n");
+		display = EGL_NO_DISPLAY;
+		return -1;
+	}
+	if (!eglBindAPI(EGL_OPENGL_API)) {
+		fprintf(stderr, "EGL does not support desktop OpenGL\n");
+		gl_context_destroy();
+		return -1;
+	}
+
+	const EGLint attributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+	if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+		fprintf(stderr, "Failed to create a surfaceless OpenGL 3.3 context\n");
+		gl_context_destroy();
+		return -1;
+	}
+
+	// glewInit() insists on GLX/WGL, only the function pointers are needed here
+	glewExperimental = GL_TRUE;
+	if (glewContextInit() != GLEW_OK) {
+		fprintf(stderr, "Failed to initialize GLEW\n");
+		gl_context_destroy();
+		return -1;
+	}
+	return 0;
+}
+
+void gl_context_destroy() {
+	if (display == EGL_NO_DISPLAY) {
+		return;
+	}
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (context != EGL_NO_CONTEXT) {
+		eglDestroyContext(display, context);
+	}
+	eglTerminate(display);
+	context = EGL_NO_CONTEXT;
+	display = EGL_NO_DISPLAY;
+}
+
+const char* gl_renderer() {
+	const char* renderer = (const char*)glGetString(GL_RENDERER);
+	return renderer != NULL ? renderer : "unknown";
+}
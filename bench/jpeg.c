@@ -0,0 +1,155 @@
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// jpeglib.h expects FILE and size_t to already be declared
+#include <jpeglib.h>
+
+#include "file_map.h"
+#include "jpeg.h"
+
+#define JPEG_RUNS 3
+
+typedef struct jpeg_corpus_size_t {
+	int32_t width;
+	int32_t height;
+} jpeg_corpus_size_t;
+
+// 24 and 100 megapixels, each without restart markers and with one every MCU row
+static const jpeg_corpus_size_t corpus_sizes[] = {{6000, 4000}, {12000, 8400}};
+
+// Smooth gradients with some noise, closer to a photo's entropy than either alone
+static int write_jpeg(const char* path, int32_t width, int32_t height, bool restarts) {
+	FILE* file = fopen(path, "wb");
+	unsigned char* row = malloc((size_t)width * 3);
+	if (file == NULL || row == NULL) {
+		if (file != NULL) {
+			fclose(file);
+		}
+		free(row);
+		return -1;
+	}
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr error;
+	cinfo.err = jpeg_std_error(&error);
+	jpeg_create_compress(&cinfo);
+	jpeg_stdio_dest(&cinfo, file);
+	cinfo.image_width = width;
+	cinfo.image_height = height;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, 90, TRUE);
+	cinfo.restart_in_rows = restarts ? 1 : 0;
+	jpeg_start_compress(&cinfo, TRUE);
+	uint32_t seed = 1;
+	while (cinfo.next_scanline < cinfo.image_height) {
+		int32_t y = cinfo.next_scanline;
+		for (int32_t x = 0; x < width; x++) {
+			seed = seed * 1103515245 + 12345;
+			int32_t noise = (seed >> 16) & 15;
+			row[x * 3] = (unsigned char)(x * 255 / width + noise);
+			row[x * 3 + 1] = (unsigned char)(y * 255 / height + noise);
+			row[x * 3 + 2] = (unsigned char)((x + y) / 16 + noise);
+		}
+		JSAMPROW rows = row;
+		jpeg_write_scanlines(&cinfo, &rows, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+	fclose(file);
+	free(row);
+	return 0;
+}
+
+static double decode_time(const file_map_t* map, size_t threads) {
+	double times[JPEG_RUNS];
+	for (size_t i = 0; i < JPEG_RUNS; i++) {
+		image_t image;
+		double start = now_seconds();
+		if (decode_jpeg_threads(map->data, map->size, 0, 0, threads, &image) != 0) {
+			return -1.0;
+		}
+		times[i] = now_seconds() - start;
+		free_image(&image);
+	}
+	qsort(times, JPEG_RUNS, sizeof(double), compare_doubles);
+	return times[JPEG_RUNS / 2];
+}
+
+static size_t next_thread_count(size_t threads, size_t max_threads) {
+	if (threads < max_threads && threads * 2 > max_threads) {
+		return max_threads;
+	}
+	return threads * 2;
+}
+
+// Powers of two up to the thread count decode_jpeg() uses, and that count itself
+static void bench_file(const char* path) {
+	file_map_t map;
+	int32_t width, height;
+	if (probe_image(path, &width, &height) != 0 || map_file(path, &map) != 0) {
+		fprintf(stderr, "jpeg: can't read %s\n", path);
+		return;
+	}
+	if (!is_jpeg(map.data, map.size)) {
+		fprintf(stderr, "jpeg: %s is not a JPEG\n", path);
+		unmap_file(&map);
+		return;
+	}
+	int32_t interval = jpeg_restart_interval(map.data, map.size);
+	char restarts[32];
+	snprintf(restarts, sizeof(restarts), interval > 0 ? "%d MCUs" : "none", interval);
+	const char* slash = strrchr(path, '/');
+	const char* name = slash != NULL ? slash + 1 : path;
+	double megapixels = (double)width * height / 1e6;
+	size_t max_threads = jpeg_threads();
+	double serial = 0.0;
+	for (size_t threads = 1; threads <= max_threads; threads = next_thread_count(threads, max_threads)) {
+		double seconds = decode_time(&map, threads);
+		if (seconds < 0.0) {
+			fprintf(stderr, "jpeg: failed to decode %s\n", path);
+			break;
+		}
+		if (threads == 1) {
+			serial = seconds;
+		}
+		printf("%-32s %8.1f %10s %8zu %10.1fms %10.1f %8.2fx\n", name, megapixels, restarts, threads, seconds * 1e3,
+		       megapixels / seconds, serial / seconds);
+	}
+	unmap_file(&map);
+}
+
+// Decodes each JPEG at full size with 1 to jpeg_threads() threads. Files
+// without restart markers always decode serially, they're there to show the
+// split costs nothing when it can't be made. With no files a corpus of both
+// kinds is written to /tmp first.
+int bench_jpeg(int argc, char** argv) {
+	printf("%-32s %8s %10s %8s %12s %10s %9s\n", "file", "MP", "restarts", "threads", "time", "MP/s", "speedup");
+	if (argc > 0) {
+		for (int i = 0; i < argc; i++) {
+			bench_file(argv[i]);
+		}
+		return 0;
+	}
+
+	char directory[] = "/tmp/imeye_bench_jpeg_XXXXXX";
+	if (mkdtemp(directory) == NULL) {
+		perror("mkdtemp");
+		return -1;
+	}
+	for (size_t i = 0; i < sizeof(corpus_sizes) / sizeof(corpus_sizes[0]); i++) {
+		for (int restarts = 0; restarts < 2; restarts++) {
+			char path[256];
+			snprintf(path, sizeof(path), "%s/%dx%d_%s.jpg", directory, corpus_sizes[i].width, corpus_sizes[i].height,
+			         restarts ? "rst" : "plain");
+			fprintf(stderr, "Writing %s\n", path);
+			if (write_jpeg(path, corpus_sizes[i].width, corpus_sizes[i].height, restarts) == 0) {
+				bench_file(path);
+			}
+		}
+	}
+	remove_directory(directory);
+	return 0;
+}
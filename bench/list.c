@@ -0,0 +1,136 @@
+#include "bench.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dir_splore.h"
+
+#define LIST_RUNS 5
+
+static const size_t default_counts[] = {1000, 10000, 100000};
+
+// Empty files named like a capture sequence, so only the listing is measured
+static char* make_corpus(size_t count) {
+	char template[] = "/tmp/imeye_list_XXXXXX";
+	if (mkdtemp(template) == NULL) {
+		return NULL;
+	}
+	char path[256];
+	for (size_t i = 0; i < count; i++) {
+		snprintf(path, sizeof(path), "%s/frame_%07zu.jpg", template, (count * 7919 + i * 104729) % (count * 10));
+		int fd = open(path, O_CREAT | O_WRONLY, 0644);
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+	return strdup(template);
+}
+
+static int compare_paths(const void* a, const void* b) {
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// What list_images() used to do: readdir() and one malloc per path
+static double list_readdir(const char* directory, size_t* count, size_t* bytes) {
+	double start = now_seconds();
+	DIR* dir = opendir(directory);
+	if (dir == NULL) {
+		return -1.0;
+	}
+	size_t capacity = 1024;
+	char** paths = malloc(capacity * sizeof(char*));
+	size_t n = 0;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.') {
+			continue;
+		}
+		if (n == capacity) {
+			capacity *= 2;
+			paths = realloc(paths, capacity * sizeof(char*));
+		}
+		paths[n] = malloc(strlen(directory) + strlen(entry->d_name) + 2);
+		sprintf(paths[n], "%s/%s", directory, entry->d_name);
+		n++;
+	}
+	closedir(dir);
+	qsort(paths, n, sizeof(char*), compare_paths);
+	double elapsed = now_seconds() - start;
+
+	*count = n;
+	*bytes = malloc_usable_size(paths);
+	for (size_t i = 0; i < n; i++) {
+		*bytes += malloc_usable_size(paths[i]);
+		free(paths[i]);
+	}
+	free(paths);
+	return elapsed;
+}
+
+static double list_table(const char* directory, size_t* count, size_t* bytes) {
+	char file[512];
+	snprintf(file, sizeof(file), "%s/x", directory);
+	path_table_t table;
+	double start = now_seconds();
+	if (list_images(file, &table) != 0) {
+		return -1.0;
+	}
+	double elapsed = now_seconds() - start;
+	*count = table.count;
+	*bytes = path_table_memory(&table);
+	path_table_destroy(&table);
+	return elapsed;
+}
+
+typedef double (*list_fn)(const char* directory, size_t* count, size_t* bytes);
+
+static double median_time(list_fn list, const char* directory, size_t* count, size_t* bytes) {
+	double times[LIST_RUNS];
+	for (size_t i = 0; i < LIST_RUNS; i++) {
+		times[i] = list(directory, count, bytes);
+		if (times[i] < 0.0) {
+			return -1.0;
+		}
+	}
+	qsort(times, LIST_RUNS, sizeof(double), compare_doubles);
+	return times[LIST_RUNS / 2];
+}
+
+int bench_list(int argc, char** argv) {
+	size_t counts[16];
+	size_t count_total = 0;
+	if (argc == 0) {
+		for (size_t i = 0; i < sizeof(default_counts) / sizeof(default_counts[0]); i++) {
+			counts[count_total++] = default_counts[i];
+		}
+	}
+	for (int i = 0; i < argc && count_total < 16; i++) {
+		counts[count_total++] = strtoul(argv[i], NULL, 10);
+	}
+
+	printf("%-10s %12s %12s %12s %12s\n", "entries", "readdir", "table", "readdir MB", "table MB");
+	for (size_t i = 0; i < count_total; i++) {
+		char* directory = make_corpus(counts[i]);
+		if (directory == NULL) {
+			fprintf(stderr, "list: could not create a corpus of %zu files\n", counts[i]);
+			return -1;
+		}
+		size_t old_count, old_bytes, count, bytes;
+		double old_time = median_time(list_readdir, directory, &old_count, &old_bytes);
+		double time = median_time(list_table, directory, &count, &bytes);
+		if (old_time < 0.0 || time < 0.0 || old_count != count) {
+			fprintf(stderr, "list: listing %s failed\n", directory);
+		} else {
+			printf("%-10zu %10.2fms %10.2fms %12.2f %12.2f\n", count, old_time * 1e3, time * 1e3,
+			       old_bytes / (1024.0 * 1024.0), bytes / (1024.0 * 1024.0));
+		}
+		remove_directory(directory);
+		free(directory);
+	}
+	return 0;
+}
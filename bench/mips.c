@@ -0,0 +1,100 @@
+#include "bench.h"
+
+#include <GL/glew.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "image.h"
+#include "mipmap.h"
+
+#define MIPS_RUNS 5
+
+static double build_time(const image_t* source, mip_isa_t isa) {
+	double times[MIPS_RUNS];
+	for (size_t i = 0; i < MIPS_RUNS; i++) {
+		// Shallow copy so the chain hangs off a throwaway image
+		image_t image = *source;
+		image.mips = NULL;
+		image.mip_count = 0;
+		double start = now_seconds();
+		if (build_mipmaps_isa(&image, isa) != 0) {
+			return -1.0;
+		}
+		times[i] = now_seconds() - start;
+		for (int32_t level = 0; level < image.mip_count; level++) {
+			free(image.mips[level].pixels);
+		}
+		free(image.mips);
+	}
+	qsort(times, MIPS_RUNS, sizeof(double), compare_doubles);
+	return times[MIPS_RUNS / 2];
+}
+
+// Upload of the base level is left out, only the time the driver spends filtering counts
+static double generate_time(const image_t* image) {
+	double times[MIPS_RUNS];
+	GLenum format = image_format(image->channels);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (size_t i = 0; i < MIPS_RUNS; i++) {
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, image->width, image->height, 0, format, GL_UNSIGNED_BYTE, image->pixels);
+		glFinish();
+		double start = now_seconds();
+		glGenerateMipmap(GL_TEXTURE_2D);
+		glFinish();
+		times[i] = now_seconds() - start;
+		glDeleteTextures(1, &texture);
+	}
+	qsort(times, MIPS_RUNS, sizeof(double), compare_doubles);
+	return times[MIPS_RUNS / 2];
+}
+
+int bench_mips(int argc, char** argv) {
+	if (argc == 0) {
+		fprintf(stderr, "mips: no images given\n");
+		return -1;
+	}
+
+	bool gl = gl_context_init() == 0;
+	mip_isa_t best = mip_isa();
+	printf("CPU: %s, GL: %s\n", mip_isa_name(best), gl ? gl_renderer() : "unavailable");
+	printf("%-40s %12s %8s %12s %12s %12s %14s\n", "file", "size", "levels", "scalar", "sse2", "avx2",
+	       "glGenerateMip");
+	for (int i = 0; i < argc; i++) {
+		image_t image;
+		if (decode_image(argv[i], 0, 0, &image) != 0) {
+			fprintf(stderr, "Failed to decode %s\n", argv[i]);
+			continue;
+		}
+
+		char size[32];
+		snprintf(size, sizeof(size), "%dx%dx%d", image.width, image.height, image.channels);
+		int32_t levels = 0;
+		for (int32_t w = image.width, h = image.height; w > 1 || h > 1; levels++) {
+			w = w > 1 ? (w + 1) / 2 : 1;
+			h = h > 1 ? (h + 1) / 2 : 1;
+		}
+		printf("%-40s %12s %8d", argv[i], size, levels);
+		for (mip_isa_t isa = MIP_SCALAR; isa <= MIP_AVX2; isa++) {
+			double elapsed = isa <= best ? build_time(&image, isa) : -1.0;
+			if (elapsed < 0.0) {
+				printf(" %12s", "-");
+			} else {
+				printf(" %10.1fms", elapsed * 1e3);
+			}
+		}
+		if (gl && image_format(image.channels) != 0) {
+			printf(" %12.1fms\n", generate_time(&image) * 1e3);
+		} else {
+			printf(" %14s\n", "-");
+		}
+		free_image(&image);
+	}
+
+	if (gl) {
+		gl_context_destroy();
+	}
+	return 0;
+}
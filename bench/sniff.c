@@ -0,0 +1,144 @@
+#include "bench.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dir_splore.h"
+#include "sniff.h"
+
+#define DEFAULT_SNIFF_COUNT 100000
+
+typedef struct header_t {
+	const char* bytes;
+	size_t size;
+	bool image;
+} header_t;
+
+static const header_t headers[] = {
+	{"\x89PNG\r\n\x1a\n\0\0\0\rIHDR", 16, true},
+	{"\xff\xd8\xff\xe0\0\x10JFIF\0\1\1\0\0\1", 16, true},
+	{"GIF89a\x10\0\x10\0\0\0\0\0\0\0", 16, true},
+	{"P6\n16 16\n255\n", 13, true},
+	{"#!/bin/sh\necho hi\n", 18, false},
+};
+
+// Files without extensions, each holding the header of an image or a script, so every one needs sniffing
+static char* make_corpus(size_t count, size_t* images) {
+	char template[] = "/tmp/imeye_sniff_XXXXXX";
+	if (mkdtemp(template) == NULL) {
+		return NULL;
+	}
+	*images = 0;
+	char path[256];
+	for (size_t i = 0; i < count; i++) {
+		const header_t* header = &headers[i % (sizeof(headers) / sizeof(headers[0]))];
+		snprintf(path, sizeof(path), "%s/capture_%07zu", template, i);
+		int fd = open(path, O_CREAT | O_WRONLY, 0644);
+		if (fd < 0) {
+			continue;
+		}
+		if (write(fd, header->bytes, header->size) == (ssize_t)header->size && header->image) {
+			(*images)++;
+		}
+		close(fd);
+	}
+	return strdup(template);
+}
+
+static double list_time(const char* directory, size_t* count) {
+	char file[512];
+	snprintf(file, sizeof(file), "%s/x", directory);
+	path_table_t table;
+	double start = now_seconds();
+	if (list_images(file, &table) != 0) {
+		return -1.0;
+	}
+	double elapsed = now_seconds() - start;
+	*count = table.count;
+	path_table_destroy(&table);
+	return elapsed;
+}
+
+static void report(const char* name, size_t files, double seconds, size_t found, size_t expected) {
+	printf("%-22s %10.2fms %14.0f %10zu%s\n", name, seconds * 1e3, files / seconds, found,
+	       found == expected ? "" : "  (wrong count)");
+}
+
+int bench_sniff(int argc, char** argv) {
+	size_t count = argc > 0 ? strtoul(argv[0], NULL, 10) : DEFAULT_SNIFF_COUNT;
+	size_t expected;
+	char* directory = make_corpus(count, &expected);
+	if (directory == NULL) {
+		fprintf(stderr, "sniff: could not create a corpus of %zu files\n", count);
+		return -1;
+	}
+
+	// Names straight from a listing, the way the scanner hands them over
+	path_table_t table = {0};
+	char file[512];
+	snprintf(file, sizeof(file), "%s/x", directory);
+	path_table_init(&table, file);
+	table.count = 0;
+	table.names_size = 0;
+	for (size_t i = 0; i < count; i++) {
+		char name[64];
+		snprintf(name, sizeof(name), "capture_%07zu", i);
+		path_table_add(&table, name);
+	}
+	const char** names = malloc(count * sizeof(const char*));
+	image_type_t* types = malloc(count * sizeof(image_type_t));
+	for (size_t i = 0; i < count; i++) {
+		names[i] = path_table_name(&table, i);
+	}
+
+	size_t threads = sniff_threads();
+	printf("%zu files, %zu images, %zu threads\n", count, expected, threads);
+	printf("%-22s %12s %14s %10s\n", "pass", "time", "files/s", "images");
+	size_t thread_counts[] = {1, threads};
+	for (size_t t = 0; t < 2; t++) {
+		sniff_cache_clear();
+		double start = now_seconds();
+		sniff_files(table.directory, names, count, types, thread_counts[t]);
+		double elapsed = now_seconds() - start;
+		size_t found = 0;
+		for (size_t i = 0; i < count; i++) {
+			found += types[i] != TYPE_NOT_IMAGE;
+		}
+		char name[32];
+		snprintf(name, sizeof(name), "probe, %zu thread%s", thread_counts[t], thread_counts[t] == 1 ? "" : "s");
+		report(name, count, elapsed, found, expected);
+	}
+
+	double start = now_seconds();
+	sniff_files(table.directory, names, count, types, threads);
+	double elapsed = now_seconds() - start;
+	size_t found = 0;
+	for (size_t i = 0; i < count; i++) {
+		found += types[i] != TYPE_NOT_IMAGE;
+	}
+	report("probe, cached", count, elapsed, found, expected);
+	sniff_stats_t stats = sniff_stats();
+	if (stats.cache_hits != count) {
+		fprintf(stderr, "sniff: %llu of %zu files came from the cache\n", (unsigned long long)stats.cache_hits, count);
+	}
+
+	sniff_cache_clear();
+	double cold = list_time(directory, &found);
+	if (cold >= 0.0) {
+		report("list_images", count, cold, found, expected);
+	}
+	double warm = list_time(directory, &found);
+	if (warm >= 0.0) {
+		report("list_images, cached", count, warm, found, expected);
+	}
+
+	free(names);
+	free(types);
+	path_table_destroy(&table);
+	remove_directory(directory);
+	free(directory);
+	return 0;
+}
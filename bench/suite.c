@@ -0,0 +1,355 @@
+#include "bench.h"
+
+#include <GL/glew.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <stb/stb_image_write.h>
+
+#include "cpu.h"
+#include "dir_splore.h"
+#include "image.h"
+#include "mipmap.h"
+#include "shader.h"
+
+#define SUITE_RUNS 15
+#define SUITE_MAX_RESULTS 64
+// Framebuffer the draw suite renders into
+#define DRAW_WIDTH 1920
+#define DRAW_HEIGHT 1080
+// Bumped when fields change meaning, so old results aren't compared with new ones
+#define SUITE_SCHEMA 1
+
+typedef struct corpus_size_t {
+	int32_t width;
+	int32_t height;
+} corpus_size_t;
+
+static const corpus_size_t sizes[] = {{256, 256}, {1920, 1080}, {4000, 3000}};
+static const char* const formats[] = {"png", "jpg", "bmp", "tga"};
+static const size_t list_counts[] = {1000, 10000};
+
+typedef struct suite_result_t {
+	const char* suite;
+	char name[64];
+	double median;
+	double p99;
+	// Per run: decoded bytes for MB/s and items for a per second rate, 0 when it doesn't apply
+	double bytes;
+	double items;
+} suite_result_t;
+
+typedef struct suite_t {
+	size_t runs;
+	double* times;
+	suite_result_t results[SUITE_MAX_RESULTS];
+	size_t result_count;
+} suite_t;
+
+typedef double (*run_fn)(void* context);
+
+// Times runs of fn, the first one beforehand only warms caches up
+static int measure(suite_t* suite, const char* name, const char* label, run_fn fn, void* context, double bytes,
+                   double items) {
+	if (suite->result_count == SUITE_MAX_RESULTS || fn(context) < 0.0) {
+		return -1;
+	}
+	for (size_t i = 0; i < suite->runs; i++) {
+		suite->times[i] = fn(context);
+		if (suite->times[i] < 0.0) {
+			return -1;
+		}
+	}
+	qsort(suite->times, suite->runs, sizeof(double), compare_doubles);
+	suite_result_t* result = &suite->results[suite->result_count++];
+	result->suite = name;
+	snprintf(result->name, sizeof(result->name), "%s", label);
+	result->median = percentile(suite->times, suite->runs, 0.5);
+	result->p99 = percentile(suite->times, suite->runs, 0.99);
+	result->bytes = bytes;
+	result->items = items;
+	fprintf(stderr, "%-7s %-20s %10.3fms median %10.3fms p99\n", name, label, result->median * 1e3, result->p99 * 1e3);
+	return 0;
+}
+
+// Smooth gradients with a little noise, so PNG and JPEG compress about as well as they do on photos
+static unsigned char* make_pixels(int32_t width, int32_t height) {
+	unsigned char* pixels = malloc((size_t)width * height * 3);
+	if (pixels == NULL) {
+		return NULL;
+	}
+	uint32_t state = 0x9E3779B9u;
+	for (int32_t y = 0; y < height; y++) {
+		for (int32_t x = 0; x < width; x++) {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			int noise = (int)(state & 15) - 8;
+			unsigned char* pixel = pixels + ((size_t)y * width + x) * 3;
+			int r = x * 255 / width + noise;
+			int g = y * 255 / height + noise;
+			int b = (x + y) * 127 / (width + height) + 64 + noise;
+			pixel[0] = (unsigned char)(r < 0 ? 0 : r > 255 ? 255 : r);
+			pixel[1] = (unsigned char)(g < 0 ? 0 : g > 255 ? 255 : g);
+			pixel[2] = (unsigned char)(b < 0 ? 0 : b > 255 ? 255 : b);
+		}
+	}
+	return pixels;
+}
+
+static int write_image(const char* path, const char* format, const unsigned char* pixels, int32_t width, int32_t height) {
+	if (strcmp(format, "png") == 0) {
+		return stbi_write_png(path, width, height, 3, pixels, width * 3) ? 0 : -1;
+	} else if (strcmp(format, "jpg") == 0) {
+		return stbi_write_jpg(path, width, height, 3, pixels, 90) ? 0 : -1;
+	} else if (strcmp(format, "bmp") == 0) {
+		return stbi_write_bmp(path, width, height, 3, pixels) ? 0 : -1;
+	}
+	return stbi_write_tga(path, width, height, 3, pixels) ? 0 : -1;
+}
+
+static double decode_run(void* context) {
+	image_t image;
+	double start = now_seconds();
+	if (decode_image(context, 0, 0, &image) != 0) {
+		return -1.0;
+	}
+	double elapsed = now_seconds() - start;
+	free_image(&image);
+	return elapsed;
+}
+
+static double list_run(void* context) {
+	path_table_t table;
+	double start = now_seconds();
+	if (list_images(context, &table) != 0) {
+		return -1.0;
+	}
+	double elapsed = now_seconds() - start;
+	path_table_destroy(&table);
+	return elapsed;
+}
+
+// What the uploader does for an image that isn't tiled, without the PBO and the shared context
+static double upload_run(void* context) {
+	image_t* image = context;
+	double start = now_seconds();
+	GLuint texture = upload_image(image);
+	glFinish();
+	double elapsed = now_seconds() - start;
+	glDeleteTextures(1, &texture);
+	return elapsed;
+}
+
+static double draw_run(void* context) {
+	(void)context;
+	double start = now_seconds();
+	glClear(GL_COLOR_BUFFER_BIT);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+	glFinish();
+	return now_seconds() - start;
+}
+
+typedef struct draw_target_t {
+	GLuint framebuffer;
+	GLuint renderbuffer;
+	GLuint vao;
+	GLuint buffers[2];
+	GLuint program;
+} draw_target_t;
+
+// The viewer's quad and shader, drawn into an offscreen framebuffer of a typical window size
+static int draw_target_init(draw_target_t* target) {
+	static const float vertices[20] = {1.0f, 1.0f, -1.0f, 1.0f, 1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 0.0f,
+	                                   -1.0f, -1.0f, -1.0f, 0.0f, 0.0f, -1.0f, 1.0f, -1.0f, 0.0f, 1.0f};
+	static const unsigned int indices[6] = {0, 3, 1, 1, 3, 2};
+	target->program = get_shader();
+	if (target->program == (GLuint)-1) {
+		return -1;
+	}
+	glGenFramebuffers(1, &target->framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+	glGenRenderbuffers(1, &target->renderbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, target->renderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, DRAW_WIDTH, DRAW_HEIGHT);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target->renderbuffer);
+	glViewport(0, 0, DRAW_WIDTH, DRAW_HEIGHT);
+
+	glGenVertexArrays(1, &target->vao);
+	glBindVertexArray(target->vao);
+	glGenBuffers(2, target->buffers);
+	glBindBuffer(GL_ARRAY_BUFFER, target->buffers[0]);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, target->buffers[1]);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+
+	glUseProgram(target->program);
+	GLint vertex = glGetAttribLocation(target->program, "vertex");
+	glVertexAttribPointer(vertex, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 5, 0);
+	glEnableVertexAttribArray(vertex);
+	GLint tex_coord = glGetAttribLocation(target->program, "texCoord");
+	glVertexAttribPointer(tex_coord, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 5, (void*)(sizeof(float) * 3));
+	glEnableVertexAttribArray(tex_coord);
+	glUniform1i(glGetUniformLocation(target->program, "image"), 0);
+	glUniform1f(glGetUniformLocation(target->program, "rotation_angle"), 0.0f);
+	glUniform4f(glGetUniformLocation(target->program, "tile"), 0.0f, 0.0f, 1.0f, 1.0f);
+	return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE ? 0 : -1;
+}
+
+static void draw_target_destroy(draw_target_t* target) {
+	glDeleteBuffers(2, target->buffers);
+	glDeleteVertexArrays(1, &target->vao);
+	glDeleteRenderbuffers(1, &target->renderbuffer);
+	glDeleteFramebuffers(1, &target->framebuffer);
+	glDeleteProgram(target->program);
+}
+
+// Strings from the driver may hold anything
+static void print_json_string(const char* text) {
+	putchar('"');
+	for (const char* c = text; *c != '\0'; c++) {
+		if (*c == '"' || *c == '\\') {
+			printf("\\%c", *c);
+		} else if ((unsigned char)*c < 0x20) {
+			printf("\\u%04x", (unsigned char)*c);
+		} else {
+			putchar(*c);
+		}
+	}
+	putchar('"');
+}
+
+static void print_json(const suite_t* suite, const char* renderer) {
+	char date[32];
+	time_t now = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+	printf("{\n  \"schema\": %d,\n  \"date\": \"%s\",\n  \"runs\": %zu,\n", SUITE_SCHEMA, date, suite->runs);
+	printf("  \"cpus\": %zu,\n  \"simd\": \"%s\",\n  \"gl_renderer\": ", cpu_count(),
+	       mip_isa_name(mip_isa()));
+	if (renderer != NULL) {
+		print_json_string(renderer);
+	} else {
+		printf("null");
+	}
+	printf(",\n  \"peak_rss_kb\": %ld,\n  \"results\": [\n", peak_rss_kb());
+	for (size_t i = 0; i < suite->result_count; i++) {
+		const suite_result_t* result = &suite->results[i];
+		printf("    {\"suite\": \"%s\", \"name\": ", result->suite);
+		print_json_string(result->name);
+		printf(", \"median_ms\": %.4f, \"p99_ms\": %.4f", result->median * 1e3, result->p99 * 1e3);
+		if (result->bytes > 0.0) {
+			printf(", \"mb_per_s\": %.1f", result->bytes / result->median / (1024.0 * 1024.0));
+		}
+		if (result->items > 0.0) {
+			printf(", \"per_s\": %.1f", result->items / result->median);
+		}
+		printf("}%s\n", i + 1 < suite->result_count ? "," : "");
+	}
+	printf("  ]\n}\n");
+}
+
+static void run_images(suite_t* suite, const char* directory, bool gl) {
+	draw_target_t target;
+	bool draw = gl && draw_target_init(&target) == 0;
+	if (gl && !draw) {
+		fprintf(stderr, "suite: offscreen framebuffer unavailable, skipping draw\n");
+	}
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		unsigned char* pixels = make_pixels(sizes[s].width, sizes[s].height);
+		if (pixels == NULL) {
+			continue;
+		}
+		for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+			char path[512];
+			char label[64];
+			snprintf(path, sizeof(path), "%s/%dx%d.%s", directory, sizes[s].width, sizes[s].height, formats[f]);
+			snprintf(label, sizeof(label), "%s %dx%d", formats[f], sizes[s].width, sizes[s].height);
+			if (write_image(path, formats[f], pixels, sizes[s].width, sizes[s].height) != 0) {
+				fprintf(stderr, "suite: failed to write %s\n", path);
+				continue;
+			}
+			double bytes = (double)sizes[s].width * sizes[s].height * 3;
+			measure(suite, "decode", label, decode_run, path, bytes, 1.0);
+
+			// Upload and draw don't depend on the format the pixels came from
+			if (!gl || f != 0) {
+				continue;
+			}
+			image_t image;
+			if (decode_image(path, 0, 0, &image) != 0) {
+				continue;
+			}
+			snprintf(label, sizeof(label), "%dx%d", sizes[s].width, sizes[s].height);
+			measure(suite, "upload", label, upload_run, &image, bytes, 1.0);
+			if (draw) {
+				GLuint texture = upload_image(&image);
+				measure(suite, "draw", label, draw_run, NULL, 0.0, 1.0);
+				glDeleteTextures(1, &texture);
+			}
+			free_image(&image);
+		}
+		free(pixels);
+	}
+	if (draw) {
+		draw_target_destroy(&target);
+	}
+}
+
+static void run_lists(suite_t* suite) {
+	for (size_t i = 0; i < sizeof(list_counts) / sizeof(list_counts[0]); i++) {
+		char directory[] = "/tmp/imeye_suite_list_XXXXXX";
+		if (mkdtemp(directory) == NULL) {
+			continue;
+		}
+		char path[512];
+		for (size_t j = 0; j < list_counts[i]; j++) {
+			snprintf(path, sizeof(path), "%s/frame_%07zu.jpg", directory, j);
+			int fd = open(path, O_CREAT | O_WRONLY, 0644);
+			if (fd >= 0) {
+				close(fd);
+			}
+		}
+		char label[64];
+		snprintf(label, sizeof(label), "%zu files", list_counts[i]);
+		snprintf(path, sizeof(path), "%s/x", directory);
+		measure(suite, "list", label, list_run, path, 0.0, (double)list_counts[i]);
+		remove_directory(directory);
+	}
+}
+
+// Everything at once over a generated corpus, as JSON on stdout to keep between releases
+int bench_suite(int argc, char** argv) {
+	suite_t suite = {0};
+	suite.runs = argc > 0 ? strtoul(argv[0], NULL, 10) : SUITE_RUNS;
+	if (suite.runs == 0) {
+		fprintf(stderr, "suite: runs must be at least 1\n");
+		return -1;
+	}
+	suite.times = malloc(suite.runs * sizeof(double));
+	char directory[] = "/tmp/imeye_suite_XXXXXX";
+	if (suite.times == NULL || mkdtemp(directory) == NULL) {
+		free(suite.times);
+		return -1;
+	}
+
+	bool gl = gl_context_init() == 0;
+	const char* renderer = gl ? gl_renderer() : NULL;
+	if (!gl) {
+		fprintf(stderr, "suite: no GL context, skipping upload and draw\n");
+	}
+	run_images(&suite, directory, gl);
+	run_lists(&suite);
+	print_json(&suite, renderer);
+
+	remove_directory(directory);
+	if (gl) {
+		gl_context_destroy();
+	}
+	free(suite.times);
+	return 0;
+}
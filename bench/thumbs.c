@@ -0,0 +1,105 @@
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "dir_splore.h"
+#include "thumbs.h"
+
+typedef struct thumbs_pass_t {
+	double seconds;
+	uint64_t hits;
+	uint64_t generated;
+	uint64_t failed;
+} thumbs_pass_t;
+
+static int run_pass(const path_table_t* table, size_t threads, thumbs_pass_t* pass) {
+	thumbnailer_t thumbnailer;
+	if (thumbnailer_init(&thumbnailer, threads, NULL) != 0) {
+		return -1;
+	}
+	double start = now_seconds();
+	for (size_t i = 0; i < table->count; i++) {
+		char* path = path_table_path(table, i);
+		if (path == NULL || thumbnailer_request(&thumbnailer, path, i) != 0) {
+			free(path);
+			thumbnailer_destroy(&thumbnailer);
+			return -1;
+		}
+		free(path);
+	}
+	size_t done = 0;
+	while (done < table->count) {
+		thumb_result_t result;
+		if (thumbnailer_poll(&thumbnailer, &result)) {
+			thumb_result_free(&result);
+			done++;
+		} else {
+			usleep(500);
+		}
+	}
+	pass->seconds = now_seconds() - start;
+	pass->hits = thumbnailer.hits;
+	pass->generated = thumbnailer.generated;
+	pass->failed = thumbnailer.failed;
+	thumbnailer_destroy(&thumbnailer);
+	return 0;
+}
+
+static void report(const char* name, size_t threads, size_t count, const thumbs_pass_t* pass) {
+	double rate = count / pass->seconds;
+	printf("%-6s %8zu %10.1fms %12.1f %12.1f %9.1f%% %8lu\n", name, threads, pass->seconds * 1e3, rate, rate / threads,
+	       100.0 * pass->hits / count, (unsigned long)pass->failed);
+}
+
+int bench_thumbs(int argc, char** argv) {
+	if (argc == 0) {
+		fprintf(stderr, "thumbs: no directory given\n");
+		return -1;
+	}
+	char file[4096];
+	snprintf(file, sizeof(file), "%s/x", argv[0]);
+	path_table_t table;
+	if (list_images(file, &table) != 0 || table.count == 0) {
+		fprintf(stderr, "thumbs: no images in %s\n", argv[0]);
+		return -1;
+	}
+	size_t thread_counts[] = {1, cpu_count()};
+	size_t runs = thread_counts[1] > 1 ? 2 : 1;
+
+	// A private cache, so the first pass is cold and the user's own cache stays as it is
+	char cache[] = "/tmp/imeye_thumbs_XXXXXX";
+	if (mkdtemp(cache) == NULL) {
+		path_table_destroy(&table);
+		return -1;
+	}
+	setenv("XDG_CACHE_HOME", cache, 1);
+
+	printf("%zu images\n", table.count);
+	printf("%-6s %8s %12s %12s %12s %10s %8s\n", "pass", "threads", "time", "thumbs/s", "per thread", "hits", "failed");
+	for (size_t i = 0; i < runs; i++) {
+		thumbs_pass_t cold, warm;
+		if (run_pass(&table, thread_counts[i], &cold) != 0 || run_pass(&table, thread_counts[i], &warm) != 0) {
+			fprintf(stderr, "thumbs: failed to start the thumbnailer\n");
+			break;
+		}
+		report("cold", thread_counts[i], table.count, &cold);
+		report("warm", thread_counts[i], table.count, &warm);
+
+		char path[512];
+		snprintf(path, sizeof(path), "%s/thumbnails/normal", cache);
+		remove_directory(path);
+		snprintf(path, sizeof(path), "%s/thumbnails/fail/imeye", cache);
+		remove_directory(path);
+		snprintf(path, sizeof(path), "%s/thumbnails/fail", cache);
+		rmdir(path);
+		snprintf(path, sizeof(path), "%s/thumbnails", cache);
+		rmdir(path);
+	}
+	rmdir(cache);
+	path_table_destroy(&table);
+	return 0;
+}
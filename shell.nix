@@ -5,6 +5,8 @@ pkgs.mkShell {
     pkgs.cargo
     pkgs.glew
     pkgs.glfw
+    pkgs.libGL
+    pkgs.libjpeg_turbo
     pkgs.stb
   ];
 }
@@ -0,0 +1,88 @@
+#include "animation.h"
+
+#include <GL/glew.h>
+#include <math.h>
+#include <string.h>
+
+// Doubles the size every second
+#define ZOOM_SPEED 0.6931
+#define PAN_SPEED 800.0
+// Time constant of the velocity easing
+#define EASE_SECONDS 0.08
+// Longer gaps (a stall) are integrated as this
+#define MAX_STEP_SECONDS 0.1
+// The first frame after idling has no previous frame to measure from
+#define FIRST_STEP_SECONDS (1.0 / 60.0)
+#define STOP_ZOOM_VELOCITY 0.001
+#define STOP_PAN_VELOCITY 1.0
+// Zooming out stops once the shorter side is this small
+#define MIN_VIEW_SIZE 16.0f
+
+void view_motion_init(view_motion_t* motion) {
+	memset(motion, 0, sizeof(*motion));
+}
+
+static void sync_from(view_motion_t* motion, const app_data_t* app_data) {
+	if (motion->v_x == app_data->v_x && motion->v_y == app_data->v_y && motion->im_width == app_data->im_width &&
+	    motion->im_height == app_data->im_height) {
+		return;
+	}
+	motion->x = app_data->v_x;
+	motion->y = app_data->v_y;
+	motion->width = app_data->im_width;
+	motion->height = app_data->im_height;
+}
+
+static double ease(double velocity, double target, double dt) {
+	return velocity + (target - velocity) * (1.0 - exp(-dt / EASE_SECONDS));
+}
+
+bool view_motion_update(view_motion_t* motion, app_data_t* app_data, int32_t zoom, int32_t pan_x, int32_t pan_y, double time) {
+	double dt = time - motion->last_time;
+	motion->last_time = time;
+	bool held = zoom != 0 || pan_x != 0 || pan_y != 0;
+	if (!motion->moving && !held) {
+		return false;
+	}
+	if (!motion->moving) {
+		dt = FIRST_STEP_SECONDS;
+	} else if (dt > MAX_STEP_SECONDS) {
+		dt = MAX_STEP_SECONDS;
+	}
+
+	motion->zoom_velocity = ease(motion->zoom_velocity, zoom * ZOOM_SPEED, dt);
+	motion->pan_velocity_x = ease(motion->pan_velocity_x, pan_x * PAN_SPEED, dt);
+	motion->pan_velocity_y = ease(motion->pan_velocity_y, pan_y * PAN_SPEED, dt);
+	if (!held && fabs(motion->zoom_velocity) < STOP_ZOOM_VELOCITY && fabs(motion->pan_velocity_x) < STOP_PAN_VELOCITY &&
+	    fabs(motion->pan_velocity_y) < STOP_PAN_VELOCITY) {
+		motion->zoom_velocity = 0.0;
+		motion->pan_velocity_x = 0.0;
+		motion->pan_velocity_y = 0.0;
+		motion->moving = false;
+		return false;
+	}
+	motion->moving = true;
+
+	sync_from(motion, app_data);
+	// Zoom around the center of the image
+	float factor = expf((float)(motion->zoom_velocity * dt));
+	if (factor < 1.0f && fminf(motion->width, motion->height) * factor < MIN_VIEW_SIZE) {
+		factor = 1.0f;
+	}
+	float width = motion->width * factor;
+	float height = motion->height * factor;
+	motion->x -= (width - motion->width) / 2.0f;
+	motion->y -= (height - motion->height) / 2.0f;
+	motion->width = width;
+	motion->height = height;
+	motion->x += (float)(motion->pan_velocity_x * dt);
+	motion->y += (float)(motion->pan_velocity_y * dt);
+
+	app_data->v_x = motion->v_x = lroundf(motion->x);
+	app_data->v_y = motion->v_y = lroundf(motion->y);
+	app_data->im_width = motion->im_width = lroundf(motion->width);
+	app_data->im_height = motion->im_height = lroundf(motion->height);
+	glViewport(app_data->v_x, app_data->v_y, app_data->im_width, app_data->im_height);
+	check_resolution(app_data);
+	return true;
+}
@@ -0,0 +1,662 @@
+#include "compress.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <dirent.h>
+#include <utime.h>
+#endif
+
+#define STB_DXT_IMPLEMENTATION
+#include <stb/stb_dxt.h>
+
+#include "cpu.h"
+#include "md5.h"
+#include "tiles.h"
+#include "trace.h"
+
+#define MAX_LEVELS 32
+
+typedef struct block_cache_header_t {
+	char magic[4];
+	uint32_t version;
+	uint32_t compression;
+	int32_t channels;
+	int32_t full_width;
+	int32_t full_height;
+	int32_t mip_count;
+	float psnr;
+	uint64_t raw_bytes;
+} block_cache_header_t;
+
+static const char cache_magic[4] = {'I', 'M', 'B', 'C'};
+
+const char* compression_name(image_compression_t compression) {
+	switch (compression) {
+		case IMAGE_BC1:
+			return "BC1";
+		case IMAGE_BC3:
+			return "BC3";
+		default:
+			return "raw";
+	}
+}
+
+static char* default_cache_dir() {
+	const char* cache = getenv("XDG_CACHE_HOME");
+	const char* suffix = "/imeye/blocks/";
+	if (cache == NULL || cache[0] != '/') {
+		cache = getenv("HOME");
+		suffix = "/.cache/imeye/blocks/";
+	}
+	if (cache == NULL || cache[0] == '\0') {
+		return NULL;
+	}
+	char* dir = malloc(strlen(cache) + strlen(suffix) + 1);
+	if (dir != NULL) {
+		sprintf(dir, "%s%s", cache, suffix);
+	}
+	return dir;
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+static int make_dirs(char* dir) {
+	(void)dir;
+	return -1;
+}
+#else
+// Creates dir and its parents, dir has to end in a slash
+static int make_dirs(char* dir) {
+	for (char* c = dir + 1; *c != '\0'; c++) {
+		if (*c != '/') {
+			continue;
+		}
+		*c = '\0';
+		struct stat st;
+		bool exists = stat(dir, &st) == 0 && S_ISDIR(st.st_mode);
+		if (!exists && mkdir(dir, 0700) != 0) {
+			fprintf(stderr, "Could not create block cache directory %s\n", dir);
+			*c = '/';
+			return -1;
+		}
+		*c = '/';
+	}
+	return 0;
+}
+#endif
+
+int compressor_init(compressor_t* compressor, int32_t max_size, const char* cache_dir) {
+	memset(compressor, 0, sizeof(*compressor));
+	compressor->max_size = max_size;
+	compressor->cache_limit = (uint64_t)BLOCK_CACHE_LIMIT_MB * 1024 * 1024;
+	size_t cpus = cpu_count();
+	compressor->threads = cpus < MAX_COMPRESS_THREADS ? cpus : MAX_COMPRESS_THREADS;
+	if (cache_dir != NULL) {
+		size_t length = strlen(cache_dir);
+		compressor->cache_dir = malloc(length + 2);
+		if (compressor->cache_dir != NULL) {
+			sprintf(compressor->cache_dir, "%s%s", cache_dir, length > 0 && cache_dir[length - 1] == '/' ? "" : "/");
+		}
+	} else {
+		compressor->cache_dir = default_cache_dir();
+	}
+	// Still worth compressing without a cache, it only costs the encode every time
+	if (compressor->cache_dir != NULL && make_dirs(compressor->cache_dir) != 0) {
+		free(compressor->cache_dir);
+		compressor->cache_dir = NULL;
+	}
+	pthread_mutex_init(&compressor->lock, NULL);
+	return 0;
+}
+
+void compressor_destroy(compressor_t* compressor) {
+	free(compressor->cache_dir);
+	pthread_mutex_destroy(&compressor->lock);
+}
+
+int block_key(const char* path, unsigned char key[16]) {
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		return -1;
+	}
+#if defined(_WIN32) || defined(_WIN64)
+	int64_t mtime = (int64_t)st.st_mtime * 1000000000;
+#else
+	int64_t mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+	// Every decode asks for a key, so it's made from what stat() says instead of reading the whole file
+	int64_t identity[4] = {(int64_t)st.st_dev, (int64_t)st.st_ino, (int64_t)st.st_size, mtime};
+	md5_t md5;
+	md5_init(&md5);
+	md5_update(&md5, path, strlen(path));
+	md5_update(&md5, identity, sizeof(identity));
+	md5_final(&md5, key);
+	return 0;
+}
+
+// Colour endpoints are RGB565, expanded the way the hardware does
+static void unpack_565(uint16_t color, unsigned char rgb[3]) {
+	int32_t r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+	rgb[0] = (unsigned char)((r << 3) | (r >> 2));
+	rgb[1] = (unsigned char)((g << 2) | (g >> 4));
+	rgb[2] = (unsigned char)((b << 3) | (b >> 2));
+}
+
+// BC1 blocks with color0 <= color1 have a transparent fourth colour, BC3 colour never does
+static void decode_color(const unsigned char* block, bool bc1, unsigned char rgba[64]) {
+	uint16_t c0 = block[0] | block[1] << 8;
+	uint16_t c1 = block[2] | block[3] << 8;
+	unsigned char palette[4][4];
+	unpack_565(c0, palette[0]);
+	unpack_565(c1, palette[1]);
+	palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+	for (int32_t c = 0; c < 3; c++) {
+		if (c0 > c1 || !bc1) {
+			palette[2][c] = (unsigned char)((2 * palette[0][c] + palette[1][c]) / 3);
+			palette[3][c] = (unsigned char)((palette[0][c] + 2 * palette[1][c]) / 3);
+		} else {
+			palette[2][c] = (unsigned char)((palette[0][c] + palette[1][c]) / 2);
+			palette[3][c] = 0;
+		}
+	}
+	if (c0 <= c1 && bc1) {
+		palette[3][3] = 0;
+	}
+	uint32_t indices = block[4] | block[5] << 8 | block[6] << 16 | (uint32_t)block[7] << 24;
+	for (int32_t i = 0; i < 16; i++) {
+		memcpy(rgba + i * 4, palette[(indices >> (2 * i)) & 3], 4);
+	}
+}
+
+static void decode_alpha(const unsigned char* block, unsigned char rgba[64]) {
+	unsigned char palette[8];
+	palette[0] = block[0];
+	palette[1] = block[1];
+	if (palette[0] > palette[1]) {
+		for (int32_t i = 1; i < 7; i++) {
+			palette[i + 1] = (unsigned char)(((7 - i) * palette[0] + i * palette[1]) / 7);
+		}
+	} else {
+		for (int32_t i = 1; i < 5; i++) {
+			palette[i + 1] = (unsigned char)(((5 - i) * palette[0] + i * palette[1]) / 5);
+		}
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+	uint64_t indices = 0;
+	for (int32_t i = 0; i < 6; i++) {
+		indices |= (uint64_t)block[2 + i] << (8 * i);
+	}
+	for (int32_t i = 0; i < 16; i++) {
+		rgba[i * 4 + 3] = palette[(indices >> (3 * i)) & 7];
+	}
+}
+
+static void decode_block(const unsigned char* block, image_compression_t compression, unsigned char rgba[64]) {
+	if (compression == IMAGE_BC3) {
+		decode_color(block + 8, false, rgba);
+		decode_alpha(block, rgba);
+	} else {
+		decode_color(block, true, rgba);
+	}
+}
+
+int decompress_level(const image_t* level, unsigned char* rgba) {
+	if (level->compression == IMAGE_RAW) {
+		return -1;
+	}
+	size_t block_bytes = level->compression == IMAGE_BC1 ? 8 : 16;
+	int32_t columns = (level->width + 3) / 4;
+	int32_t rows = (level->height + 3) / 4;
+	for (int32_t by = 0; by < rows; by++) {
+		for (int32_t bx = 0; bx < columns; bx++) {
+			unsigned char texels[64];
+			decode_block(level->pixels + ((size_t)by * columns + bx) * block_bytes, level->compression, texels);
+			for (int32_t y = 0; y < 4 && by * 4 + y < level->height; y++) {
+				for (int32_t x = 0; x < 4 && bx * 4 + x < level->width; x++) {
+					memcpy(rgba + ((size_t)(by * 4 + y) * level->width + bx * 4 + x) * 4, texels + (y * 4 + x) * 4, 4);
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+// Any channel count as RGBA, grey spread over RGB and opaque without alpha
+static void load_texel(const unsigned char* src, int32_t channels, unsigned char* rgba) {
+	if (channels >= 3) {
+		rgba[0] = src[0];
+		rgba[1] = src[1];
+		rgba[2] = src[2];
+	} else {
+		rgba[0] = rgba[1] = rgba[2] = src[0];
+	}
+	rgba[3] = channels == 4 ? src[3] : channels == 2 ? src[1] : 255;
+}
+
+typedef struct compress_job_t {
+	const image_t* levels[MAX_LEVELS];
+	unsigned char* blocks[MAX_LEVELS];
+	// Block rows of every level before this one, a thread's work is found by row
+	int32_t first_row[MAX_LEVELS + 1];
+	int32_t level_count;
+	image_compression_t compression;
+	int32_t next_row;
+	// Squared error summed over level 0, and the values it covers
+	double error;
+	uint64_t samples;
+	pthread_mutex_t lock;
+} compress_job_t;
+
+// Encodes one row of blocks, measuring the error of level 0 as it goes
+static void encode_row(compress_job_t* job, int32_t level_index, int32_t by, double* error, uint64_t* samples) {
+	const image_t* level = job->levels[level_index];
+	bool alpha = job->compression == IMAGE_BC3;
+	size_t block_bytes = alpha ? 16 : 8;
+	int32_t columns = (level->width + 3) / 4;
+	unsigned char* out = job->blocks[level_index] + (size_t)by * columns * block_bytes;
+	for (int32_t bx = 0; bx < columns; bx++, out += block_bytes) {
+		// Edge blocks repeat the last row and column
+		unsigned char rgba[64];
+		for (int32_t y = 0; y < 4; y++) {
+			int32_t sy = by * 4 + y < level->height ? by * 4 + y : level->height - 1;
+			for (int32_t x = 0; x < 4; x++) {
+				int32_t sx = bx * 4 + x < level->width ? bx * 4 + x : level->width - 1;
+				load_texel(level->pixels + ((size_t)sy * level->width + sx) * level->channels, level->channels,
+				           rgba + (y * 4 + x) * 4);
+			}
+		}
+		stb_compress_dxt_block(out, rgba, alpha, STB_DXT_HIGHQUAL);
+		if (level_index != 0) {
+			continue;
+		}
+		unsigned char decoded[64];
+		decode_block(out, job->compression, decoded);
+		int32_t compared = alpha ? 4 : 3;
+		for (int32_t y = 0; y < 4 && by * 4 + y < level->height; y++) {
+			for (int32_t x = 0; x < 4 && bx * 4 + x < level->width; x++) {
+				for (int32_t c = 0; c < compared; c++) {
+					double difference = (double)rgba[(y * 4 + x) * 4 + c] - decoded[(y * 4 + x) * 4 + c];
+					*error += difference * difference;
+				}
+				*samples += compared;
+			}
+		}
+	}
+}
+
+static void* compress_worker(void* arg) {
+	compress_job_t* job = arg;
+	double error = 0.0;
+	uint64_t samples = 0;
+	int32_t total = job->first_row[job->level_count];
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		int32_t start = job->next_row;
+		job->next_row += COMPRESS_CHUNK_ROWS;
+		pthread_mutex_unlock(&job->lock);
+		if (start >= total) {
+			break;
+		}
+		int32_t end = start + COMPRESS_CHUNK_ROWS < total ? start + COMPRESS_CHUNK_ROWS : total;
+		uint64_t span = trace_begin();
+		int32_t level = 0;
+		for (int32_t row = start; row < end; row++) {
+			while (row >= job->first_row[level + 1]) {
+				level++;
+			}
+			encode_row(job, level, row - job->first_row[level], &error, &samples);
+		}
+		trace_end("compress", span);
+	}
+	pthread_mutex_lock(&job->lock);
+	job->error += error;
+	job->samples += samples;
+	pthread_mutex_unlock(&job->lock);
+	return NULL;
+}
+
+static void* compress_thread(void* arg) {
+	trace_thread_name("compress");
+	return compress_worker(arg);
+}
+
+static bool has_alpha(const image_t* image) {
+	if (image->channels != 2 && image->channels != 4) {
+		return false;
+	}
+	size_t count = (size_t)image->width * image->height;
+	const unsigned char* alpha = image->pixels + image->channels - 1;
+	for (size_t i = 0; i < count; i++, alpha += image->channels) {
+		if (*alpha != 255) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int compress_levels(image_t* image, size_t threads, compress_report_t* report) {
+	// BC1 and BC3 hold 8 bit colour, half float images would lose what they're kept for
+	if (image->compression != IMAGE_RAW || image->sample != IMAGE_UNORM8 || image->mip_count + 1 > MAX_LEVELS) {
+		return -1;
+	}
+	double start = (double)trace_now();
+	compress_job_t job = {
+		.level_count = image->mip_count + 1,
+		.compression = has_alpha(image) ? IMAGE_BC3 : IMAGE_BC1,
+	};
+	size_t block_bytes = job.compression == IMAGE_BC1 ? 8 : 16;
+	for (int32_t i = 0; i < job.level_count; i++) {
+		const image_t* level = image_level(image, i);
+		int32_t rows = (level->height + 3) / 4;
+		job.levels[i] = level;
+		job.first_row[i + 1] = job.first_row[i] + rows;
+		job.blocks[i] = malloc((size_t)rows * ((level->width + 3) / 4) * block_bytes);
+		if (job.blocks[i] == NULL) {
+			for (int32_t j = 0; j < i; j++) {
+				free(job.blocks[j]);
+			}
+			return -1;
+		}
+	}
+	pthread_mutex_init(&job.lock, NULL);
+
+	// The calling thread is one of the workers
+	if (threads > MAX_COMPRESS_THREADS) {
+		threads = MAX_COMPRESS_THREADS;
+	}
+	pthread_t workers[MAX_COMPRESS_THREADS];
+	size_t started = 0;
+	for (size_t i = 1; i < threads; i++) {
+		if (pthread_create(&workers[started], NULL, compress_thread, &job) == 0) {
+			started++;
+		}
+	}
+	compress_worker(&job);
+	for (size_t i = 0; i < started; i++) {
+		pthread_join(workers[i], NULL);
+	}
+	pthread_mutex_destroy(&job.lock);
+
+	report->compression = job.compression;
+	report->raw_bytes = image_memory(image);
+	double mse = job.samples > 0 ? job.error / job.samples : 0.0;
+	report->psnr = mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : INFINITY;
+	report->from_cache = false;
+	// Swapped in only now, the workers read every level's pixels until they're done
+	for (int32_t i = 0; i < job.level_count; i++) {
+		image_t* level = (image_t*)job.levels[i];
+		free(level->pixels);
+		level->pixels = job.blocks[i];
+		level->compression = job.compression;
+	}
+	report->compressed_bytes = image_memory(image);
+	report->seconds = ((double)trace_now() - start) / 1e9;
+	return 0;
+}
+
+static char* cache_path(const compressor_t* compressor, const unsigned char key[16]) {
+	char* path = malloc(strlen(compressor->cache_dir) + 32 + sizeof(".blocks"));
+	if (path == NULL) {
+		return NULL;
+	}
+	char* out = path + sprintf(path, "%s", compressor->cache_dir);
+	for (int32_t i = 0; i < 16; i++) {
+		out += sprintf(out, "%02x", key[i]);
+	}
+	strcpy(out, ".blocks");
+	return path;
+}
+
+// The header, the size of every level, then every level's blocks
+static int read_cache(FILE* file, image_t* image, block_cache_header_t* header) {
+	if (fread(header, sizeof(*header), 1, file) != 1 || memcmp(header->magic, cache_magic, 4) != 0 ||
+	    header->version != BLOCK_CACHE_VERSION || (header->compression != IMAGE_BC1 && header->compression != IMAGE_BC3) ||
+	    header->mip_count < 0 || header->mip_count + 1 > MAX_LEVELS) {
+		return -1;
+	}
+	int32_t sizes[2 * MAX_LEVELS];
+	if (fread(sizes, sizeof(int32_t), 2 * (header->mip_count + 1), file) != (size_t)(2 * (header->mip_count + 1))) {
+		return -1;
+	}
+	*image = (image_t){0};
+	if (header->mip_count > 0) {
+		image->mips = calloc(header->mip_count, sizeof(image_t));
+		if (image->mips == NULL) {
+			return -1;
+		}
+		image->mip_count = header->mip_count;
+	}
+	for (int32_t i = 0; i <= header->mip_count; i++) {
+		image_t* level = i == 0 ? image : &image->mips[i - 1];
+		level->width = sizes[2 * i];
+		level->height = sizes[2 * i + 1];
+		if (level->width <= 0 || level->height <= 0 || level->width > 65536 || level->height > 65536) {
+			free_image(image);
+			return -1;
+		}
+		level->channels = header->channels;
+		level->full_width = header->full_width;
+		level->full_height = header->full_height;
+		level->compression = (image_compression_t)header->compression;
+		size_t size = image_size(level);
+		level->pixels = malloc(size);
+		if (level->pixels == NULL || fread(level->pixels, 1, size, file) != size) {
+			free_image(image);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int compressor_load(compressor_t* compressor, const unsigned char key[16], image_t* image, compress_report_t* report) {
+	if (compressor->cache_dir == NULL) {
+		return -1;
+	}
+	char* file_path = cache_path(compressor, key);
+	if (file_path == NULL) {
+		return -1;
+	}
+	uint64_t start = trace_now();
+	FILE* file = fopen(file_path, "rb");
+	if (file == NULL) {
+		free(file_path);
+		return -1;
+	}
+	block_cache_header_t header;
+	int result = read_cache(file, image, &header);
+	fclose(file);
+#if !defined(_WIN32) && !defined(_WIN64)
+	// Trimming goes by modification time, a file read now shouldn't be the next to go
+	if (result == 0) {
+		utime(file_path, NULL);
+	}
+#endif
+	free(file_path);
+	if (result != 0) {
+		return -1;
+	}
+	report->compression = image->compression;
+	report->raw_bytes = header.raw_bytes;
+	report->compressed_bytes = image_memory(image);
+	report->psnr = header.psnr;
+	report->seconds = (trace_now() - start) / 1e9;
+	report->from_cache = true;
+
+	pthread_mutex_lock(&compressor->lock);
+	compressor->cache_hits++;
+	compressor->raw_bytes += report->raw_bytes;
+	compressor->compressed_bytes += report->compressed_bytes;
+	pthread_mutex_unlock(&compressor->lock);
+	return 0;
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+static void store_cache(const compressor_t* compressor, const unsigned char key[16], const image_t* image,
+                        const compress_report_t* report) {
+	(void)compressor;
+	(void)key;
+	(void)image;
+	(void)report;
+}
+#else
+typedef struct cache_file_t {
+	char* path;
+	uint64_t size;
+	int64_t mtime;
+} cache_file_t;
+
+static int compare_cache_files(const void* a, const void* b) {
+	const cache_file_t* x = a;
+	const cache_file_t* y = b;
+	return (x->mtime > y->mtime) - (x->mtime < y->mtime);
+}
+
+// Deletes the least recently used block files until the rest fit in the limit
+static void trim_cache(const compressor_t* compressor) {
+	DIR* dir = opendir(compressor->cache_dir);
+	if (dir == NULL) {
+		return;
+	}
+	cache_file_t* files = NULL;
+	size_t count = 0;
+	size_t capacity = 0;
+	uint64_t total = 0;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		// Temporary files still being written end in a random suffix instead
+		size_t length = strlen(entry->d_name);
+		if (length < sizeof(".blocks") || strcmp(entry->d_name + length - (sizeof(".blocks") - 1), ".blocks") != 0) {
+			continue;
+		}
+		if (count == capacity) {
+			capacity = capacity == 0 ? 64 : capacity * 2;
+			cache_file_t* grown = realloc(files, capacity * sizeof(cache_file_t));
+			if (grown == NULL) {
+				break;
+			}
+			files = grown;
+		}
+		char* path = malloc(strlen(compressor->cache_dir) + length + 1);
+		if (path == NULL) {
+			break;
+		}
+		sprintf(path, "%s%s", compressor->cache_dir, entry->d_name);
+		struct stat st;
+		if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+			free(path);
+			continue;
+		}
+		files[count].path = path;
+		files[count].size = (uint64_t)st.st_size;
+		files[count].mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+		total += files[count].size;
+		count++;
+	}
+	closedir(dir);
+
+	if (total > compressor->cache_limit) {
+		qsort(files, count, sizeof(cache_file_t), compare_cache_files);
+		for (size_t i = 0; i < count && total > compressor->cache_limit; i++) {
+			if (unlink(files[i].path) == 0) {
+				total -= files[i].size;
+			}
+		}
+	}
+	for (size_t i = 0; i < count; i++) {
+		free(files[i].path);
+	}
+	free(files);
+}
+
+// Written to a temporary file and renamed, so a reader never sees half of one
+static void store_cache(const compressor_t* compressor, const unsigned char key[16], const image_t* image,
+                        const compress_report_t* report) {
+	char* path = cache_path(compressor, key);
+	char* temp = path != NULL ? malloc(strlen(path) + sizeof(".XXXXXX")) : NULL;
+	if (temp == NULL) {
+		free(path);
+		return;
+	}
+	sprintf(temp, "%s.XXXXXX", path);
+	int fd = mkstemp(temp);
+	FILE* file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+	if (file == NULL) {
+		if (fd >= 0) {
+			close(fd);
+			unlink(temp);
+		}
+		free(temp);
+		free(path);
+		return;
+	}
+
+	block_cache_header_t header = {
+		.version = BLOCK_CACHE_VERSION,
+		.compression = image->compression,
+		.channels = image->channels,
+		.full_width = image->full_width,
+		.full_height = image->full_height,
+		.mip_count = image->mip_count,
+		.psnr = (float)report->psnr,
+		.raw_bytes = report->raw_bytes,
+	};
+	memcpy(header.magic, cache_magic, 4);
+	bool failed = fwrite(&header, sizeof(header), 1, file) != 1;
+	for (int32_t i = 0; i <= image->mip_count && !failed; i++) {
+		const image_t* level = image_level(image, i);
+		int32_t size[2] = {level->width, level->height};
+		failed = fwrite(size, sizeof(size), 1, file) != 1;
+	}
+	for (int32_t i = 0; i <= image->mip_count && !failed; i++) {
+		const image_t* level = image_level(image, i);
+		failed = fwrite(level->pixels, 1, image_size(level), file) != image_size(level);
+	}
+	failed = fclose(file) != 0 || failed;
+	if (failed || rename(temp, path) != 0) {
+		fprintf(stderr, "Failed to write block cache %s\n", path);
+		unlink(temp);
+	} else {
+		trim_cache(compressor);
+	}
+	free(temp);
+	free(path);
+}
+#endif
+
+int compressor_compress(compressor_t* compressor, const unsigned char key[16], image_t* image,
+                        compress_report_t* report) {
+	// Reduced decodes are replaced by a full one when zoomed in, tiled images are never one texture
+	if (image->compression != IMAGE_RAW || image->width != image->full_width ||
+	    (size_t)image->width * image->height < COMPRESS_MIN_PIXELS || image->width > compressor->max_size ||
+	    image->height > compressor->max_size || (size_t)image->width * image->height > TILED_MIN_PIXELS) {
+		return -1;
+	}
+	uint64_t start = trace_begin();
+	if (compress_levels(image, compressor->threads, report) != 0) {
+		return -1;
+	}
+	trace_end("compress_image", start);
+	if (key != NULL && compressor->cache_dir != NULL) {
+		store_cache(compressor, key, image, report);
+	}
+
+	pthread_mutex_lock(&compressor->lock);
+	compressor->encoded++;
+	compressor->raw_bytes += report->raw_bytes;
+	compressor->compressed_bytes += report->compressed_bytes;
+	pthread_mutex_unlock(&compressor->lock);
+	return 0;
+}
+
+void print_compress_report(const char* path, const compress_report_t* report) {
+	printf("%s %s: %.1f MB -> %.1f MB (%.1fx), PSNR %.2f dB, %s in %.0f ms\n", compression_name(report->compression),
+	       path, report->raw_bytes / (1024.0 * 1024.0), report->compressed_bytes / (1024.0 * 1024.0),
+	       report->compressed_bytes > 0 ? (double)report->raw_bytes / report->compressed_bytes : 0.0, report->psnr,
+	       report->from_cache ? "loaded" : "encoded", report->seconds * 1e3);
+}
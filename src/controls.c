@@ -8,6 +8,11 @@
 #include <math.h>
 
 #include "image.h"
+#include "texcache.h"
+#include "uploader.h"
+#include "tiles.h"
+#include "sniff.h"
+#include "trace.h"
 
 #define MARGIN 100
 
@@ -15,43 +20,16 @@
 
 float get_scale(uint32_t prev_width, uint32_t prev_height, uint32_t width, uint32_t height);
 
-void zoom_(zoom_t zoom, app_data_t* app_data) {
-    if (zoom == ZOOM_IN) {
-        app_data->scale += 0.01f;
-    } else if (zoom == ZOOM_OUT) {
-        app_data->scale -= 0.01f;
-    } else {
-        fprintf(stderr, "Invalid zoom value\n");
-        exit(EXIT_FAILURE);
+void check_resolution(app_data_t* app_data) {
+    if (app_data->refining || app_data->texture_width >= app_data->full_width) {
+        return;
     }
-    int prev_width = app_data->im_width;
-    int prev_height = app_data->im_height;
-    app_data->im_width *= app_data->scale;
-    app_data->im_height *= app_data->scale;
-    app_data->v_x -= (app_data->im_width - prev_width) / 2;
-    app_data->v_y -= (app_data->im_height - prev_height) / 2;
-    glViewport(app_data->v_x, app_data->v_y, app_data->im_width, app_data->im_height);
-}
-
-void move(direction_t direction, app_data_t* app_data) {
-    switch (direction) {
-        case UP:
-            app_data->v_y += 1;
-            break;
-        case DOWN:
-            app_data->v_y -= 1;
-            break;
-        case LEFT:
-            app_data->v_x -= 1;
-            break;
-        case RIGHT:
-            app_data->v_x += 1;
-            break;
-        default:
-            fprintf(stderr, "Invalid direction value\n");
-            exit(EXIT_FAILURE);
+    // Zoomed in past the reduced decode, fetch the full resolution image
+    int32_t on_screen = app_data->rotation % 180 == 0 ? app_data->im_width : app_data->im_height;
+    if (on_screen > app_data->texture_width) {
+        app_data->refining = true;
+        prefetch_request_full(app_data->prefetch, app_data->image_index);
     }
-    glViewport(app_data->v_x, app_data->v_y, app_data->im_width, app_data->im_height);
 }
 
 void fullscreen(app_data_t* app_data, GLFWwindow* window, GLFWmonitor* monitor) {
@@ -66,29 +44,356 @@ void fullscreen(app_data_t* app_data, GLFWwindow* window, GLFWmonitor* monitor)
     app_data->fullscreen = !app_data->fullscreen;
 }
 
+// Tiled right away or handed to the uploader
+static void use_image(app_data_t* app_data, image_t image) {
+    if (needs_tiling(&image)) {
+        int32_t texture_width = image.width;
+        int32_t width = image.full_width;
+        int32_t height = image.full_height;
+        bool hdr = image.hdr;
+        tiled_image_t* tiled = malloc(sizeof(tiled_image_t));
+        if (tiled == NULL || tiled_image_init(tiled, &image) != 0) {
+            free(tiled);
+            free_image(&image);
+            return;
+        }
+        show_image(app_data, 0, tiled, texture_width, width, height, hdr);
+        return;
+    }
+    // The previous image stays on screen until poll_uploads() sees the new texture
+    app_data->loading = true;
+    uploader_submit(app_data->uploader, app_data->image_path, &image);
+}
+
 void switch_image(control_t control, app_data_t* app_data, GLFWwindow* window) {
-    app_data->rotation = 0;
-    if (app_data->image_count == 0 || app_data->image_count == 1) {
+    (void)window;
+    size_t image_count = app_data->images->count;
+    if (image_count == 0 || image_count == 1) {
         return;
     }
-    if (control == NEXT) {
-        app_data->image_index++;
-        if (app_data->image_index >= app_data->image_count) {
-            app_data->image_index = 0;
-        }
-    } else if (control == PREVIOUS) {
-        if (app_data->image_index == 0) {
-            app_data->image_index = app_data->image_count - 1;
+    if (control != NEXT && control != PREVIOUS) {
+        fprintf(stderr, "Invalid control value\n");
+        exit(EXIT_FAILURE);
+    }
+    // Files that can't be decoded are stepped over
+    size_t index = app_data->image_index;
+    for (size_t tries = 1; tries < image_count; tries++) {
+        if (control == NEXT) {
+            index = index + 1 < image_count ? index + 1 : 0;
         } else {
-            app_data->image_index--;
+            index = index > 0 ? index - 1 : image_count - 1;
+        }
+        if (open_image(app_data, index, control == NEXT ? 1 : -1) == 0) {
+            return;
         }
+    }
+}
+
+static void set_image_path(app_data_t* app_data, size_t index, char* path) {
+    app_data->image_index = index;
+    free(app_data->image_path);
+    app_data->image_path = path;
+    app_data->refining = false;
+    app_data->loading = false;
+    app_data->decoding = false;
+}
+
+int open_image(app_data_t* app_data, size_t index, int direction) {
+    char* path = path_table_path(app_data->images, index);
+    if (path == NULL) {
+        return -1;
+    }
+    uint64_t start = trace_begin();
+    // Recenter the prefetch window first so the worker doesn't decode the image we're about to take
+    prefetch_update(app_data->prefetch, index, direction);
+    int result = 0;
+    texture_entry_t cached;
+    image_t image;
+    if (texture_cache_get(app_data->textures, path, &cached)) {
+        set_image_path(app_data, index, path);
+        show_image(app_data, cached.texture, NULL, cached.width, cached.full_width, cached.full_height, cached.hdr);
+    } else if (prefetch_take(app_data->prefetch, index, &image) == 0) {
+        set_image_path(app_data, index, path);
+        use_image(app_data, image);
     } else {
-        fprintf(stderr, "Invalid control value\n");
-        exit(EXIT_FAILURE);
+        // The previous image stays on screen, so it stays the current one too
+        prefetch_update(app_data->prefetch, app_data->image_index, direction);
+        free(path);
+        result = -1;
+    }
+    trace_end("open_image", start);
+    return result;
+}
+
+static int start_grid(app_data_t* app_data) {
+    thumbnailer_t* thumbnailer = malloc(sizeof(thumbnailer_t));
+    if (thumbnailer == NULL || thumbnailer_init(thumbnailer, 0, glfwPostEmptyEvent) != 0) {
+        free(thumbnailer);
+        return -1;
+    }
+    grid_view_t* grid = malloc(sizeof(grid_view_t));
+    if (grid == NULL || grid_view_init(grid, thumbnailer) != 0) {
+        fprintf(stderr, "Failed to create the grid view\n");
+        free(grid);
+        thumbnailer_destroy(thumbnailer);
+        free(thumbnailer);
+        return -1;
+    }
+    app_data->thumbnailer = thumbnailer;
+    app_data->grid = grid;
+    return 0;
+}
+
+void toggle_grid(app_data_t* app_data) {
+    app_data->dirty = true;
+    if (app_data->in_grid) {
+        app_data->in_grid = false;
+        // The grid drew over the whole framebuffer, put the image's viewport back
+        glViewport(app_data->v_x, app_data->v_y, app_data->im_width, app_data->im_height);
+        size_t selected = app_data->grid->selected;
+        if (selected != app_data->image_index && selected < app_data->images->count) {
+            open_image(app_data, selected, selected > app_data->image_index ? 1 : -1);
+        }
+        return;
     }
+    if (app_data->grid == NULL && start_grid(app_data) != 0) {
+        return;
+    }
+    app_data->in_grid = true;
+    grid_view_select(app_data->grid, app_data->images, app_data->image_index);
+}
+
+void reload_image(app_data_t* app_data) {
+    app_data->refining = false;
+    app_data->loading = false;
+    // Decoded in the background, the old version stays on screen until poll_uploads() has the new one
+    app_data->decoding = true;
+    prefetch_request_center(app_data->prefetch);
+}
+
+// The reduced image stays, and isn't refined again until it's reopened
+static void stop_refining(app_data_t* app_data) {
+    app_data->refining = false;
+    app_data->full_width = app_data->texture_width;
+}
+
+void poll_uploads(app_data_t* app_data) {
+    const char* path = app_data->image_path;
+    image_t image;
+    if (app_data->decoding) {
+        int result = prefetch_poll(app_data->prefetch, app_data->image_index, &image);
+        if (result != 0) {
+            app_data->decoding = false;
+        }
+        if (result > 0) {
+            use_image(app_data, image);
+        } else if (result < 0 && app_data->loading) {
+            // Nothing of it on screen yet, same as failing before the window existed
+            glfwSetWindowShouldClose(app_data->window, GLFW_TRUE);
+        }
+    }
+    int full = prefetch_poll_full(app_data->prefetch, app_data->image_index, &image);
+    if (full > 0) {
+        if (needs_tiling(&image)) {
+            tiled_image_t* tiled = malloc(sizeof(tiled_image_t));
+            int32_t texture_width = image.width;
+            bool hdr = image.hdr;
+            if (tiled != NULL && tiled_image_init(tiled, &image) == 0) {
+                replace_image(app_data, 0, tiled, texture_width, hdr);
+            } else {
+                free(tiled);
+                free_image(&image);
+                stop_refining(app_data);
+            }
+        } else {
+            uploader_submit(app_data->uploader, path, &image);
+        }
+    } else if (full < 0) {
+        stop_refining(app_data);
+    }
+
+    upload_result_t upload;
+    if (!uploader_poll(app_data->uploader, &upload)) {
+        return;
+    }
+    if (upload.texture == 0) {
+        fprintf(stderr, "Failed to upload image: %s\n", upload.path);
+        // The previous texture stays on screen
+        if (strcmp(upload.path, path) == 0) {
+            app_data->loading = false;
+            if (app_data->refining) {
+                stop_refining(app_data);
+            }
+        }
+        free(upload.path);
+        return;
+    }
+    texture_entry_t entry = {
+        .texture = upload.texture,
+        .width = upload.width,
+        .height = upload.height,
+        .full_width = upload.full_width,
+        .full_height = upload.full_height,
+        .bytes = upload.bytes,
+        .hdr = upload.hdr,
+        .mtime = upload.mtime,
+    };
+    if (texture_cache_put(app_data->textures, upload.path, &entry) != 0) {
+        if (strcmp(upload.path, path) == 0) {
+            app_data->loading = false;
+            if (app_data->refining) {
+                stop_refining(app_data);
+            }
+        }
+        free(upload.path);
+        return;
+    }
+    // The user may have moved on while this was uploading, it's cached for when they come back
+    if (strcmp(upload.path, path) == 0) {
+        if (app_data->refining) {
+            replace_image(app_data, upload.texture, NULL, upload.width, upload.hdr);
+        } else {
+            show_image(app_data, upload.texture, NULL, upload.width, upload.full_width, upload.full_height, upload.hdr);
+        }
+    }
+    free(upload.path);
+}
+
+// Entries land and go around the current image, so find it again by name
+static void find_current(app_data_t* app_data) {
+    size_t index = path_table_find(app_data->images, app_data->image_path);
+    if (index < app_data->images->count) {
+        app_data->image_index = index;
+    }
+}
+
+static void apply_watch(app_data_t* app_data) {
+    path_table_t rewritten = {0};
+    prefetch_paths_begin(app_data->prefetch);
+    if (dir_watch_apply(app_data->watch, app_data->images, path_file_name(app_data->image_path), &rewritten)) {
+        find_current(app_data);
+    }
+    prefetch_paths_end(app_data->prefetch, app_data->image_index);
+
+    bool reload = false;
+    for (size_t i = 0; i < rewritten.count; i++) {
+        size_t index = path_table_find(app_data->images, path_table_name(&rewritten, i));
+        char* path = index < app_data->images->count ? path_table_path(app_data->images, index) : NULL;
+        if (path == NULL) {
+            continue;
+        }
+        prefetch_invalidate(app_data->prefetch, path);
+        texture_cache_invalidate(app_data->textures, path);
+        reload = reload || index == app_data->image_index;
+        free(path);
+    }
+    path_table_destroy(&rewritten);
+    if (reload) {
+        reload_image(app_data);
+    }
+}
+
+void poll_directory(app_data_t* app_data) {
+    if (app_data->watch != NULL && dir_watch_ready(app_data->watch)) {
+        apply_watch(app_data);
+    }
+    if (app_data->scan == NULL) {
+        return;
+    }
+    if (dir_scan_ready(app_data->scan)) {
+        prefetch_paths_begin(app_data->prefetch);
+        if (dir_scan_merge(app_data->scan, app_data->images)) {
+            find_current(app_data);
+        }
+        prefetch_paths_end(app_data->prefetch, app_data->image_index);
+    }
+    if (dir_scan_done(app_data->scan)) {
+        dir_scan_destroy(app_data->scan);
+        app_data->scan = NULL;
+    }
+}
+
+void poll_animation(app_data_t* app_data) {
+    if (app_data->gif == NULL || app_data->in_grid) {
+        return;
+    }
+    uint32_t frame;
+    if (gif_player_poll(app_data->gif, glfwGetTime(), &frame)) {
+        // Straight to the frame, the cache keeps the first frame's texture as the current one
+        app_data->texture = frame;
+        glBindTexture(GL_TEXTURE_2D, frame);
+        app_data->dirty = true;
+    }
+}
+
+void stop_animation(app_data_t* app_data) {
+    if (app_data->gif == NULL) {
+        return;
+    }
+    gif_player_stop(app_data->gif);
+    free(app_data->gif);
+    app_data->gif = NULL;
+}
+
+// The first frame is decoded and shown like any other image, the player takes over from there
+static void start_animation(app_data_t* app_data) {
+    image_type_t type = sniff_extension(path_file_name(app_data->image_path));
+    if (app_data->tiled != NULL || (type != TYPE_GIF && type != TYPE_UNKNOWN)) {
+        return;
+    }
+    gif_player_t* player = malloc(sizeof(gif_player_t));
+    if (player == NULL || gif_player_start(player, app_data->image_path, glfwPostEmptyEvent) != 0) {
+        free(player);
+        return;
+    }
+    app_data->gif = player;
+}
+
+// The path, and the exposure while it's not 0
+static void update_title(app_data_t* app_data) {
+    free(app_data->title);
+    app_data->title = malloc(sizeof(char) * (strlen(app_data->image_path) + sizeof("imeye - ") + sizeof(" (+10.0 EV)")));
+    if (app_data->title == NULL) {
+        return;
+    }
+    int length = sprintf(app_data->title, "imeye - %s", app_data->image_path);
+    if (app_data->exposure != 0.0f) {
+        sprintf(app_data->title + length, " (%+.1f EV)", app_data->exposure);
+    }
+    glfwSetWindowTitle(app_data->window, app_data->title);
+}
+
+static void set_texture(app_data_t* app_data, uint32_t texture, tiled_image_t* tiled, int32_t texture_width, bool hdr) {
+    stop_animation(app_data);
+    if (app_data->tiled != NULL) {
+        tiled_image_destroy(app_data->tiled);
+        free(app_data->tiled);
+    }
+    app_data->tiled = tiled;
+    app_data->texture = texture;
+    app_data->texture_width = texture_width;
+    app_data->hdr = hdr;
+    app_data->dirty = true;
+    texture_cache_set_current(app_data->textures, texture);
+    glBindTexture(GL_TEXTURE_2D, app_data->texture);
+}
+
+void replace_image(app_data_t* app_data, uint32_t texture, tiled_image_t* tiled, int32_t texture_width, bool hdr) {
+    // Same image at a higher resolution, the view stays as it is
+    app_data->refining = false;
+    set_texture(app_data, texture, tiled, texture_width, hdr);
+}
+
+void show_image(app_data_t* app_data, uint32_t texture, tiled_image_t* tiled, int32_t texture_width, int32_t width, int32_t height,
+                bool hdr) {
+    app_data->rotation = 0;
+    app_data->loading = false;
     uint32_t prev_width = app_data->im_width;
     uint32_t prev_height = app_data->im_height;
-    app_data->texture = get_image(app_data->image_paths[app_data->image_index], &app_data->im_width, &app_data->im_height);
+    set_texture(app_data, texture, tiled, texture_width, hdr);
+    app_data->full_width = width;
+    app_data->im_width = width;
+    app_data->im_height = height;
     // Scale the image to maintain aspect ratio and the scale of previous image
     float new_scale = get_scale(prev_width, prev_height, app_data->im_width, app_data->im_height);
     app_data->im_width *= new_scale;
@@ -99,10 +404,9 @@ void switch_image(control_t control, app_data_t* app_data, GLFWwindow* window) {
     app_data->v_x = prev_center_x - app_data->im_width / 2;
     app_data->v_y = prev_center_y - app_data->im_height / 2;
     glViewport(app_data->v_x, app_data->v_y, app_data->im_width, app_data->im_height);
-    free(app_data->title);
-    app_data->title = malloc(sizeof(char) * (strlen(app_data->image_paths[app_data->image_index]) + sizeof("imeye - ")));
-    sprintf(app_data->title, "imeye - %s", app_data->image_paths[app_data->image_index]);
-    glfwSetWindowTitle(window, app_data->title);
+    update_title(app_data);
+    check_resolution(app_data);
+    start_animation(app_data);
 }
 
 float get_scale(uint32_t prev_width, uint32_t prev_height, uint32_t width, uint32_t height) {
@@ -178,3 +482,15 @@ void rotate(rotate_direction_t direction, app_data_t* app_data) {
     glViewport(app_data->v_x, app_data->v_y, app_data->im_width, app_data->im_height);
     app_data->rotation %= 360;
 }
+
+void adjust_exposure(app_data_t* app_data, int32_t steps) {
+    float exposure = steps == 0 ? 0.0f : app_data->exposure + steps * EXPOSURE_STEP;
+    exposure = fminf(fmaxf(exposure, -MAX_EXPOSURE), MAX_EXPOSURE);
+    if (exposure == app_data->exposure) {
+        return;
+    }
+    // Only a uniform changes, the texture stays as it is
+    app_data->exposure = exposure;
+    app_data->dirty = true;
+    update_title(app_data);
+}
@@ -0,0 +1,18 @@
+#include "cpu.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+size_t cpu_count() {
+#if defined(_WIN32) || defined(_WIN64)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	long cpus = (long)info.dwNumberOfProcessors;
+#else
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return cpus > 0 ? (size_t)cpus : 1;
+}
@@ -1,93 +1,605 @@
 #include "dir_splore.h"
+#include "sniff.h"
+#include "trace.h"
 #include <stdlib.h>
 #include <string.h>
-#include <dirent.h>
 #include <stdio.h>
+#include <pthread.h>
 
-char* images[1024];
+#ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <dirent.h>
+#endif
 
-char* parent_directory(const char* filepath) {
-	size_t last_slash = 0;
-	size_t file_len = strlen(filepath);
-	for (size_t i = file_len; i > 0; i--) {
-		if (filepath[i] == '/' || filepath[i] == '\\') {
-			last_slash = i;
-			break;
+#if defined(_WIN32) || defined(_WIN64)
+#define SEPARATOR '\\'
+#else
+#define SEPARATOR '/'
+#endif
+
+typedef int (*scan_batch_fn)(void* context, path_table_t* batch);
+
+#define INITIAL_ENTRIES 256
+#define INITIAL_NAMES (16 * 1024)
+
+// Directory of filepath including the trailing separator
+static char* parent_directory(const char* filepath) {
+	const char* last_slash = NULL;
+	for (const char* c = filepath; *c != '\0'; c++) {
+		if (*c == '/' || *c == '\\') {
+			last_slash = c;
 		}
 	}
 
-	if (last_slash == 0) {
-		char* dot = malloc(2);
-		dot[0] = '.'; dot[1] = '\0';
+	if (last_slash == NULL) {
+		char* dot = malloc(3);
+		if (dot != NULL) {
+			dot[0] = '.'; dot[1] = SEPARATOR; dot[2] = '\0';
+		}
 		return dot;
 	}
 
-	char* parent = malloc(last_slash + 1);
-	memcpy(parent, filepath, last_slash);
-	parent[last_slash] = '\0';
+	size_t length = last_slash - filepath + 1;
+	char* parent = malloc(length + 1);
+	if (parent != NULL) {
+		memcpy(parent, filepath, length);
+		parent[length] = '\0';
+	}
 	return parent;
 }
 
-int compare_strings(const void* a, const void* b) {
-	char* a_copy = strdup(*(char**)a);
-	char* b_copy = strdup(*(char**)b);
+const char* path_file_name(const char* path) {
+	const char* name = path;
+	for (const char* c = path; *c != '\0'; c++) {
+		if (*c == '/' || *c == '\\') {
+			name = c + 1;
+		}
+	}
+	return name;
+}
+
+static bool is_image_type(image_type_t type) {
+	return type != TYPE_UNKNOWN && type != TYPE_NOT_IMAGE;
+}
+
+// Names are ordered without their last four characters, so "a.png" comes before "a1.png"
+static size_t stem_length(const char* name) {
+	size_t len = strlen(name);
+	return len > 4 ? len - 4 : len;
+}
+
+static int compare_stems(const char* a, size_t a_len, const char* b, size_t b_len) {
+	size_t len = a_len < b_len ? a_len : b_len;
+	int result = memcmp(a, b, len);
+	if (result != 0) {
+		return result;
+	}
+	return (a_len > b_len) - (a_len < b_len);
+}
+
+static int compare_names(const char* a, const char* b) {
+	return compare_stems(a, stem_length(a), b, stem_length(b));
+}
+
+// Room for entries more offsets and name_bytes more bytes of names
+static int reserve(path_table_t* table, size_t entries, size_t name_bytes) {
+	if (table->count + entries > table->capacity) {
+		size_t capacity = table->capacity == 0 ? INITIAL_ENTRIES : table->capacity;
+		while (table->count + entries > capacity) {
+			capacity *= 2;
+		}
+		uint32_t* offsets = realloc(table->offsets, capacity * sizeof(uint32_t));
+		if (offsets == NULL) {
+			return -1;
+		}
+		table->offsets = offsets;
+		table->capacity = capacity;
+	}
+	if (table->names_size + name_bytes > table->names_capacity) {
+		size_t capacity = table->names_capacity == 0 ? INITIAL_NAMES : table->names_capacity;
+		while (table->names_size + name_bytes > capacity) {
+			capacity *= 2;
+		}
+		if (capacity > UINT32_MAX) {
+			return -1;
+		}
+		char* names = realloc(table->names, capacity);
+		if (names == NULL) {
+			return -1;
+		}
+		table->names = names;
+		table->names_capacity = capacity;
+	}
+	return 0;
+}
+
+static int add_name(path_table_t* table, const char* name, size_t len) {
+	if (reserve(table, 1, len + 1) != 0) {
+		return -1;
+	}
+	memcpy(table->names + table->names_size, name, len + 1);
+	table->offsets[table->count++] = (uint32_t)table->names_size;
+	table->names_size += len + 1;
+	return 0;
+}
+
+// Sorts an entry into table by its extension, or into unknown for add_sniffed() to look at
+static int add_entry(path_table_t* table, path_table_t* unknown, const char* name, size_t len) {
+	image_type_t type = sniff_extension(name);
+	if (type == TYPE_UNKNOWN) {
+		return add_name(unknown, name, len);
+	}
+	return is_image_type(type) ? add_name(table, name, len) : 0;
+}
+
+// Probes the headers of the unknown entries in parallel and adds the images to table
+static int add_sniffed(const char* directory, path_table_t* unknown, path_table_t* table) {
+	if (unknown->count == 0) {
+		return 0;
+	}
+	const char** names = malloc(unknown->count * sizeof(const char*));
+	image_type_t* types = malloc(unknown->count * sizeof(image_type_t));
+	int result = names != NULL && types != NULL ? 0 : -1;
+	if (result == 0) {
+		for (size_t i = 0; i < unknown->count; i++) {
+			names[i] = unknown->names + unknown->offsets[i];
+		}
+		sniff_files(directory, names, unknown->count, types, sniff_threads());
+		for (size_t i = 0; i < unknown->count && result == 0; i++) {
+			if (is_image_type(types[i])) {
+				result = add_name(table, names[i], strlen(names[i]));
+			}
+		}
+	}
+	free(names);
+	free(types);
+	unknown->count = 0;
+	unknown->names_size = 0;
+	return result;
+}
+
+#ifdef __linux__
+// glibc only wraps getdents64 since 2.30
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
 
-	size_t a_len = strlen(a_copy);
-	size_t b_len = strlen(b_copy);
+#define DIRENT_BUFFER_SIZE (64 * 1024)
 
-	if (a_len > 4 && b_len > 4) {
-		a_copy[a_len - 4] = '\0';
-		b_copy[b_len - 4] = '\0';
+// Reads the directory in 64 KB batches of entries instead of one readdir() call each,
+// on_batch is called after each one and stops the scan by returning non zero
+static int scan_directory(const char* directory, path_table_t* table, scan_batch_fn on_batch, void* context) {
+	int fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+	char* buffer = malloc(DIRENT_BUFFER_SIZE);
+	if (buffer == NULL) {
+		close(fd);
+		return -1;
+	}
+
+	path_table_t unknown = {0};
+	int result = 0;
+	for (;;) {
+		long size = syscall(SYS_getdents64, fd, buffer, DIRENT_BUFFER_SIZE);
+		if (size <= 0) {
+			result = size < 0 ? -1 : 0;
+			break;
+		}
+		for (long pos = 0; pos < size;) {
+			struct linux_dirent64* entry = (struct linux_dirent64*)(buffer + pos);
+			pos += entry->d_reclen;
+			// Sockets, FIFOs and devices are never images, unknown types get checked when sniffed
+			if (entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) {
+				continue;
+			}
+			if (add_entry(table, &unknown, entry->d_name, strlen(entry->d_name)) != 0) {
+				result = -1;
+				break;
+			}
+		}
+		if (result == 0) {
+			result = add_sniffed(directory, &unknown, table);
+		}
+		if (result != 0 || (on_batch != NULL && on_batch(context, table) != 0)) {
+			break;
+		}
 	}
 
-	int result = strcmp(a_copy, b_copy);
-	free(a_copy);
-	free(b_copy);
+	free(unknown.names);
+	free(unknown.offsets);
+	free(buffer);
+	close(fd);
 	return result;
 }
+#else
+#define READDIR_BATCH 1024
 
-char** list_images(const char* filepath) {
-	char* directory = parent_directory(filepath);
+static int scan_directory(const char* directory, path_table_t* table, scan_batch_fn on_batch, void* context) {
 	DIR* dir = opendir(directory);
 	if (dir == NULL) {
-		fprintf(stderr, "Could not open directory %s\n", directory);
-		return NULL;
+		return -1;
 	}
-
+	path_table_t unknown = {0};
+	int result = 0;
+	size_t read = 0;
 	struct dirent* entry;
-	
-	size_t i = 0;
 	while ((entry = readdir(dir)) != NULL) {
-		const char* name = entry->d_name;
-		// Check if the file is an image
-		// Extensions: .png, .jpg, .jpeg, .bmp, .gif, .tga, .svg
-		size_t len = strlen(name);
-		if (len > 4) {
-			if (strcmp(name + len - 4, ".png") == 0 ||
-				strcmp(name + len - 4, ".jpg") == 0 ||
-				strcmp(name + len - 5, ".jpeg") == 0 ||
-				strcmp(name + len - 4, ".bmp") == 0 ||
-				strcmp(name + len - 4, ".PNG") == 0 ||
-				strcmp(name + len - 4, ".JPG") == 0 ||
-				strcmp(name + len - 5, ".JPEG") == 0 ||
-				strcmp(name + len - 4, ".BMP") == 0) {
-				images[i] = malloc(strlen(directory) + strlen(name) + 2);
-				strcpy(images[i], directory);
-				#if defined(_WIN32) || defined(_WIN64)
-					strcat(images[i], "\\");
-				#else
-					strcat(images[i], "/");
-				#endif
-				strcat(images[i], name);
-				i++;
+		if (add_entry(table, &unknown, entry->d_name, strlen(entry->d_name)) != 0) {
+			result = -1;
+			break;
+		}
+		if (++read % READDIR_BATCH == 0) {
+			result = add_sniffed(directory, &unknown, table);
+			if (result != 0 || (on_batch != NULL && on_batch(context, table) != 0)) {
+				break;
 			}
 		}
 	}
-
+	if (result == 0 && read % READDIR_BATCH != 0) {
+		result = add_sniffed(directory, &unknown, table);
+		if (result == 0 && on_batch != NULL) {
+			on_batch(context, table);
+		}
+	}
+	free(unknown.names);
+	free(unknown.offsets);
 	closedir(dir);
-	free(directory);
+	return result;
+}
+#endif
+
+typedef struct sort_key_t {
+	uint32_t offset;
+	uint32_t length;
+} sort_key_t;
+
+// Bottom up merge sort on (offset, stem length) keys, qsort() has no portable way to pass the arena to the
+// comparison and measuring the names once keeps strlen() out of the inner loop
+static int sort_offsets(const char* names, uint32_t* offsets, size_t count) {
+	if (count < 2) {
+		return 0;
+	}
+	sort_key_t* keys = malloc(2 * count * sizeof(sort_key_t));
+	if (keys == NULL) {
+		return -1;
+	}
+	for (size_t i = 0; i < count; i++) {
+		keys[i].offset = offsets[i];
+		keys[i].length = stem_length(names + offsets[i]);
+	}
+	sort_key_t* src = keys;
+	sort_key_t* dst = keys + count;
+	for (size_t width = 1; width < count; width *= 2) {
+		for (size_t start = 0; start < count; start += 2 * width) {
+			size_t mid = start + width < count ? start + width : count;
+			size_t end = start + 2 * width < count ? start + 2 * width : count;
+			size_t i = start, j = mid, k = start;
+			while (i < mid && j < end) {
+				bool right = compare_stems(names + src[j].offset, src[j].length, names + src[i].offset, src[i].length) < 0;
+				dst[k++] = right ? src[j++] : src[i++];
+			}
+			while (i < mid) {
+				dst[k++] = src[i++];
+			}
+			while (j < end) {
+				dst[k++] = src[j++];
+			}
+		}
+		sort_key_t* temp = src;
+		src = dst;
+		dst = temp;
+	}
+	for (size_t i = 0; i < count; i++) {
+		offsets[i] = src[i].offset;
+	}
+	free(keys);
+	return 0;
+}
+
+int list_images(const char* filepath, path_table_t* table) {
+	memset(table, 0, sizeof(*table));
+	table->directory = parent_directory(filepath);
+	if (table->directory == NULL) {
+		return -1;
+	}
+	table->directory_length = strlen(table->directory);
+
+	uint64_t start = trace_begin();
+	if (scan_directory(table->directory, table, NULL, NULL) != 0) {
+		fprintf(stderr, "Could not read directory %s\n", table->directory);
+		path_table_destroy(table);
+		return -1;
+	}
 
 	// Sort the images alphabetically
-	qsort(images, i, sizeof(char*), compare_strings);
-	return images;
+	if (sort_offsets(table->names, table->offsets, table->count) != 0) {
+		path_table_destroy(table);
+		return -1;
+	}
+	trace_end("list_images", start);
+	return 0;
+}
+
+int path_table_init(path_table_t* table, const char* filepath) {
+	memset(table, 0, sizeof(*table));
+	table->directory = parent_directory(filepath);
+	if (table->directory == NULL) {
+		return -1;
+	}
+	table->directory_length = strlen(table->directory);
+	const char* name = path_file_name(filepath);
+	if (add_name(table, name, strlen(name)) != 0) {
+		path_table_destroy(table);
+		return -1;
+	}
+	return 0;
+}
+
+// Whether name is already among the entries before end that sort equal to it
+static bool in_equal_run(const path_table_t* table, const uint32_t* offsets, size_t end, const char* name) {
+	for (size_t i = end; i > 0 && compare_names(table->names + offsets[i - 1], name) == 0; i--) {
+		if (strcmp(table->names + offsets[i - 1], name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int path_table_merge(path_table_t* table, const path_table_t* sorted) {
+	if (sorted->count == 0) {
+		return 0;
+	}
+	if (reserve(table, 0, sorted->names_size) != 0) {
+		return -1;
+	}
+	size_t capacity = table->count + sorted->count;
+	uint32_t* offsets = malloc(capacity * sizeof(uint32_t));
+	if (offsets == NULL) {
+		return -1;
+	}
+	// Names that turn out to be duplicates stay in the arena unreferenced
+	uint32_t base = (uint32_t)table->names_size;
+	memcpy(table->names + base, sorted->names, sorted->names_size);
+	table->names_size += sorted->names_size;
+
+	size_t i = 0, j = 0, k = 0;
+	while (i < table->count || j < sorted->count) {
+		const char* name = j < sorted->count ? table->names + base + sorted->offsets[j] : NULL;
+		if (name == NULL || (i < table->count && compare_names(table->names + table->offsets[i], name) <= 0)) {
+			offsets[k++] = table->offsets[i++];
+		} else {
+			if (!in_equal_run(table, offsets, k, name)) {
+				offsets[k++] = base + sorted->offsets[j];
+			}
+			j++;
+		}
+	}
+	free(table->offsets);
+	table->offsets = offsets;
+	table->count = k;
+	table->capacity = capacity;
+	table->generation++;
+	return 0;
+}
+
+void path_table_destroy(path_table_t* table) {
+	free(table->directory);
+	free(table->names);
+	free(table->offsets);
+	memset(table, 0, sizeof(*table));
+}
+
+const char* path_table_name(const path_table_t* table, size_t index) {
+	return table->names + table->offsets[index];
+}
+
+char* path_table_path(const path_table_t* table, size_t index) {
+	const char* name = path_table_name(table, index);
+	size_t len = strlen(name);
+	char* path = malloc(table->directory_length + len + 1);
+	if (path == NULL) {
+		return NULL;
+	}
+	memcpy(path, table->directory, table->directory_length);
+	memcpy(path + table->directory_length, name, len + 1);
+	return path;
+}
+
+bool path_table_is(const path_table_t* table, size_t index, const char* path) {
+	return strncmp(path, table->directory, table->directory_length) == 0 &&
+		strcmp(path + table->directory_length, path_table_name(table, index)) == 0;
+}
+
+size_t path_table_find(const path_table_t* table, const char* path) {
+	const char* name = path_file_name(path);
+	// First entry not ordered before name, then past the ones that compare equal without their extension
+	size_t low = 0, high = table->count;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (compare_names(path_table_name(table, mid), name) < 0) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	for (size_t i = low; i < table->count && compare_names(path_table_name(table, i), name) == 0; i++) {
+		if (strcmp(path_table_name(table, i), name) == 0) {
+			return i;
+		}
+	}
+	return table->count;
+}
+
+int path_table_add(path_table_t* table, const char* name) {
+	return add_name(table, name, strlen(name));
+}
+
+int path_table_sort(path_table_t* table) {
+	return sort_offsets(table->names, table->offsets, table->count);
+}
+
+int path_table_remove(path_table_t* table, const path_table_t* names) {
+	if (names->count == 0) {
+		return 0;
+	}
+	bool* removed = calloc(table->count, sizeof(bool));
+	if (removed == NULL) {
+		return -1;
+	}
+	for (size_t i = 0; i < names->count; i++) {
+		size_t index = path_table_find(table, path_table_name(names, i));
+		if (index < table->count) {
+			removed[index] = true;
+		}
+	}
+	size_t count = 0;
+	size_t live_bytes = 0;
+	for (size_t i = 0; i < table->count; i++) {
+		if (!removed[i]) {
+			live_bytes += strlen(table->names + table->offsets[i]) + 1;
+			table->offsets[count++] = table->offsets[i];
+		}
+	}
+	free(removed);
+	if (count != table->count) {
+		table->count = count;
+		table->generation++;
+	}
+
+	// Files coming and going forever shouldn't grow the arena forever, repack once it's half garbage
+	if (live_bytes < table->names_size / 2) {
+		char* names = malloc(live_bytes > 0 ? live_bytes : 1);
+		if (names == NULL) {
+			return 0;
+		}
+		size_t size = 0;
+		for (size_t i = 0; i < table->count; i++) {
+			const char* name = table->names + table->offsets[i];
+			size_t len = strlen(name) + 1;
+			memcpy(names + size, name, len);
+			table->offsets[i] = (uint32_t)size;
+			size += len;
+		}
+		free(table->names);
+		table->names = names;
+		table->names_size = size;
+		table->names_capacity = live_bytes > 0 ? live_bytes : 1;
+	}
+	return 0;
+}
+
+bool is_image_name(const char* name) {
+	return is_image_type(sniff_extension(name));
+}
+
+size_t path_table_memory(const path_table_t* table) {
+	return table->directory_length + 1 + table->names_capacity + table->capacity * sizeof(uint32_t);
+}
+
+static int publish_batch(void* context, path_table_t* batch) {
+	dir_scan_t* scan = context;
+	int result = sort_offsets(batch->names, batch->offsets, batch->count);
+	pthread_mutex_lock(&scan->lock);
+	if (result == 0) {
+		result = path_table_merge(&scan->pending, batch);
+	}
+	bool cancel = scan->cancel;
+	pthread_mutex_unlock(&scan->lock);
+	batch->count = 0;
+	batch->names_size = 0;
+	if (result == 0 && scan->notify != NULL) {
+		scan->notify();
+	}
+	return result != 0 || cancel;
+}
+
+static void* scan_worker(void* arg) {
+	dir_scan_t* scan = arg;
+	trace_thread_name("scan");
+	uint64_t start = trace_begin();
+	path_table_t batch = {0};
+	int result = scan_directory(scan->pending.directory, &batch, publish_batch, scan);
+	trace_end("scan", start);
+	free(batch.names);
+	free(batch.offsets);
+
+	pthread_mutex_lock(&scan->lock);
+	scan->done = true;
+	scan->failed = result != 0;
+	pthread_mutex_unlock(&scan->lock);
+	if (result != 0) {
+		fprintf(stderr, "Could not read directory %s\n", scan->pending.directory);
+	}
+	if (scan->notify != NULL) {
+		scan->notify();
+	}
+	return NULL;
+}
+
+int dir_scan_start(dir_scan_t* scan, const char* directory, void (*notify)(void)) {
+	memset(scan, 0, sizeof(*scan));
+	scan->pending.directory = strdup(directory);
+	if (scan->pending.directory == NULL) {
+		return -1;
+	}
+	scan->pending.directory_length = strlen(directory);
+	scan->notify = notify;
+	pthread_mutex_init(&scan->lock, NULL);
+	if (pthread_create(&scan->thread, NULL, scan_worker, scan) != 0) {
+		fprintf(stderr, "Failed to start directory scan thread\n");
+		pthread_mutex_destroy(&scan->lock);
+		path_table_destroy(&scan->pending);
+		return -1;
+	}
+	scan->started = true;
+	return 0;
+}
+
+bool dir_scan_ready(dir_scan_t* scan) {
+	pthread_mutex_lock(&scan->lock);
+	bool ready = scan->pending.count > 0;
+	pthread_mutex_unlock(&scan->lock);
+	return ready;
+}
+
+bool dir_scan_merge(dir_scan_t* scan, path_table_t* table) {
+	pthread_mutex_lock(&scan->lock);
+	size_t count = table->count;
+	if (path_table_merge(table, &scan->pending) != 0) {
+		fprintf(stderr, "Failed to add %zu directory entries\n", scan->pending.count);
+	}
+	scan->pending.count = 0;
+	scan->pending.names_size = 0;
+	pthread_mutex_unlock(&scan->lock);
+	return table->count != count;
+}
+
+bool dir_scan_done(dir_scan_t* scan) {
+	pthread_mutex_lock(&scan->lock);
+	bool done = scan->done && scan->pending.count == 0;
+	pthread_mutex_unlock(&scan->lock);
+	return done;
+}
+
+void dir_scan_destroy(dir_scan_t* scan) {
+	if (!scan->started) {
+		return;
+	}
+	pthread_mutex_lock(&scan->lock);
+	scan->cancel = true;
+	pthread_mutex_unlock(&scan->lock);
+	pthread_join(scan->thread, NULL);
+	pthread_mutex_destroy(&scan->lock);
+	path_table_destroy(&scan->pending);
+	scan->started = false;
 }
@@ -0,0 +1,138 @@
+#include "file_map.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+
+// No mmap, read the file into memory instead
+int map_file(const char* path, file_map_t* map) {
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "Could not open %s\n", path);
+		return -1;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	unsigned char* data = size > 0 ? malloc(size) : NULL;
+	if (data == NULL || fread(data, 1, size, file) != (size_t)size) {
+		fprintf(stderr, "Could not read %s\n", path);
+		free(data);
+		fclose(file);
+		return -1;
+	}
+	fclose(file);
+	map->data = data;
+	map->size = size;
+	return 0;
+}
+
+void unmap_file(file_map_t* map) {
+	free((void*)map->data);
+	map->data = NULL;
+	map->size = 0;
+}
+
+void map_guard_begin(sigjmp_buf* jump) {
+	(void)jump;
+}
+
+void map_guard_end() {
+}
+
+#else
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static _Thread_local sigjmp_buf* guard_jump = NULL;
+static pthread_once_t guard_once = PTHREAD_ONCE_INIT;
+static struct sigaction previous_bus_action;
+
+static void bus_handler(int signal, siginfo_t* info, void* context) {
+	if (guard_jump != NULL) {
+		siglongjmp(*guard_jump, 1);
+	}
+	// Not ours, let the previous handler (usually the default crash) deal with it
+	if (previous_bus_action.sa_flags & SA_SIGINFO) {
+		previous_bus_action.sa_sigaction(signal, info, context);
+		return;
+	}
+	sigaction(SIGBUS, &previous_bus_action, NULL);
+	raise(SIGBUS);
+}
+
+static void install_bus_handler() {
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = bus_handler;
+	action.sa_flags = SA_SIGINFO | SA_NODEFER;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGBUS, &action, &previous_bus_action);
+}
+
+int map_file(const char* path, file_map_t* map) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "Could not open %s\n", path);
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		fprintf(stderr, "Could not read %s\n", path);
+		close(fd);
+		return -1;
+	}
+
+	void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping keeps the file alive on its own
+	close(fd);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "Could not map %s\n", path);
+		return -1;
+	}
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+	madvise(data, st.st_size, MADV_WILLNEED);
+
+	map->data = data;
+	map->size = st.st_size;
+	return 0;
+}
+
+void unmap_file(file_map_t* map) {
+	if (map->data != NULL) {
+		munmap((void*)map->data, map->size);
+	}
+	map->data = NULL;
+	map->size = 0;
+}
+
+void map_guard_begin(sigjmp_buf* jump) {
+	pthread_once(&guard_once, install_bus_handler);
+	guard_jump = jump;
+}
+
+void map_guard_end() {
+	guard_jump = NULL;
+}
+
+#endif
+
+int64_t file_mtime(const char* path) {
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		return -1;
+	}
+#if defined(_WIN32) || defined(_WIN64)
+	return (int64_t)st.st_mtime * 1000000000;
+#else
+	return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+}
@@ -0,0 +1,448 @@
+#include "gif.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GIF_HEADER_SIZE 13
+#define GIF_EXTENSION 0x21
+#define GIF_IMAGE 0x2C
+#define GIF_GRAPHIC_CONTROL 0xF9
+#define GIF_APPLICATION 0xFF
+#define GIF_DISPOSE_BACKGROUND 2
+#define GIF_DISPOSE_PREVIOUS 3
+
+static int read_u8(gif_decoder_t* gif) {
+	if (gif->pos >= gif->map.size) {
+		return -1;
+	}
+	return gif->map.data[gif->pos++];
+}
+
+static int read_u16(gif_decoder_t* gif) {
+	if (gif->pos + 2 > gif->map.size) {
+		return -1;
+	}
+	int value = gif->map.data[gif->pos] | gif->map.data[gif->pos + 1] << 8;
+	gif->pos += 2;
+	return value;
+}
+
+static int skip(gif_decoder_t* gif, size_t bytes) {
+	if (bytes > gif->map.size - gif->pos) {
+		return -1;
+	}
+	gif->pos += bytes;
+	return 0;
+}
+
+// Extension and image data are split into blocks of up to 255 bytes, ending with an empty one
+static int skip_sub_blocks(gif_decoder_t* gif) {
+	for (;;) {
+		int length = read_u8(gif);
+		if (length <= 0) {
+			return length;
+		}
+		if (skip(gif, length) != 0) {
+			return -1;
+		}
+	}
+}
+
+static int skip_image(gif_decoder_t* gif) {
+	if (skip(gif, 8) != 0) {
+		return -1;
+	}
+	int packed = read_u8(gif);
+	if (packed < 0 || (packed & 0x80 && skip(gif, 3 * (2 << (packed & 7))) != 0)) {
+		return -1;
+	}
+	// LZW minimum code size
+	if (read_u8(gif) < 0) {
+		return -1;
+	}
+	return skip_sub_blocks(gif);
+}
+
+static void read_loops(gif_decoder_t* gif) {
+	int size = read_u8(gif);
+	if (size < 0) {
+		return;
+	}
+	const unsigned char* id = gif->map.data + gif->pos;
+	if (skip(gif, size) != 0 || size != 11 || (memcmp(id, "NETSCAPE2.0", 11) != 0 && memcmp(id, "ANIMEXTS1.0", 11) != 0)) {
+		return;
+	}
+	int length = read_u8(gif);
+	if (length >= 3 && gif->pos + length <= gif->map.size && gif->map.data[gif->pos] == 1) {
+		int loops = gif->map.data[gif->pos + 1] | gif->map.data[gif->pos + 2] << 8;
+		// The count is of repeats after the first play
+		gif->plays = loops == 0 ? 0 : loops + 1;
+	}
+	if (length > 0) {
+		skip(gif, length);
+	}
+}
+
+// Walks the blocks up to the second image, without decoding anything
+static int scan(gif_decoder_t* gif) {
+	int images = 0;
+	while (images < 2) {
+		int block = read_u8(gif);
+		if (block == GIF_EXTENSION) {
+			int label = read_u8(gif);
+			if (label == GIF_APPLICATION) {
+				read_loops(gif);
+			}
+			if (label < 0 || skip_sub_blocks(gif) != 0) {
+				break;
+			}
+		} else if (block == GIF_IMAGE) {
+			images++;
+			if (skip_image(gif) != 0) {
+				break;
+			}
+		} else {
+			break;
+		}
+	}
+	gif->animated = images > 1;
+	gif->pos = gif->start;
+	return images > 0 ? 0 : -1;
+}
+
+int gif_open(const char* filename, gif_decoder_t* gif) {
+	memset(gif, 0, sizeof(*gif));
+	if (map_file(filename, &gif->map) != 0) {
+		return -1;
+	}
+	const unsigned char* data = gif->map.data;
+	sigjmp_buf jump;
+	if (sigsetjmp(jump, 1) != 0) {
+		map_guard_end();
+		fprintf(stderr, "File truncated while loading: %s\n", filename);
+		gif_close(gif);
+		return -1;
+	}
+	map_guard_begin(&jump);
+	if (gif->map.size < GIF_HEADER_SIZE || (memcmp(data, "GIF87a", 6) != 0 && memcmp(data, "GIF89a", 6) != 0)) {
+		map_guard_end();
+		gif_close(gif);
+		return -1;
+	}
+
+	gif->pos = 6;
+	gif->width = read_u16(gif);
+	gif->height = read_u16(gif);
+	int packed = read_u8(gif);
+	// Background color and aspect ratio, browsers ignore both
+	skip(gif, 2);
+	if (packed & 0x80) {
+		gif->palette_size = 2 << (packed & 7);
+		if (skip(gif, 3 * gif->palette_size) != 0) {
+			gif->palette_size = 0;
+		} else {
+			memcpy(gif->palette, data + gif->pos - 3 * gif->palette_size, 3 * gif->palette_size);
+		}
+	}
+	gif->start = gif->pos;
+	gif->plays = 1;
+	int scanned = scan(gif);
+	map_guard_end();
+
+	if (gif->width == 0 || gif->height == 0 || scanned != 0) {
+		fprintf(stderr, "No images in GIF: %s\n", filename);
+		gif_close(gif);
+		return -1;
+	}
+	size_t canvas_size = (size_t)gif->width * gif->height * 4;
+	gif->canvas = calloc(canvas_size, 1);
+	gif->previous = malloc(canvas_size);
+	if (gif->canvas == NULL || gif->previous == NULL) {
+		fprintf(stderr, "Out of memory for GIF: %s\n", filename);
+		gif_close(gif);
+		return -1;
+	}
+	return 0;
+}
+
+void gif_close(gif_decoder_t* gif) {
+	if (gif->map.data != NULL) {
+		unmap_file(&gif->map);
+	}
+	free(gif->canvas);
+	free(gif->previous);
+	free(gif->indices);
+	gif->map.data = NULL;
+	gif->canvas = NULL;
+	gif->previous = NULL;
+	gif->indices = NULL;
+}
+
+void gif_rewind(gif_decoder_t* gif) {
+	gif->pos = gif->start;
+	gif->dispose = 0;
+	memset(gif->canvas, 0, (size_t)gif->width * gif->height * 4);
+}
+
+// Fills indices with up to count color indices, returns how many were decoded
+static size_t decode_lzw(gif_decoder_t* gif, size_t count) {
+	int min_size = read_u8(gif);
+	if (min_size < 1 || min_size > 11) {
+		skip_sub_blocks(gif);
+		return 0;
+	}
+	int clear = 1 << min_size;
+	int end = clear + 1;
+	int size = min_size + 1;
+	int next = clear + 2;
+	int old = -1;
+	uint8_t first = 0;
+	uint32_t bits = 0;
+	int bit_count = 0;
+	int block_left = 0;
+	size_t out = 0;
+
+	for (;;) {
+		while (bit_count < size) {
+			if (block_left == 0) {
+				block_left = read_u8(gif);
+				if (block_left <= 0) {
+					// The terminator came early, what was decoded is kept
+					return out;
+				}
+			}
+			int byte = read_u8(gif);
+			if (byte < 0) {
+				return out;
+			}
+			block_left--;
+			bits |= (uint32_t)byte << bit_count;
+			bit_count += 8;
+		}
+		int code = bits & ((1 << size) - 1);
+		bits >>= size;
+		bit_count -= size;
+
+		if (code == clear) {
+			size = min_size + 1;
+			next = clear + 2;
+			old = -1;
+			continue;
+		}
+		if (code == end) {
+			break;
+		}
+		if (old < 0) {
+			if (code > clear) {
+				break;
+			}
+			if (out < count) {
+				gif->indices[out++] = (uint8_t)code;
+			}
+			old = code;
+			first = (uint8_t)code;
+			continue;
+		}
+
+		int in = code;
+		int top = 0;
+		if (code >= next) {
+			// Not in the table yet: the previous string plus its own first byte
+			if (code > next) {
+				break;
+			}
+			gif->stack[top++] = first;
+			code = old;
+		}
+		while (code >= clear && top < GIF_MAX_CODES - 1) {
+			gif->stack[top++] = gif->suffix[code];
+			code = gif->prefix[code];
+		}
+		first = (uint8_t)code;
+		gif->stack[top++] = first;
+		if (next < GIF_MAX_CODES) {
+			gif->prefix[next] = (uint16_t)old;
+			gif->suffix[next] = first;
+			next++;
+			if (next == 1 << size && size < 12) {
+				size++;
+			}
+		}
+		while (top > 0 && out < count) {
+			gif->indices[out++] = gif->stack[--top];
+		}
+		old = in;
+	}
+	skip(gif, block_left);
+	skip_sub_blocks(gif);
+	return out;
+}
+
+// Row of the image that the row-th row of interlaced data belongs to
+static int32_t interlaced_row(int32_t row, int32_t height) {
+	static const int32_t starts[4] = {0, 4, 2, 1};
+	static const int32_t steps[4] = {8, 8, 4, 2};
+	for (int pass = 0; pass < 4; pass++) {
+		int32_t rows = (height - starts[pass] + steps[pass] - 1) / steps[pass];
+		if (row < rows) {
+			return starts[pass] + row * steps[pass];
+		}
+		row -= rows;
+	}
+	return -1;
+}
+
+static void dispose_last(gif_decoder_t* gif) {
+	if (gif->dispose == GIF_DISPOSE_PREVIOUS) {
+		memcpy(gif->canvas, gif->previous, (size_t)gif->width * gif->height * 4);
+	} else if (gif->dispose == GIF_DISPOSE_BACKGROUND) {
+		// Browsers clear to transparent rather than to the background color
+		int32_t right = gif->dispose_x + gif->dispose_width;
+		int32_t bottom = gif->dispose_y + gif->dispose_height;
+		right = right < gif->width ? right : gif->width;
+		bottom = bottom < gif->height ? bottom : gif->height;
+		for (int32_t y = gif->dispose_y; y < bottom; y++) {
+			if (right > gif->dispose_x) {
+				memset(gif->canvas + ((size_t)y * gif->width + gif->dispose_x) * 4, 0, (size_t)(right - gif->dispose_x) * 4);
+			}
+		}
+	}
+	gif->dispose = 0;
+}
+
+static int draw_image(gif_decoder_t* gif, int32_t transparent, int32_t dispose) {
+	int32_t x = read_u16(gif);
+	int32_t y = read_u16(gif);
+	int32_t width = read_u16(gif);
+	int32_t height = read_u16(gif);
+	int packed = read_u8(gif);
+	if (x < 0 || y < 0 || width < 0 || height < 0 || packed < 0) {
+		return -1;
+	}
+	const uint8_t* palette = gif->palette;
+	int32_t colors = gif->palette_size;
+	if (packed & 0x80) {
+		colors = 2 << (packed & 7);
+		palette = gif->map.data + gif->pos;
+		if (skip(gif, 3 * colors) != 0) {
+			return -1;
+		}
+	}
+	if (colors == 0) {
+		return -1;
+	}
+
+	size_t count = (size_t)width * height;
+	if (count > gif->indices_size) {
+		uint8_t* indices = realloc(gif->indices, count);
+		if (indices == NULL) {
+			return -1;
+		}
+		gif->indices = indices;
+		gif->indices_size = count;
+	}
+	size_t decoded = decode_lzw(gif, count);
+
+	dispose_last(gif);
+	if (dispose == GIF_DISPOSE_PREVIOUS) {
+		memcpy(gif->previous, gif->canvas, (size_t)gif->width * gif->height * 4);
+	}
+	bool interlaced = packed & 0x40;
+	for (int32_t row = 0; row < height && (size_t)row * width < decoded; row++) {
+		int32_t canvas_y = y + (interlaced ? interlaced_row(row, height) : row);
+		if (canvas_y >= gif->height) {
+			continue;
+		}
+		const uint8_t* indices = gif->indices + (size_t)row * width;
+		unsigned char* out = gif->canvas + ((size_t)canvas_y * gif->width + x) * 4;
+		for (int32_t column = 0; column < width && x + column < gif->width; column++) {
+			if ((size_t)row * width + column >= decoded) {
+				break;
+			}
+			int32_t index = indices[column];
+			if (index != transparent && index < colors) {
+				out[column * 4] = palette[index * 3];
+				out[column * 4 + 1] = palette[index * 3 + 1];
+				out[column * 4 + 2] = palette[index * 3 + 2];
+				out[column * 4 + 3] = 255;
+			}
+		}
+	}
+	gif->dispose = dispose;
+	gif->dispose_x = x;
+	gif->dispose_y = y;
+	gif->dispose_width = width;
+	gif->dispose_height = height;
+	return 0;
+}
+
+static int next_frame(gif_decoder_t* gif, int32_t* delay_ms) {
+	int32_t delay = 0;
+	int32_t transparent = -1;
+	int32_t dispose = 0;
+	for (;;) {
+		int block = read_u8(gif);
+		if (block == GIF_EXTENSION) {
+			int label = read_u8(gif);
+			if (label == GIF_GRAPHIC_CONTROL) {
+				size_t start = gif->pos + 1;
+				int size = read_u8(gif);
+				int packed = read_u8(gif);
+				int centiseconds = read_u16(gif);
+				int index = read_u8(gif);
+				if (size < 4 || index < 0) {
+					return -1;
+				}
+				delay = centiseconds * 10;
+				transparent = packed & 1 ? index : -1;
+				dispose = (packed >> 2) & 7;
+				gif->pos = start + size;
+			}
+			if (label < 0 || skip_sub_blocks(gif) != 0) {
+				return -1;
+			}
+		} else if (block == GIF_IMAGE) {
+			if (draw_image(gif, transparent, dispose) != 0) {
+				return -1;
+			}
+			*delay_ms = delay <= 10 ? GIF_DEFAULT_DELAY_MS : delay;
+			return 1;
+		} else {
+			// The trailer, or the end of a file missing it
+			return 0;
+		}
+	}
+}
+
+int gif_next_frame(gif_decoder_t* gif, image_t* frame, int32_t* delay_ms) {
+	sigjmp_buf jump;
+	if (sigsetjmp(jump, 1) != 0) {
+		map_guard_end();
+		fprintf(stderr, "GIF truncated while loading\n");
+		return -1;
+	}
+	map_guard_begin(&jump);
+	int result = next_frame(gif, delay_ms);
+	map_guard_end();
+	if (result <= 0) {
+		return result;
+	}
+
+	size_t row_size = (size_t)gif->width * 4;
+	unsigned char* pixels = malloc(row_size * gif->height);
+	if (pixels == NULL) {
+		return -1;
+	}
+	for (int32_t y = 0; y < gif->height; y++) {
+		memcpy(pixels + (size_t)(gif->height - 1 - y) * row_size, gif->canvas + (size_t)y * row_size, row_size);
+	}
+	memset(frame, 0, sizeof(*frame));
+	frame->pixels = pixels;
+	frame->width = gif->width;
+	frame->height = gif->height;
+	frame->channels = 4;
+	frame->full_width = gif->width;
+	frame->full_height = gif->height;
+	return 1;
+}
@@ -0,0 +1,187 @@
+#include "gif_player.h"
+
+#include <GL/glew.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+static void* decode_frames(void* arg) {
+	gif_player_t* player = arg;
+	gif_decoder_t* decoder = player->decoder;
+	int32_t plays = 0;
+	size_t frames_this_play = 0;
+	trace_thread_name("gif");
+
+	pthread_mutex_lock(&player->lock);
+	while (!player->stop) {
+		if (player->decoded_count == GIF_DECODE_AHEAD) {
+			pthread_cond_wait(&player->wake, &player->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&player->lock);
+
+		image_t frame;
+		int32_t delay = 0;
+		uint64_t start = trace_begin();
+		int result = gif_next_frame(decoder, &frame, &delay);
+		trace_end("gif_frame", start);
+		if (result == 0 && frames_this_play > 0) {
+			plays++;
+			if (decoder->plays == 0 || plays < decoder->plays) {
+				gif_rewind(decoder);
+				frames_this_play = 0;
+				pthread_mutex_lock(&player->lock);
+				continue;
+			}
+		}
+
+		pthread_mutex_lock(&player->lock);
+		// Played every loop, or the file broke off
+		if (result <= 0) {
+			break;
+		}
+		frames_this_play++;
+		size_t slot = (player->decoded_head + player->decoded_count) % GIF_DECODE_AHEAD;
+		player->decoded[slot] = frame;
+		player->decoded_delays[slot] = delay;
+		player->decoded_count++;
+		pthread_mutex_unlock(&player->lock);
+		if (player->notify != NULL) {
+			player->notify();
+		}
+		pthread_mutex_lock(&player->lock);
+	}
+	pthread_mutex_unlock(&player->lock);
+	return NULL;
+}
+
+int gif_player_start(gif_player_t* player, const char* path, void (*notify)(void)) {
+	memset(player, 0, sizeof(*player));
+	player->decoder = malloc(sizeof(gif_decoder_t));
+	if (player->decoder == NULL || gif_open(path, player->decoder) != 0) {
+		free(player->decoder);
+		return -1;
+	}
+	if (!player->decoder->animated) {
+		gif_close(player->decoder);
+		free(player->decoder);
+		return -1;
+	}
+	player->notify = notify;
+
+	GLint bound;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+	glGenTextures(GIF_RING_SIZE, player->textures);
+	for (size_t i = 0; i < GIF_RING_SIZE; i++) {
+		glBindTexture(GL_TEXTURE_2D, player->textures[i]);
+		set_texture_params(0);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, player->decoder->width, player->decoder->height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+		             NULL);
+	}
+	glBindTexture(GL_TEXTURE_2D, bound);
+
+	pthread_mutex_init(&player->lock, NULL);
+	pthread_cond_init(&player->wake, NULL);
+	if (pthread_create(&player->thread, NULL, decode_frames, player) != 0) {
+		fprintf(stderr, "Failed to start GIF decoder thread\n");
+		pthread_mutex_destroy(&player->lock);
+		pthread_cond_destroy(&player->wake);
+		glDeleteTextures(GIF_RING_SIZE, player->textures);
+		gif_close(player->decoder);
+		free(player->decoder);
+		return -1;
+	}
+	return 0;
+}
+
+void gif_player_stop(gif_player_t* player) {
+	pthread_mutex_lock(&player->lock);
+	player->stop = true;
+	pthread_cond_signal(&player->wake);
+	pthread_mutex_unlock(&player->lock);
+	pthread_join(player->thread, NULL);
+
+	for (size_t i = 0; i < player->decoded_count; i++) {
+		free_image(&player->decoded[(player->decoded_head + i) % GIF_DECODE_AHEAD]);
+	}
+	pthread_mutex_destroy(&player->lock);
+	pthread_cond_destroy(&player->wake);
+	glDeleteTextures(GIF_RING_SIZE, player->textures);
+	gif_close(player->decoder);
+	free(player->decoder);
+}
+
+// Moves decoded frames into the free slots of the ring
+static void fill_ring(gif_player_t* player) {
+	image_t frames[GIF_DECODE_AHEAD];
+	int32_t delays[GIF_DECODE_AHEAD];
+	size_t count = 0;
+	pthread_mutex_lock(&player->lock);
+	while (player->ring_count + count < GIF_RING_SIZE && player->decoded_count > 0) {
+		frames[count] = player->decoded[player->decoded_head];
+		delays[count] = player->decoded_delays[player->decoded_head];
+		player->decoded_head = (player->decoded_head + 1) % GIF_DECODE_AHEAD;
+		player->decoded_count--;
+		count++;
+	}
+	if (count > 0) {
+		pthread_cond_signal(&player->wake);
+	}
+	pthread_mutex_unlock(&player->lock);
+	if (count == 0) {
+		return;
+	}
+
+	uint64_t start = trace_begin();
+	GLint bound;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (size_t i = 0; i < count; i++) {
+		size_t slot = (player->ring_head + player->ring_count) % GIF_RING_SIZE;
+		glBindTexture(GL_TEXTURE_2D, player->textures[slot]);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, frames[i].width, frames[i].height, GL_RGBA, GL_UNSIGNED_BYTE, frames[i].pixels);
+		player->delays[slot] = delays[i];
+		player->ring_count++;
+		free_image(&frames[i]);
+	}
+	glBindTexture(GL_TEXTURE_2D, bound);
+	trace_end("gif_upload", start);
+}
+
+bool gif_player_poll(gif_player_t* player, double now, uint32_t* texture) {
+	fill_ring(player);
+	if (player->ring_count == 0) {
+		return false;
+	}
+	if (!player->showing) {
+		player->showing = true;
+		player->due = now + player->delays[player->ring_head] / 1000.0;
+		player->frames++;
+		*texture = player->textures[player->ring_head];
+		return true;
+	}
+	if (player->ring_count < 2 || now < player->due) {
+		return false;
+	}
+
+	player->ring_head = (player->ring_head + 1) % GIF_RING_SIZE;
+	player->ring_count--;
+	player->frames++;
+	double delay = player->delays[player->ring_head] / 1000.0;
+	player->due += delay;
+	if (player->due < now) {
+		// Behind by a whole frame after a stall, time from now rather than rushing to catch up
+		player->due = now + delay;
+		player->late++;
+	}
+	// The slot that went off screen is free for the next frame
+	fill_ring(player);
+	*texture = player->textures[player->ring_head];
+	return true;
+}
+
+double gif_player_due(const gif_player_t* player) {
+	return player->showing && player->ring_count > 1 ? player->due : 0.0;
+}
@@ -0,0 +1,403 @@
+#include "grid.h"
+
+#include <GL/glew.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shader.h"
+
+#define CELL_EMPTY -1
+#define CELL_REQUESTED -2
+#define CELL_FAILED -3
+
+// Layers the shader draws as a flat colour instead of sampling
+#define LAYER_PLACEHOLDER -1.0f
+#define LAYER_SELECTION -2.0f
+
+static const float corners[8] = {0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f};
+
+int grid_view_init(grid_view_t* grid, thumbnailer_t* thumbnailer) {
+	memset(grid, 0, sizeof(*grid));
+	grid->thumbnailer = thumbnailer;
+	grid->first_requested = SIZE_MAX;
+	grid->last_requested = SIZE_MAX;
+	grid->program = get_grid_shader();
+	if (grid->program == (uint32_t)-1) {
+		return -1;
+	}
+
+	GLint max_layers = 0;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+	grid->layer_count = max_layers < GRID_LAYERS ? max_layers : GRID_LAYERS;
+	grid->layers = calloc(grid->layer_count, sizeof(grid_layer_t));
+	if (grid->layers == NULL) {
+		glDeleteProgram(grid->program);
+		return -1;
+	}
+
+	glGenTextures(1, &grid->texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, grid->texture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, THUMB_SIZE, THUMB_SIZE, grid->layer_count, 0, GL_RGBA,
+	             GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+
+	glGenVertexArrays(1, &grid->vao);
+	glBindVertexArray(grid->vao);
+	glGenBuffers(1, &grid->corner_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, grid->corner_buffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
+	glEnableVertexAttribArray(0);
+
+	glGenBuffers(1, &grid->instance_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, grid->instance_buffer);
+	glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(grid_instance_t), (void*)offsetof(grid_instance_t, cell));
+	glVertexAttribDivisor(1, 1);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(grid_instance_t), (void*)offsetof(grid_instance_t, thumb));
+	glVertexAttribDivisor(2, 1);
+	glEnableVertexAttribArray(2);
+
+	glUseProgram(grid->program);
+	glUniform1i(glGetUniformLocation(grid->program, "thumbs"), 0);
+	grid->viewport_uniform = glGetUniformLocation(grid->program, "viewport");
+	return 0;
+}
+
+void grid_view_destroy(grid_view_t* grid) {
+	for (int32_t i = 0; i < grid->layer_count; i++) {
+		free(grid->layers[i].name);
+	}
+	free(grid->layers);
+	free(grid->cells);
+	free(grid->instances);
+	free(grid->selected_name);
+	glDeleteTextures(1, &grid->texture);
+	glDeleteBuffers(1, &grid->corner_buffer);
+	glDeleteBuffers(1, &grid->instance_buffer);
+	glDeleteVertexArrays(1, &grid->vao);
+	glDeleteProgram(grid->program);
+	memset(grid, 0, sizeof(*grid));
+}
+
+// Entries moved since the last call, find every layer and the selection again by name
+static void sync_table(grid_view_t* grid, const path_table_t* table) {
+	if (grid->cells != NULL && grid->generation == table->generation && grid->cell_count == table->count) {
+		return;
+	}
+	int32_t* cells = realloc(grid->cells, (table->count > 0 ? table->count : 1) * sizeof(int32_t));
+	if (cells == NULL) {
+		return;
+	}
+	grid->cells = cells;
+	grid->cell_count = table->count;
+	grid->generation = table->generation;
+	for (size_t i = 0; i < table->count; i++) {
+		cells[i] = CELL_EMPTY;
+	}
+	for (int32_t i = 0; i < grid->layer_count; i++) {
+		grid_layer_t* layer = &grid->layers[i];
+		if (layer->name == NULL) {
+			continue;
+		}
+		layer->index = path_table_find(table, layer->name);
+		if (layer->index < table->count) {
+			cells[layer->index] = i;
+		} else {
+			free(layer->name);
+			layer->name = NULL;
+		}
+	}
+	if (grid->selected_name != NULL) {
+		size_t index = path_table_find(table, grid->selected_name);
+		if (index < table->count) {
+			grid->selected = index;
+		}
+	}
+	if (grid->selected >= table->count) {
+		grid->selected = table->count > 0 ? table->count - 1 : 0;
+	}
+	// Queued requests were marked in the old cells, they'd only be made twice
+	thumbnailer_cancel_pending(grid->thumbnailer);
+	grid->first_requested = SIZE_MAX;
+	grid->last_requested = SIZE_MAX;
+}
+
+// A free layer, or the one used longest ago that isn't on screen
+static int32_t take_layer(grid_view_t* grid) {
+	int32_t oldest = -1;
+	for (int32_t i = 0; i < grid->layer_count; i++) {
+		grid_layer_t* layer = &grid->layers[i];
+		if (layer->name == NULL) {
+			return i;
+		}
+		if (layer->last_used < grid->frame && (oldest < 0 || layer->last_used < grid->layers[oldest].last_used)) {
+			oldest = i;
+		}
+	}
+	if (oldest >= 0) {
+		grid_layer_t* layer = &grid->layers[oldest];
+		if (layer->index < grid->cell_count) {
+			grid->cells[layer->index] = CELL_EMPTY;
+		}
+		free(layer->name);
+		layer->name = NULL;
+	}
+	return oldest;
+}
+
+// The array texture is RGBA, grey and grey alpha thumbnails are spread out so they don't come out red
+static unsigned char* rgba_pixels(const image_t* image) {
+	size_t count = (size_t)image->width * image->height;
+	unsigned char* rgba = malloc(count * 4);
+	if (rgba == NULL) {
+		return NULL;
+	}
+	const unsigned char* src = image->pixels;
+	for (size_t i = 0; i < count; i++, src += image->channels) {
+		unsigned char* dst = rgba + i * 4;
+		if (image->channels >= 3) {
+			dst[0] = src[0];
+			dst[1] = src[1];
+			dst[2] = src[2];
+		} else {
+			dst[0] = dst[1] = dst[2] = src[0];
+		}
+		dst[3] = image->channels == 4 ? src[3] : image->channels == 2 ? src[1] : 255;
+	}
+	return rgba;
+}
+
+static bool upload_thumbnail(grid_view_t* grid, size_t index, const char* name, const image_t* image) {
+	if (image->pixels == NULL || image->width > THUMB_SIZE || image->height > THUMB_SIZE) {
+		grid->cells[index] = CELL_FAILED;
+		return false;
+	}
+	int32_t layer_index = grid->cells[index] >= 0 ? grid->cells[index] : take_layer(grid);
+	unsigned char* rgba = layer_index >= 0 ? rgba_pixels(image) : NULL;
+	if (rgba == NULL) {
+		grid->cells[index] = CELL_EMPTY;
+		return false;
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, grid->texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer_index, image->width, image->height, 1, GL_RGBA,
+	                GL_UNSIGNED_BYTE, rgba);
+	free(rgba);
+
+	grid_layer_t* layer = &grid->layers[layer_index];
+	if (layer->name == NULL || strcmp(layer->name, name) != 0) {
+		free(layer->name);
+		layer->name = strdup(name);
+	}
+	layer->index = index;
+	layer->width = image->width;
+	layer->height = image->height;
+	layer->last_used = grid->frame;
+	grid->cells[index] = layer->name != NULL ? layer_index : CELL_EMPTY;
+	return true;
+}
+
+bool grid_view_poll(grid_view_t* grid, const path_table_t* table) {
+	bool changed = grid->cells == NULL || grid->generation != table->generation || grid->cell_count != table->count;
+	sync_table(grid, table);
+	thumb_result_t result;
+	for (size_t i = 0; i < GRID_UPLOADS_PER_FRAME && thumbnailer_poll(grid->thumbnailer, &result); i++) {
+		// Found by name, the entry may have moved since it was requested
+		const char* name = path_file_name(result.path);
+		size_t index = path_table_find(table, name);
+		if (index < grid->cell_count) {
+			upload_thumbnail(grid, index, name, &result.image);
+			changed = true;
+		}
+		thumb_result_free(&result);
+	}
+	return changed;
+}
+
+static size_t row_count(const grid_view_t* grid) {
+	return grid->columns > 0 ? (grid->cell_count + grid->columns - 1) / grid->columns : 0;
+}
+
+static void clamp_scroll(grid_view_t* grid) {
+	float content = (float)row_count(grid) * GRID_CELL + GRID_GAP;
+	float max_scroll = content > grid->fb_height ? content - grid->fb_height : 0.0f;
+	if (grid->scroll > max_scroll) {
+		grid->scroll = max_scroll;
+	}
+	if (grid->scroll < 0.0f) {
+		grid->scroll = 0.0f;
+	}
+}
+
+static void follow_selection(grid_view_t* grid) {
+	if (grid->columns <= 0) {
+		return;
+	}
+	float top = (float)(grid->selected / grid->columns) * GRID_CELL;
+	if (top < grid->scroll) {
+		grid->scroll = top;
+	} else if (top + GRID_CELL + GRID_GAP > grid->scroll + grid->fb_height) {
+		grid->scroll = top + GRID_CELL + GRID_GAP - grid->fb_height;
+	}
+}
+
+void grid_view_select(grid_view_t* grid, const path_table_t* table, size_t index) {
+	if (index >= table->count) {
+		return;
+	}
+	grid->selected = index;
+	free(grid->selected_name);
+	grid->selected_name = strdup(path_table_name(table, index));
+	grid->follow_selection = true;
+}
+
+void grid_view_move(grid_view_t* grid, const path_table_t* table, int32_t columns, int32_t rows) {
+	if (table->count == 0) {
+		return;
+	}
+	int64_t index = (int64_t)grid->selected + columns + (int64_t)rows * (grid->columns > 0 ? grid->columns : 1);
+	if (index < 0) {
+		index = 0;
+	} else if (index >= (int64_t)table->count) {
+		index = table->count - 1;
+	}
+	grid_view_select(grid, table, (size_t)index);
+}
+
+void grid_view_scroll(grid_view_t* grid, float pixels) {
+	grid->scroll += pixels;
+}
+
+// Requests thumbnails for the rows in view and one beyond either edge. The
+// thumbnailer serves the newest request first, so the rows nearest the top
+// are queued last.
+static void request_rows(grid_view_t* grid, const path_table_t* table, size_t first_row, size_t last_row) {
+	if (first_row > 0) {
+		first_row--;
+	}
+	size_t start = first_row * grid->columns;
+	size_t end = (last_row + 2) * grid->columns;
+	if (end > grid->cell_count) {
+		end = grid->cell_count;
+	}
+	if (start == grid->first_requested && end == grid->last_requested) {
+		return;
+	}
+	thumbnailer_cancel_pending(grid->thumbnailer);
+	// Requests that were dropped may still be marked, unmark them so they're asked for again
+	for (size_t i = grid->first_requested; i < grid->last_requested && i < grid->cell_count; i++) {
+		if (grid->cells[i] == CELL_REQUESTED) {
+			grid->cells[i] = CELL_EMPTY;
+		}
+	}
+	grid->first_requested = start;
+	grid->last_requested = end;
+
+	for (size_t i = end; i > start; i--) {
+		if (grid->cells[i - 1] != CELL_EMPTY) {
+			continue;
+		}
+		char* path = path_table_path(table, i - 1);
+		if (path != NULL && thumbnailer_request(grid->thumbnailer, path, i - 1) == 0) {
+			grid->cells[i - 1] = CELL_REQUESTED;
+		}
+		free(path);
+	}
+}
+
+static grid_instance_t* add_instance(grid_view_t* grid, size_t* count) {
+	if (*count == grid->instance_capacity) {
+		size_t capacity = grid->instance_capacity == 0 ? 256 : grid->instance_capacity * 2;
+		grid_instance_t* instances = realloc(grid->instances, capacity * sizeof(grid_instance_t));
+		if (instances == NULL) {
+			return NULL;
+		}
+		grid->instances = instances;
+		grid->instance_capacity = capacity;
+	}
+	return &grid->instances[(*count)++];
+}
+
+void grid_view_draw(grid_view_t* grid, const path_table_t* table, int32_t fb_width, int32_t fb_height) {
+	sync_table(grid, table);
+	grid->frame++;
+	grid->fb_width = fb_width;
+	grid->fb_height = fb_height;
+	grid->columns = (fb_width - GRID_GAP) / GRID_CELL;
+	if (grid->columns < 1) {
+		grid->columns = 1;
+	}
+	if (grid->follow_selection) {
+		follow_selection(grid);
+		grid->follow_selection = false;
+	}
+	clamp_scroll(grid);
+
+	size_t count = 0;
+	size_t rows = row_count(grid);
+	if (rows > 0) {
+		size_t first_row = (size_t)(grid->scroll / GRID_CELL);
+		size_t last_row = (size_t)((grid->scroll + fb_height - 1) / GRID_CELL);
+		if (last_row >= rows) {
+			last_row = rows - 1;
+		}
+		request_rows(grid, table, first_row, last_row);
+
+		float left = (fb_width - grid->columns * GRID_CELL + GRID_GAP) / 2.0f;
+		size_t end = (last_row + 1) * grid->columns;
+		for (size_t i = first_row * grid->columns; i < end && i < grid->cell_count; i++) {
+			float x = left + (float)(i % grid->columns) * GRID_CELL;
+			float y = GRID_GAP + (float)(i / grid->columns) * GRID_CELL - grid->scroll;
+			// Drawn first so the thumbnail covers all but its edge
+			if (i == grid->selected) {
+				grid_instance_t* frame = add_instance(grid, &count);
+				if (frame != NULL) {
+					*frame = (grid_instance_t){
+						{x - GRID_GAP / 2.0f, y - GRID_GAP / 2.0f, GRID_CELL, GRID_CELL},
+						{0.0f, 0.0f, LAYER_SELECTION, 0.0f},
+					};
+				}
+			}
+			int32_t cell = grid->cells[i];
+			if (cell == CELL_FAILED) {
+				continue;
+			}
+			grid_instance_t* instance = add_instance(grid, &count);
+			if (instance == NULL) {
+				break;
+			}
+			if (cell < 0) {
+				*instance = (grid_instance_t){{x, y, THUMB_SIZE, THUMB_SIZE}, {0.0f, 0.0f, LAYER_PLACEHOLDER, 0.0f}};
+				continue;
+			}
+			grid_layer_t* layer = &grid->layers[cell];
+			layer->last_used = grid->frame;
+			// Centered in the cell, sampling only the part of the layer it fills
+			*instance = (grid_instance_t){
+				{x + (THUMB_SIZE - layer->width) / 2.0f, y + (THUMB_SIZE - layer->height) / 2.0f, layer->width, layer->height},
+				{(float)layer->width / THUMB_SIZE, (float)layer->height / THUMB_SIZE, (float)cell, 0.0f},
+			};
+		}
+	}
+
+	glViewport(0, 0, fb_width, fb_height);
+	glClear(GL_COLOR_BUFFER_BIT);
+	if (count == 0) {
+		return;
+	}
+	glUseProgram(grid->program);
+	glUniform2f(grid->viewport_uniform, (float)fb_width, (float)fb_height);
+	glBindVertexArray(grid->vao);
+	glBindBuffer(GL_ARRAY_BUFFER, grid->instance_buffer);
+	// Orphaned every frame, the driver hands out fresh storage instead of waiting on the last draw
+	glBufferData(GL_ARRAY_BUFFER, count * sizeof(grid_instance_t), grid->instances, GL_STREAM_DRAW);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, grid->texture);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)count);
+}
@@ -0,0 +1,320 @@
+#include "hud.h"
+
+#include <GL/glew.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "shader.h"
+
+#define FONT_FIRST ' '
+#define FONT_GLYPHS 64
+#define GLYPH_WIDTH 5
+#define GLYPH_HEIGHT 7
+
+// ASCII space to underscore, a row per byte with the leftmost pixel in bit 4.
+// Lower case is drawn as upper case.
+static const uint8_t font[FONT_GLYPHS][GLYPH_HEIGHT] = {
+	{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // space
+	{0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04}, // !
+	{0x0a, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x00}, // "
+	{0x0a, 0x0a, 0x1f, 0x0a, 0x1f, 0x0a, 0x0a}, // #
+	{0x04, 0x0f, 0x14, 0x0e, 0x05, 0x1e, 0x04}, // $
+	{0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03}, // %
+	{0x0c, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0d}, // &
+	{0x04, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00}, // '
+	{0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02}, // (
+	{0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08}, // )
+	{0x00, 0x04, 0x15, 0x0e, 0x15, 0x04, 0x00}, // *
+	{0x00, 0x04, 0x04, 0x1f, 0x04, 0x04, 0x00}, // +
+	{0x00, 0x00, 0x00, 0x00, 0x0c, 0x04, 0x08}, // ,
+	{0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00}, // -
+	{0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c}, // .
+	{0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00}, // /
+	{0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e}, // 0
+	{0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e}, // 1
+	{0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f}, // 2
+	{0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e}, // 3
+	{0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02}, // 4
+	{0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e}, // 5
+	{0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e}, // 6
+	{0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}, // 7
+	{0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e}, // 8
+	{0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c}, // 9
+	{0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00}, // :
+	{0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x04, 0x08}, // ;
+	{0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02}, // <
+	{0x00, 0x00, 0x1f, 0x00, 0x1f, 0x00, 0x00}, // =
+	{0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08}, // >
+	{0x0e, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04}, // ?
+	{0x0e, 0x11, 0x01, 0x0d, 0x15, 0x15, 0x0e}, // @
+	{0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11}, // A
+	{0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e}, // B
+	{0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e}, // C
+	{0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c}, // D
+	{0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f}, // E
+	{0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10}, // F
+	{0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f}, // G
+	{0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11}, // H
+	{0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e}, // I
+	{0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c}, // J
+	{0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11}, // K
+	{0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f}, // L
+	{0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11}, // M
+	{0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11}, // N
+	{0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e}, // O
+	{0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10}, // P
+	{0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d}, // Q
+	{0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11}, // R
+	{0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e}, // S
+	{0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, // T
+	{0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e}, // U
+	{0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04}, // V
+	{0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a}, // W
+	{0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11}, // X
+	{0x11, 0x11, 0x0a, 0x04, 0x04, 0x04, 0x04}, // Y
+	{0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f}, // Z
+	{0x0e, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0e}, // [
+	{0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00}, // backslash
+	{0x0e, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0e}, // ]
+	{0x04, 0x0a, 0x11, 0x00, 0x00, 0x00, 0x00}, // ^
+	{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1f}, // _
+};
+
+int hud_init(hud_t* hud) {
+	memset(hud, 0, sizeof(*hud));
+	hud->program = get_hud_shader();
+	if (hud->program == (uint32_t)-1) {
+		hud->program = 0;
+		return -1;
+	}
+
+	// Every glyph side by side, glyph g's column x is texel g * 5 + x
+	uint8_t texels[GLYPH_HEIGHT][FONT_GLYPHS * GLYPH_WIDTH];
+	for (int32_t y = 0; y < GLYPH_HEIGHT; y++) {
+		for (int32_t g = 0; g < FONT_GLYPHS; g++) {
+			for (int32_t x = 0; x < GLYPH_WIDTH; x++) {
+				texels[y][g * GLYPH_WIDTH + x] = font[g][y] & (0x10 >> x) ? 255 : 0;
+			}
+		}
+	}
+	GLint bound;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+	glGenTextures(1, &hud->font);
+	glBindTexture(GL_TEXTURE_2D, hud->font);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, FONT_GLYPHS * GLYPH_WIDTH, GLYPH_HEIGHT, 0, GL_RED, GL_UNSIGNED_BYTE, texels);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glBindTexture(GL_TEXTURE_2D, bound);
+
+	// Corners come from gl_VertexID, the only attribute is the cell
+	glGenVertexArrays(1, &hud->vao);
+	glBindVertexArray(hud->vao);
+	glGenBuffers(1, &hud->instance_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, hud->instance_buffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(hud->cells), NULL, GL_STREAM_DRAW);
+	glVertexAttribIPointer(0, 4, GL_UNSIGNED_BYTE, sizeof(hud_cell_t), 0);
+	glVertexAttribDivisor(0, 1);
+	glEnableVertexAttribArray(0);
+
+	glGenQueries(HUD_QUERIES, hud->queries);
+
+	glUseProgram(hud->program);
+	glUniform1i(glGetUniformLocation(hud->program, "font"), 1);
+	hud->viewport_uniform = glGetUniformLocation(hud->program, "viewport");
+	hud->scale_uniform = glGetUniformLocation(hud->program, "scale");
+	return 0;
+}
+
+void hud_destroy(hud_t* hud) {
+	if (hud->program == 0) {
+		return;
+	}
+	glDeleteQueries(HUD_QUERIES, hud->queries);
+	glDeleteTextures(1, &hud->font);
+	glDeleteBuffers(1, &hud->instance_buffer);
+	glDeleteVertexArrays(1, &hud->vao);
+	glDeleteProgram(hud->program);
+	memset(hud, 0, sizeof(*hud));
+}
+
+static void add_sample(hud_samples_t* samples, double value) {
+	samples->values[samples->next] = value;
+	samples->next = (samples->next + 1) % HUD_SAMPLES;
+	if (samples->count < HUD_SAMPLES) {
+		samples->count++;
+	}
+}
+
+static void summarise(const hud_samples_t* samples, double* average, double* max) {
+	*average = 0.0;
+	*max = 0.0;
+	for (size_t i = 0; i < samples->count; i++) {
+		*average += samples->values[i];
+		if (samples->values[i] > *max) {
+			*max = samples->values[i];
+		}
+	}
+	if (samples->count > 0) {
+		*average /= samples->count;
+	}
+}
+
+// Results of earlier frames that have come in, oldest first
+static void collect_queries(hud_t* hud) {
+	for (size_t i = 0; i < HUD_QUERIES; i++) {
+		size_t slot = (hud->next_query + i) % HUD_QUERIES;
+		if (!hud->pending[slot]) {
+			continue;
+		}
+		GLint available = 0;
+		glGetQueryObjectiv(hud->queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) {
+			break;
+		}
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(hud->queries[slot], GL_QUERY_RESULT, &elapsed);
+		hud->pending[slot] = false;
+		add_sample(&hud->gpu, elapsed / 1e6);
+	}
+}
+
+void hud_frame_begin(hud_t* hud, double start) {
+	hud->timing = false;
+	if (!hud->visible) {
+		return;
+	}
+	hud->frame_start = start;
+	collect_queries(hud);
+	// Every query still in flight, this frame goes untimed rather than waiting
+	if (hud->pending[hud->next_query]) {
+		return;
+	}
+	glBeginQuery(GL_TIME_ELAPSED, hud->queries[hud->next_query]);
+	hud->timing = true;
+}
+
+void hud_frame_end(hud_t* hud) {
+	if (!hud->visible) {
+		return;
+	}
+	if (hud->timing) {
+		glEndQuery(GL_TIME_ELAPSED);
+		hud->pending[hud->next_query] = true;
+		hud->next_query = (hud->next_query + 1) % HUD_QUERIES;
+		hud->timing = false;
+	}
+	add_sample(&hud->cpu, (glfwGetTime() - hud->frame_start) * 1e3);
+}
+
+static double hit_rate(uint64_t hits, uint64_t misses) {
+	return hits + misses > 0 ? 100.0 * hits / (hits + misses) : 0.0;
+}
+
+static void format_lines(hud_t* hud, const app_data_t* app_data, char lines[HUD_LINES][HUD_COLUMNS + 1]) {
+	double average, max;
+	size_t line = 0;
+	summarise(&hud->cpu, &average, &max);
+	snprintf(lines[line++], HUD_COLUMNS + 1, "FRAME    %6.2f MS MAX %6.2f", average, max);
+	if (hud->gpu.count > 0) {
+		summarise(&hud->gpu, &average, &max);
+		snprintf(lines[line++], HUD_COLUMNS + 1, "GPU      %6.2f MS MAX %6.2f", average, max);
+	} else {
+		snprintf(lines[line++], HUD_COLUMNS + 1, "GPU           -");
+	}
+	snprintf(lines[line++], HUD_COLUMNS + 1, "DECODE   %6.1f MS", last_decode_ms());
+	snprintf(lines[line++], HUD_COLUMNS + 1, "UPLOAD   %6.1f MS", last_upload_ms());
+
+	const texture_cache_t* textures = app_data->textures;
+	snprintf(lines[line++], HUD_COLUMNS + 1, "VRAM     %6.1f MB", textures->resident_bytes / (1024.0 * 1024.0));
+	snprintf(lines[line++], HUD_COLUMNS + 1, "TEXTURES %5.1f%% HIT %lu MISS", hit_rate(textures->hits, textures->misses),
+	         (unsigned long)textures->misses);
+
+	prefetch_t* prefetch = app_data->prefetch;
+	pthread_mutex_lock(&prefetch->lock);
+	uint64_t hits = prefetch->hits, late = prefetch->late, misses = prefetch->misses;
+	pthread_mutex_unlock(&prefetch->lock);
+	snprintf(lines[line++], HUD_COLUMNS + 1, "PREFETCH %5.1f%% HIT %lu LATE", hit_rate(hits, late + misses),
+	         (unsigned long)late);
+
+	thumbnailer_t* thumbnailer = app_data->thumbnailer;
+	if (thumbnailer != NULL) {
+		pthread_mutex_lock(&thumbnailer->lock);
+		hits = thumbnailer->hits;
+		misses = thumbnailer->generated;
+		pthread_mutex_unlock(&thumbnailer->lock);
+		snprintf(lines[line++], HUD_COLUMNS + 1, "THUMBS   %5.1f%% HIT %lu MADE", hit_rate(hits, misses),
+		         (unsigned long)misses);
+	}
+	while (line < HUD_LINES) {
+		lines[line++][0] = '\0';
+	}
+}
+
+// A cell for every character of the panel, spaces included so the background is drawn with the text
+static size_t layout_cells(hud_t* hud, char lines[HUD_LINES][HUD_COLUMNS + 1]) {
+	size_t used_lines = 0, used_columns = 0;
+	for (size_t i = 0; i < HUD_LINES; i++) {
+		size_t length = strlen(lines[i]);
+		if (length > 0) {
+			used_lines = i + 1;
+		}
+		if (length > used_columns) {
+			used_columns = length;
+		}
+	}
+	size_t count = 0;
+	for (size_t row = 0; row < used_lines + 2; row++) {
+		for (size_t column = 0; column < used_columns + 2; column++) {
+			char c = ' ';
+			if (row > 0 && row <= used_lines && column > 0 && column <= strlen(lines[row - 1])) {
+				c = lines[row - 1][column - 1];
+			}
+			if (c >= 'a' && c <= 'z') {
+				c -= 'a' - 'A';
+			}
+			if (c < FONT_FIRST || c >= FONT_FIRST + FONT_GLYPHS) {
+				c = '?';
+			}
+			hud->cells[count++] = (hud_cell_t){(uint8_t)column, (uint8_t)row, (uint8_t)(c - FONT_FIRST), 0};
+		}
+	}
+	return count;
+}
+
+void hud_draw(hud_t* hud, const app_data_t* app_data, int32_t fb_width, int32_t fb_height) {
+	if (!hud->visible || hud->program == 0) {
+		return;
+	}
+	hud->last_draw = glfwGetTime();
+	char lines[HUD_LINES][HUD_COLUMNS + 1];
+	format_lines(hud, app_data, lines);
+	size_t count = layout_cells(hud, lines);
+
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glViewport(0, 0, fb_width, fb_height);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	glUseProgram(hud->program);
+	glUniform2f(hud->viewport_uniform, (float)fb_width, (float)fb_height);
+	glUniform1f(hud->scale_uniform, (float)HUD_SCALE);
+	glBindVertexArray(hud->vao);
+	glBindBuffer(GL_ARRAY_BUFFER, hud->instance_buffer);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(hud_cell_t), hud->cells);
+	// Unit 1, the image stays bound to unit 0 between frames
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, hud->font);
+	glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)count);
+	glActiveTexture(GL_TEXTURE0);
+
+	glDisable(GL_BLEND);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+double hud_due(const hud_t* hud) {
+	return hud->visible ? hud->last_draw + HUD_REFRESH_SECONDS : 0.0;
+}
@@ -1,58 +1,396 @@
 #include "image.h"
 
 #include <GL/glew.h>
+#include <limits.h>
+#include <math.h>
+#include <stdatomic.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
 
-uint32_t get_image(const char* filename, int32_t* width, int32_t* height){
-	GLuint texture;
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
+#include "file_map.h"
+#include "jpeg.h"
+#include "trace.h"
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define HALF_X86 1
+#include <immintrin.h>
+#endif
+
+// Largest finite half, brighter values are clamped to it rather than turning into infinity
+#define HALF_MAX 65504.0f
+// Samples converted at a time from 16 bit integers
+#define HALF_CHUNK 1024
+
+// Nanoseconds the most recent decode and upload took, whichever thread ran them
+static _Atomic uint64_t last_decode = 0;
+static _Atomic uint64_t last_upload = 0;
+
+uint16_t half_from_float(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint16_t sign = (bits >> 16) & 0x8000;
+	uint32_t magnitude = bits & 0x7fffffff;
+	if (magnitude > 0x7f800000) {
+		return 0;
+	}
+	// Would round up past HALF_MAX
+	if (magnitude >= 0x477ff000) {
+		return sign | 0x7bff;
+	}
+	if (magnitude >= 0x38800000) {
+		// Rebias the exponent and round the mantissa to nearest even
+		return sign | ((magnitude - (112u << 23) + 0xfff + ((magnitude >> 13) & 1)) >> 13);
+	}
+	// Subnormal halves, in steps of 2^-24
+	int32_t shift = 126 - (int32_t)(magnitude >> 23);
+	if (shift > 24) {
+		return sign;
+	}
+	uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000;
+	uint32_t half = mantissa >> shift;
+	uint32_t rest = mantissa & ((1u << shift) - 1);
+	uint32_t midpoint = 1u << (shift - 1);
+	if (rest > midpoint || (rest == midpoint && (half & 1))) {
+		half++;
+	}
+	return sign | half;
+}
+
+float half_to_float(uint16_t half) {
+	uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+	uint32_t exponent = (half >> 10) & 0x1f;
+	uint32_t mantissa = half & 0x3ff;
+	if (exponent == 0) {
+		float value = mantissa / 16777216.0f;
+		return sign != 0 ? -value : value;
+	}
+	uint32_t bits = exponent == 0x1f ? sign | 0x7f800000 | (mantissa << 13) : sign | ((exponent + 112) << 23) | (mantissa << 13);
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+#ifdef HALF_X86
+// Eight at a time, returns how many were converted
+__attribute__((target("avx,f16c"))) static size_t halves_from_floats_f16c(const float* src, uint16_t* dst, size_t count) {
+	const __m256 max = _mm256_set1_ps(HALF_MAX);
+	const __m256 min = _mm256_set1_ps(-HALF_MAX);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 values = _mm256_max_ps(_mm256_min_ps(_mm256_loadu_ps(src + i), max), min);
+		_mm_storeu_si128((__m128i*)(dst + i), _mm256_cvtps_ph(values, _MM_FROUND_TO_NEAREST_INT));
+	}
+	return i;
+}
+#endif
+
+static void halves_from_floats(const float* src, uint16_t* dst, size_t count) {
+	size_t i = 0;
+#ifdef HALF_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("f16c")) {
+		i = halves_from_floats_f16c(src, dst, count);
+	}
+#endif
+	for (; i < count; i++) {
+		dst[i] = half_from_float(src[i]);
+	}
+}
+
+// Takes ownership of samples
+static uint16_t* half_from_float_samples(float* samples, size_t count) {
+	uint16_t* halves = malloc(count * sizeof(uint16_t));
+	if (halves != NULL) {
+		halves_from_floats(samples, halves, count);
+	}
+	stbi_image_free(samples);
+	return halves;
+}
+
+// In place, 0..65535 becomes 0..1
+static uint16_t* half_from_unorm16_samples(uint16_t* samples, size_t count) {
+	float chunk[HALF_CHUNK];
+	for (size_t i = 0; i < count; i += HALF_CHUNK) {
+		size_t n = count - i < HALF_CHUNK ? count - i : HALF_CHUNK;
+		for (size_t j = 0; j < n; j++) {
+			chunk[j] = samples[i + j] * (1.0f / 65535.0f);
+		}
+		halves_from_floats(chunk, samples + i, n);
+	}
+	return samples;
+}
+
+static int decode_mapped(const char* filename, int32_t max_width, int32_t max_height, image_t* image) {
+	// Callers free whatever comes back, failed decodes included, so nothing may be left uninitialized
+	*image = (image_t){0};
+	file_map_t map;
+	if (map_file(filename, &map) != 0) {
+		return -1;
+	}
+	if (map.size > INT_MAX) {
+		fprintf(stderr, "Image too large: %s\n", filename);
+		unmap_file(&map);
+		return -1;
+	}
+
+	sigjmp_buf jump;
+	if (sigsetjmp(jump, 1) != 0) {
+		// Whatever the decoder allocated before the fault is lost, a leak beats a crash
+		map_guard_end();
+		fprintf(stderr, "File truncated while loading: %s\n", filename);
+		unmap_file(&map);
+		return -1;
+	}
+	map_guard_begin(&jump);
+
+	if (is_jpeg(map.data, map.size) && decode_jpeg(map.data, map.size, max_width, max_height, image) == 0) {
+		map_guard_end();
+		unmap_file(&map);
+		image->sample = IMAGE_UNORM8;
+		image->hdr = false;
+		return 0;
+	}
+
+	int w, h, channels;
+	// Decoding may happen on a worker thread, so don't touch the global flip flag
+	stbi_set_flip_vertically_on_load_thread(1);
+	void* pixels;
+	image_sample_t sample = IMAGE_HALF;
+	bool hdr = false;
+	// Anything with more than 8 bits per channel is kept as half floats instead of being cut down to bytes
+	if (stbi_is_hdr_from_memory(map.data, (int)map.size)) {
+		hdr = true;
+		float* samples = stbi_loadf_from_memory(map.data, (int)map.size, &w, &h, &channels, 0);
+		pixels = samples != NULL ? half_from_float_samples(samples, (size_t)w * h * channels) : NULL;
+	} else if (stbi_is_16_bit_from_memory(map.data, (int)map.size)) {
+		uint16_t* samples = stbi_load_16_from_memory(map.data, (int)map.size, &w, &h, &channels, 0);
+		pixels = samples != NULL ? half_from_unorm16_samples(samples, (size_t)w * h * channels) : NULL;
+	} else {
+		sample = IMAGE_UNORM8;
+		pixels = stbi_load_from_memory(map.data, (int)map.size, &w, &h, &channels, 0);
+	}
+	map_guard_end();
+	unmap_file(&map);
+	if (pixels == NULL) {
+		fprintf(stderr, "Failed to load image: %s\n", filename);
+		return -1;
+	}
+
+	if (image_format(channels) == 0) {
+		fprintf(stderr, "Unsupported number of channels: %d\n", channels);
+		stbi_image_free(pixels);
+		return -1;
+	}
+
+	image->pixels = pixels;
+	image->width = w;
+	image->height = h;
+	image->channels = channels;
+	image->full_width = w;
+	image->full_height = h;
+	image->sample = sample;
+	image->hdr = hdr;
+	return 0;
+}
+
+int decode_image(const char* filename, int32_t max_width, int32_t max_height, image_t* image) {
+	uint64_t start = trace_now();
+	int result = decode_mapped(filename, max_width, max_height, image);
+	uint64_t end = trace_now();
+	if (result == 0) {
+		image->compression = IMAGE_RAW;
+		atomic_store_explicit(&last_decode, end - start, memory_order_relaxed);
+	}
+	if (trace_enabled) {
+		trace_record("decode", start, end);
+	}
+	return result;
+}
+
+double last_decode_ms() {
+	return atomic_load_explicit(&last_decode, memory_order_relaxed) / 1e6;
+}
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+void record_upload(uint64_t start) {
+	uint64_t end = trace_now();
+	atomic_store_explicit(&last_upload, end - start, memory_order_relaxed);
+	if (trace_enabled) {
+		trace_record("upload", start, end);
+	}
+}
+
+double last_upload_ms() {
+	return atomic_load_explicit(&last_upload, memory_order_relaxed) / 1e6;
+}
 
+int probe_image(const char* filename, int32_t* width, int32_t* height) {
+	// stb stops reading after the header, a buffered FILE only touches the first few KB
 	int w, h, channels;
-	stbi_set_flip_vertically_on_load(1);
-	unsigned char* image = stbi_load(filename, &w, &h, &channels, 0);
-	if (image == NULL) {
-		printf("Failed to load image: %s\n", filename);
+	if (!stbi_info(filename, &w, &h, &channels) || w <= 0 || h <= 0) {
+		fprintf(stderr, "Failed to read image header: %s\n", filename);
 		return -1;
 	}
+	*width = w;
+	*height = h;
+	return 0;
+}
+
+void free_image(image_t* image) {
+	if (image->pixels != NULL) {
+		stbi_image_free(image->pixels);
+	}
+	image->pixels = NULL;
+	for (int32_t i = 0; i < image->mip_count; i++) {
+		free(image->mips[i].pixels);
+	}
+	free(image->mips);
+	image->mips = NULL;
+	image->mip_count = 0;
+}
+
+size_t image_size(const image_t* image) {
+	if (image->compression != IMAGE_RAW) {
+		size_t blocks = (size_t)((image->width + 3) / 4) * ((image->height + 3) / 4);
+		return blocks * (image->compression == IMAGE_BC1 ? 8 : 16);
+	}
+	return (size_t)image->width * image->height * pixel_size(image);
+}
+
+size_t pixel_size(const image_t* image) {
+	return (size_t)image->channels * (image->sample == IMAGE_HALF ? sizeof(uint16_t) : 1);
+}
+
+size_t image_memory(const image_t* image) {
+	size_t size = image_size(image);
+	for (int32_t i = 0; i < image->mip_count; i++) {
+		size += image_size(&image->mips[i]);
+	}
+	return size;
+}
+
+const image_t* image_level(const image_t* image, int32_t level) {
+	return level == 0 ? image : &image->mips[level - 1];
+}
 
-	GLenum format;
+uint32_t image_format(int32_t channels) {
 	switch (channels) {
-		case 1: {
-			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-			format = GL_RED;
-			break;
-		}
-		case 2: {
-			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-			format = GL_RG;
-			break;
-		}
-		case 3: {
-			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-			format = GL_RGB;
-			break;
-		}
-		case 4: {
-			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-			format = GL_RGBA;
-			break;
-		}
+		case 1:
+			return GL_RED;
+		case 2:
+			return GL_RG;
+		case 3:
+			return GL_RGB;
+		case 4:
+			return GL_RGBA;
+		default:
+			return 0;
+	}
+}
+
+uint32_t compressed_format(image_compression_t compression) {
+	switch (compression) {
+		case IMAGE_BC1:
+			return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		case IMAGE_BC3:
+			return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
 		default:
-			printf("Unsupported number of channels: %d\n", channels);
+			return 0;
+	}
+}
+
+uint32_t internal_format(const image_t* image) {
+	if (image->sample != IMAGE_HALF) {
+		return image_format(image->channels);
+	}
+	switch (image->channels) {
+		case 1:
+			return GL_R16F;
+		case 2:
+			return GL_RG16F;
+		case 3:
+			return GL_RGB16F;
+		case 4:
+			return GL_RGBA16F;
+		default:
+			return 0;
+	}
+}
+
+uint32_t pixel_type(const image_t* image) {
+	return image->sample == IMAGE_HALF ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE;
+}
+
+int image_to_unorm8(image_t* image) {
+	if (image->sample != IMAGE_HALF) {
+		return 0;
+	}
+	bool hdr = image->hdr;
+	for (int32_t i = 0; i <= image->mip_count; i++) {
+		image_t* level = i == 0 ? image : &image->mips[i - 1];
+		size_t channels = level->channels;
+		size_t count = (size_t)level->width * level->height * level->channels;
+		const uint16_t* src = (const uint16_t*)level->pixels;
+		unsigned char* dst = malloc(count);
+		if (dst == NULL) {
 			return -1;
+		}
+		for (size_t j = 0; j < count; j++) {
+			float value = half_to_float(src[j]);
+			// Alpha is never tone mapped
+			bool alpha = (channels == 2 || channels == 4) && j % channels == channels - 1;
+			if (hdr && !alpha) {
+				value = value > 0.0f ? powf(value / (1.0f + value), 1.0f / 2.2f) : 0.0f;
+			}
+			value = value < 0.0f ? 0.0f : value > 1.0f ? 1.0f : value;
+			dst[j] = (unsigned char)(value * 255.0f + 0.5f);
+		}
+		free(level->pixels);
+		level->pixels = dst;
+		level->sample = IMAGE_UNORM8;
+		level->hdr = false;
 	}
+	return 0;
+}
 
-	glTexImage2D(GL_TEXTURE_2D, 0, format, w, h, 0, format, GL_UNSIGNED_BYTE, image);
-	*width = w;
-	*height = h;
-	stbi_image_free(image);
+void set_texture_params(int32_t mip_count) {
+	// Clamp, or the coarser levels bleed the opposite edge in
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mip_count > 0 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mip_count);
+}
+
+uint32_t upload_image(const image_t* image) {
+	GLenum format = image_format(image->channels);
+	GLenum internal = internal_format(image);
+	GLenum blocks = compressed_format(image->compression);
+	if (format == 0 && blocks == 0) {
+		printf("Unsupported number of channels: %d\n", image->channels);
+		return -1;
+	}
+
+	uint64_t start = trace_now();
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	set_texture_params(image->mip_count);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (int32_t i = 0; i <= image->mip_count; i++) {
+		const image_t* level = image_level(image, i);
+		if (blocks != 0) {
+			glCompressedTexImage2D(GL_TEXTURE_2D, i, blocks, level->width, level->height, 0, (GLsizei)image_size(level),
+			                       level->pixels);
+		} else {
+			glTexImage2D(GL_TEXTURE_2D, i, internal, level->width, level->height, 0, format, pixel_type(image),
+			             level->pixels);
+		}
+	}
+	record_upload(start);
 	return texture;
 }
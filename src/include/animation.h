@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "controls.h"
+
+// Zoom and pan driven by held keys. Velocities ease towards the target set by
+// the keys and are integrated over the real time between frames, so the speed
+// doesn't depend on the frame rate. The view is kept in floats and written back
+// to the integer viewport in app_data, which avoids rounding drift in the
+// aspect ratio while zooming.
+typedef struct view_motion_t {
+	float x;
+	float y;
+	float width;
+	float height;
+	// The viewport last written, anything else means the view was changed elsewhere
+	int32_t v_x;
+	int32_t v_y;
+	int32_t im_width;
+	int32_t im_height;
+	// Natural log of the scale per second
+	double zoom_velocity;
+	// Pixels per second
+	double pan_velocity_x;
+	double pan_velocity_y;
+	double last_time;
+	bool moving;
+} view_motion_t;
+
+void view_motion_init(view_motion_t* motion);
+// zoom and pan_x/pan_y are -1, 0 or 1 from the held keys, returns true while the view is moving
+bool view_motion_update(view_motion_t* motion, app_data_t* app_data, int32_t zoom, int32_t pan_x, int32_t pan_y, double time);
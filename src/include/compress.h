@@ -0,0 +1,69 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "image.h"
+
+// Smaller images stay uncompressed, they cost little memory and encoding them costs a visible delay
+#define COMPRESS_MIN_PIXELS (4 * 1024 * 1024)
+// Block rows a thread takes at a time
+#define COMPRESS_CHUNK_ROWS 8
+#define MAX_COMPRESS_THREADS 16
+// Bumped whenever the encoder or the file layout changes, older files are ignored
+#define BLOCK_CACHE_VERSION 1
+// Past this the least recently used files are deleted, each new one is checked against it
+#define BLOCK_CACHE_LIMIT_MB 2048
+
+typedef struct compress_report_t {
+	image_compression_t compression;
+	// What the levels took before and after
+	size_t raw_bytes;
+	size_t compressed_bytes;
+	// Of level 0 against the decoded pixels
+	double psnr;
+	double seconds;
+	bool from_cache;
+} compress_report_t;
+
+// Stores large images as BC1 (opaque) or BC3 (with alpha) blocks, a sixth or
+// a quarter of the memory they take as RGB or RGBA. Blocks are encoded with
+// stb_dxt on a few threads at once and kept on disk, keyed by a hash of the
+// file's path, size and modification time, so opening the same image again
+// skips decoding and encoding.
+typedef struct compressor_t {
+	// NULL when there's nowhere to keep blocks
+	char* cache_dir;
+	// Bytes of blocks kept on disk
+	uint64_t cache_limit;
+	// Largest texture the GL allows, bigger images are tiled and stay uncompressed
+	int32_t max_size;
+	size_t threads;
+	pthread_mutex_t lock;
+	uint64_t encoded;
+	uint64_t cache_hits;
+	uint64_t raw_bytes;
+	uint64_t compressed_bytes;
+} compressor_t;
+
+// cache_dir NULL uses $XDG_CACHE_HOME/imeye/blocks/
+int compressor_init(compressor_t* compressor, int32_t max_size, const char* cache_dir);
+void compressor_destroy(compressor_t* compressor);
+// Hash of the file's path and stat() identity the cache is keyed by, rewriting the file changes it
+int block_key(const char* path, unsigned char key[16]);
+// Fills image with the blocks cached under key, returns -1 on a miss
+int compressor_load(compressor_t* compressor, const unsigned char key[16], image_t* image, compress_report_t* report);
+// Replaces every level of a full resolution image with blocks and caches them
+// under key, or leaves the image as it is and returns -1 when it's too small,
+// reduced or too big for a single texture. key may be NULL to skip caching.
+int compressor_compress(compressor_t* compressor, const unsigned char key[16], image_t* image,
+                        compress_report_t* report);
+// Encodes level by level without any checks, report gets the PSNR and sizes
+int compress_levels(image_t* image, size_t threads, compress_report_t* report);
+// Expands one level back to RGBA, for measuring quality
+int decompress_level(const image_t* level, unsigned char* rgba);
+const char* compression_name(image_compression_t compression);
+// One line on stdout about an image compressed or loaded from the cache
+void print_compress_report(const char* path, const compress_report_t* report);
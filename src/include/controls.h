@@ -5,17 +5,19 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-typedef enum zoom_t {
-	ZOOM_IN,
-	ZOOM_OUT
-} zoom_t;
-
-typedef enum move_direction_t { 
-	UP,
-	DOWN,
-	LEFT,
-	RIGHT
-} direction_t;
+#include "prefetch.h"
+#include "texcache.h"
+#include "uploader.h"
+#include "tiles.h"
+#include "dir_splore.h"
+#include "watcher.h"
+#include "thumbs.h"
+#include "grid.h"
+#include "gif_player.h"
+
+// Stops per key press, and how far either way exposure goes
+#define EXPOSURE_STEP 0.5f
+#define MAX_EXPOSURE 10.0f
 
 typedef enum rotate_direction_t {
 	CLOCKWISE,
@@ -44,15 +46,63 @@ typedef struct app_data_t {
 	int32_t rotation;
 	int8_t scroll;
 	size_t image_index;
-	size_t image_count;
-	char** image_paths;
+	path_table_t* images;
+	// Fills images in the background, NULL once it's done
+	dir_scan_t* scan;
+	// Keeps images up to date with the directory, NULL where inotify isn't available
+	dir_watch_t* watch;
+	// Full path of images[image_index]
+	char* image_path;
+	prefetch_t* prefetch;
+	texture_cache_t* textures;
+	uploader_t* uploader;
+	// Both made the first time the grid is opened, NULL before
+	thumbnailer_t* thumbnailer;
+	grid_view_t* grid;
+	// Showing the grid instead of the image
+	bool in_grid;
+	// Playing the current image, NULL unless it's an animated GIF
+	gif_player_t* gif;
+	// Set instead of texture for images drawn in tiles
+	tiled_image_t* tiled;
+	// Width of the texture and of the image in the file, they differ after a reduced JPEG decode
+	int32_t texture_width;
+	int32_t full_width;
+	// The displayed image holds linear radiance for the shader to tone map
+	bool hdr;
+	// Stops brighter or darker than the file, applied in the shader
+	float exposure;
+	// Waiting for a full resolution decode of the current image
+	bool refining;
+	// Switched to an image that is still being uploaded
+	bool loading;
+	// Waiting on the prefetcher for the current image, at startup or after it was rewritten
+	bool decoding;
 	bool fullscreen;
-	float scale;
+	// The view changed since the last frame was drawn
+	bool dirty;
 } app_data_t;
 
-void zoom_(zoom_t zoom, app_data_t* app_data);
-void move(direction_t direction, app_data_t* app_data);
 void fullscreen(app_data_t* app_data, GLFWwindow* window, GLFWmonitor* monitor);
 void switch_image(control_t control, app_data_t* app_data, GLFWwindow* window);
+// direction is 1 or -1, the way the prefetcher should look ahead from there.
+// Returns -1 and leaves the current image as it is when index can't be decoded.
+int open_image(app_data_t* app_data, size_t index, int direction);
+// Opens the grid on the current image, or closes it and opens the selected one
+void toggle_grid(app_data_t* app_data);
+void poll_uploads(app_data_t* app_data);
+// Shows the next frame of an animated GIF when it's due
+void poll_animation(app_data_t* app_data);
+void stop_animation(app_data_t* app_data);
+// Merges scanned and watched directory changes, reloading the current image when it was rewritten
+void poll_directory(app_data_t* app_data);
+// Decodes the current image again without blocking, for poll_uploads() to show
+void reload_image(app_data_t* app_data);
+void show_image(app_data_t* app_data, uint32_t texture, tiled_image_t* tiled, int32_t texture_width, int32_t width, int32_t height,
+                bool hdr);
+void replace_image(app_data_t* app_data, uint32_t texture, tiled_image_t* tiled, int32_t texture_width, bool hdr);
+// steps is a number of EXPOSURE_STEPs up or down, 0 goes back to the file's own exposure
+void adjust_exposure(app_data_t* app_data, int32_t steps);
+void check_resolution(app_data_t* app_data);
 int reset_viewer(app_data_t* app_data);
 void rotate(rotate_direction_t direction, app_data_t* app_data);
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stddef.h>
+
+// Processors online, at least 1
+size_t cpu_count();
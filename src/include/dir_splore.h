@@ -1,3 +1,72 @@
 #pragma once
 
-char** list_images(const char* filepath);
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// Images of one directory in display order. The directory is stored once and
+// the names are packed back to back in a single arena, entries are offsets
+// into it, so a 100k file folder costs a few MB and two allocations.
+typedef struct path_table_t {
+	// Ends with a separator
+	char* directory;
+	size_t directory_length;
+	// NUL terminated names
+	char* names;
+	size_t names_size;
+	size_t names_capacity;
+	uint32_t* offsets;
+	size_t count;
+	size_t capacity;
+	// Bumped whenever entries are added or removed, indices from an older generation may be stale
+	uint64_t generation;
+} path_table_t;
+
+// Reads a directory on a worker thread, publishing sorted batches of entries
+// as they come in so the first image never waits for a large directory.
+typedef struct dir_scan_t {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	// Read but not handed to the displayed table yet, sorted
+	path_table_t pending;
+	// Called from the worker after each batch, e.g. to wake the event loop
+	void (*notify)(void);
+	bool cancel;
+	bool done;
+	bool failed;
+	bool started;
+} dir_scan_t;
+
+// Synchronous listing of every image next to filepath
+int list_images(const char* filepath, path_table_t* table);
+// Table holding only filepath itself, for dir_scan_merge() to fill in around it
+int path_table_init(path_table_t* table, const char* filepath);
+// Adds the entries of sorted, which must share the directory, skipping names already present
+int path_table_merge(path_table_t* table, const path_table_t* sorted);
+void path_table_destroy(path_table_t* table);
+const char* path_table_name(const path_table_t* table, size_t index);
+// Full path of the entry, free() it
+char* path_table_path(const path_table_t* table, size_t index);
+bool path_table_is(const path_table_t* table, size_t index, const char* path);
+// Index of the entry with the same file name as path, count if there is none
+size_t path_table_find(const path_table_t* table, const char* path);
+// Appends name unsorted, path_table_sort() puts it in display order
+int path_table_add(path_table_t* table, const char* name);
+int path_table_sort(path_table_t* table);
+// Drops the entries named in names
+int path_table_remove(path_table_t* table, const path_table_t* names);
+bool is_image_name(const char* name);
+// Part of path after the last separator
+const char* path_file_name(const char* path);
+// Bytes allocated by the table
+size_t path_table_memory(const path_table_t* table);
+
+int dir_scan_start(dir_scan_t* scan, const char* directory, void (*notify)(void));
+// Whether dir_scan_merge() has anything to add
+bool dir_scan_ready(dir_scan_t* scan);
+// Moves the entries read so far into table, returns true if it grew
+bool dir_scan_merge(dir_scan_t* scan, path_table_t* table);
+// Every entry has been merged
+bool dir_scan_done(dir_scan_t* scan);
+void dir_scan_destroy(dir_scan_t* scan);
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+typedef jmp_buf sigjmp_buf;
+#define sigsetjmp(env, savemask) setjmp(env)
+#endif
+
+typedef struct file_map_t {
+	const unsigned char* data;
+	size_t size;
+} file_map_t;
+
+// Maps the whole file read only, hinting the kernel that it will be read sequentially
+int map_file(const char* path, file_map_t* map);
+void unmap_file(file_map_t* map);
+
+// A file truncated while it is mapped raises SIGBUS when the missing pages are
+// touched. Between begin and end such a fault on this thread siglongjmps to jump
+// instead of killing the process.
+void map_guard_begin(sigjmp_buf* jump);
+void map_guard_end();
+
+// In nanoseconds, -1 if the file can't be stat'ed
+int64_t file_mtime(const char* path);
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "file_map.h"
+#include "image.h"
+
+#define GIF_MAX_CODES 4096
+// Browsers play frames with a delay of 0 or 10 ms at this, so do the same
+#define GIF_DEFAULT_DELAY_MS 100
+
+// Decodes a GIF one frame at a time. Only the composited canvas, the canvas
+// before the last frame and the indices of one frame are held, so memory is
+// the same for a GIF of two frames and one of two thousand.
+typedef struct gif_decoder_t {
+	file_map_t map;
+	// Offset of the first block after the global palette, where a loop starts again
+	size_t start;
+	size_t pos;
+	int32_t width;
+	int32_t height;
+	uint8_t palette[256 * 3];
+	// Colors in the global palette, 0 if there is none
+	int32_t palette_size;
+	// RGBA, top down
+	unsigned char* canvas;
+	// Canvas before the last frame, for frames disposed of by restoring it
+	unsigned char* previous;
+	// Color indices of the frame being decoded
+	uint8_t* indices;
+	size_t indices_size;
+	// How the last frame is cleared before the next one is drawn, and where
+	int32_t dispose;
+	int32_t dispose_x;
+	int32_t dispose_y;
+	int32_t dispose_width;
+	int32_t dispose_height;
+	// Times to play, 0 forever. From the NETSCAPE2.0 extension, once without it
+	int32_t plays;
+	// More than one image in the file
+	bool animated;
+	uint16_t prefix[GIF_MAX_CODES];
+	uint8_t suffix[GIF_MAX_CODES];
+	uint8_t stack[GIF_MAX_CODES];
+} gif_decoder_t;
+
+// Maps the file and reads the header, returns -1 if it isn't a GIF
+int gif_open(const char* filename, gif_decoder_t* gif);
+void gif_close(gif_decoder_t* gif);
+// Composites the next frame into an RGBA image, bottom up like decode_image().
+// Returns 1 with a frame, 0 after the last one and -1 if the file is broken.
+int gif_next_frame(gif_decoder_t* gif, image_t* frame, int32_t* delay_ms);
+// Back to a blank canvas before the first frame
+void gif_rewind(gif_decoder_t* gif);
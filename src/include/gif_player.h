@@ -0,0 +1,53 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gif.h"
+#include "image.h"
+
+// Frame textures, one on screen and the rest uploaded ahead of time
+#define GIF_RING_SIZE 3
+// Frames decoded ahead and waiting for a free texture
+#define GIF_DECODE_AHEAD 2
+
+// Plays an animated GIF. A worker decodes frames just ahead of the ring of
+// textures, which are overwritten in turn as frames go off screen, so memory
+// stays at a few frames whatever the length of the animation.
+typedef struct gif_player_t {
+	gif_decoder_t* decoder;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	bool stop;
+	image_t decoded[GIF_DECODE_AHEAD];
+	int32_t decoded_delays[GIF_DECODE_AHEAD];
+	size_t decoded_head;
+	size_t decoded_count;
+	// Called from the worker after each frame, e.g. to wake the event loop
+	void (*notify)(void);
+	uint32_t textures[GIF_RING_SIZE];
+	int32_t delays[GIF_RING_SIZE];
+	// Slot on screen and the number of slots filled, counting it
+	size_t ring_head;
+	size_t ring_count;
+	// The first frame is on screen
+	bool showing;
+	// glfwGetTime() when the next frame is due
+	double due;
+	uint64_t frames;
+	// Frames shown later than due because the decoder fell behind
+	uint64_t late;
+} gif_player_t;
+
+// Returns -1 if the file isn't an animated GIF. Must be called with the GL context current.
+int gif_player_start(gif_player_t* player, const char* path, void (*notify)(void));
+void gif_player_stop(gif_player_t* player);
+// Uploads decoded frames and steps to the next one when it's due. Returns
+// true with the texture to show when that changed, it leaves the
+// GL_TEXTURE_2D binding as it found it otherwise.
+bool gif_player_poll(gif_player_t* player, double now, uint32_t* texture);
+// When gif_player_poll() should be called next, 0 when only a notify from the worker will change anything
+double gif_player_due(const gif_player_t* player);
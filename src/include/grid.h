@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dir_splore.h"
+#include "thumbs.h"
+
+// Pixels between thumbnails
+#define GRID_GAP 8
+#define GRID_CELL (THUMB_SIZE + GRID_GAP)
+// Layers of the thumbnail array texture, 64 MB at RGBA8, fewer if the driver allows less
+#define GRID_LAYERS 1024
+// Thumbnails uploaded per frame, more wait for the next one
+#define GRID_UPLOADS_PER_FRAME 64
+
+typedef struct grid_layer_t {
+	// File name of the entry it holds, NULL if free
+	char* name;
+	size_t index;
+	int32_t width;
+	int32_t height;
+	uint64_t last_used;
+} grid_layer_t;
+
+typedef struct grid_instance_t {
+	float cell[4];
+	float thumb[4];
+} grid_instance_t;
+
+// Contact sheet of a whole directory. Thumbnails live in the layers of one
+// GL_TEXTURE_2D_ARRAY and every visible cell is an instance of a single quad,
+// so a frame is one draw call however many cells are on screen. Only rows in
+// view get instances and thumbnail requests, so 100k entries cost no more
+// per frame than a hundred; layers of entries scrolled far away are reused.
+typedef struct grid_view_t {
+	thumbnailer_t* thumbnailer;
+	uint32_t program;
+	uint32_t vao;
+	uint32_t corner_buffer;
+	uint32_t instance_buffer;
+	uint32_t texture;
+	int32_t viewport_uniform;
+	grid_layer_t* layers;
+	int32_t layer_count;
+	// Per entry of the table: its layer, or one of the CELL_ states in grid.c
+	int32_t* cells;
+	size_t cell_count;
+	uint64_t generation;
+	grid_instance_t* instances;
+	size_t instance_capacity;
+	// Distance from the top of the first row to the top of the window, in pixels
+	float scroll;
+	int32_t columns;
+	int32_t fb_width;
+	int32_t fb_height;
+	size_t selected;
+	// Keeps the selection on the same file when entries are added or removed
+	char* selected_name;
+	// Entries requested for last time, from first up to but not including last.
+	// Requests are only redone when the range changes.
+	size_t first_requested;
+	size_t last_requested;
+	// Scroll to the selection on the next draw, the layout isn't known before
+	bool follow_selection;
+	uint64_t frame;
+} grid_view_t;
+
+// Must be called with the GL context current
+int grid_view_init(grid_view_t* grid, thumbnailer_t* thumbnailer);
+void grid_view_destroy(grid_view_t* grid);
+void grid_view_select(grid_view_t* grid, const path_table_t* table, size_t index);
+// Moves the selection by columns and rows, scrolling to keep it in view
+void grid_view_move(grid_view_t* grid, const path_table_t* table, int32_t columns, int32_t rows);
+void grid_view_scroll(grid_view_t* grid, float pixels);
+// Uploads finished thumbnails, returns true if the grid needs drawing again
+bool grid_view_poll(grid_view_t* grid, const path_table_t* table);
+// Sets the viewport to the whole framebuffer and draws every visible cell in one instanced draw
+void grid_view_draw(grid_view_t* grid, const path_table_t* table, int32_t fb_width, int32_t fb_height);
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "controls.h"
+
+// Characters per line and lines of text, a cell of panel is kept around them
+#define HUD_COLUMNS 30
+#define HUD_LINES 8
+// Screen pixels per font pixel
+#define HUD_SCALE 2
+// Frames averaged over
+#define HUD_SAMPLES 64
+// GPU timer queries in flight, results are read a few frames late so reading never stalls
+#define HUD_QUERIES 4
+// Redraws while idle so the numbers stay current
+#define HUD_REFRESH_SECONDS 0.5
+
+typedef struct hud_samples_t {
+	double values[HUD_SAMPLES];
+	size_t next;
+	size_t count;
+} hud_samples_t;
+
+typedef struct hud_cell_t {
+	uint8_t column;
+	uint8_t row;
+	uint8_t glyph;
+	uint8_t unused;
+} hud_cell_t;
+
+// Performance overlay. Text is drawn from a built-in 5x7 font, every
+// character cell including the panel around the text is an instance of one
+// quad, so the overlay costs a single draw call after the timed part of the
+// frame. GPU time comes from GL_TIME_ELAPSED queries, only made while shown.
+typedef struct hud_t {
+	bool visible;
+	uint32_t program;
+	uint32_t vao;
+	uint32_t instance_buffer;
+	uint32_t font;
+	int32_t viewport_uniform;
+	int32_t scale_uniform;
+	uint32_t queries[HUD_QUERIES];
+	bool pending[HUD_QUERIES];
+	size_t next_query;
+	// A query was begun this frame
+	bool timing;
+	double frame_start;
+	double last_draw;
+	hud_samples_t cpu;
+	hud_samples_t gpu;
+	hud_cell_t cells[(HUD_COLUMNS + 2) * (HUD_LINES + 2)];
+} hud_t;
+
+// Must be called with the GL context current
+int hud_init(hud_t* hud);
+void hud_destroy(hud_t* hud);
+// Around the drawing of the scene, start is glfwGetTime() when the loop
+// iteration that draws it woke up
+void hud_frame_begin(hud_t* hud, double start);
+void hud_frame_end(hud_t* hud);
+// Over whatever is in the framebuffer, leaves the viewport as it found it
+void hud_draw(hud_t* hud, const app_data_t* app_data, int32_t fb_width, int32_t fb_height);
+// glfwGetTime() of the next idle refresh, 0 while hidden
+double hud_due(const hud_t* hud);
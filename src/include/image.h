@@ -1,5 +1,78 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-uint32_t get_image(const char* filename, int32_t* width, int32_t* height);
+typedef enum image_compression_t {
+	IMAGE_RAW,
+	// 4x4 blocks of 8 bytes, opaque
+	IMAGE_BC1,
+	// 4x4 blocks of 16 bytes, BC1 colour after interpolated alpha
+	IMAGE_BC3
+} image_compression_t;
+
+typedef enum image_sample_t {
+	// A byte per channel
+	IMAGE_UNORM8,
+	// Half floats, for 16 bit and HDR files
+	IMAGE_HALF
+} image_sample_t;
+
+typedef struct image_t {
+	// Allocated with malloc
+	unsigned char* pixels;
+	int32_t width;
+	int32_t height;
+	int32_t channels;
+	// Size of the image in the file, larger than width x height after a reduced decode
+	int32_t full_width;
+	int32_t full_height;
+	// Set when pixels holds blocks row by row instead of pixels, see compress.h
+	image_compression_t compression;
+	image_sample_t sample;
+	// Linear radiance from an HDR file, tone mapped when drawn. Everything
+	// else, 16 bit files included, is already encoded for display.
+	bool hdr;
+	// Of the file before it was read, see file_mtime(). 0 when not read from a file.
+	int64_t mtime;
+	// Halved levels down to 1x1, filled in by build_mipmaps()
+	struct image_t* mips;
+	int32_t mip_count;
+} image_t;
+
+// CPU side decode, safe to call from any thread. JPEGs are decoded at a reduced
+// size when that still covers the image fitted into max_width x max_height,
+// pass 0 for both to always get full resolution.
+int decode_image(const char* filename, int32_t max_width, int32_t max_height, image_t* image);
+// Size of the image from its header, without decoding any pixels
+int probe_image(const char* filename, int32_t* width, int32_t* height);
+void free_image(image_t* image);
+size_t image_size(const image_t* image);
+// Bytes per pixel of an uncompressed image
+size_t pixel_size(const image_t* image);
+// Including the mipmaps
+size_t image_memory(const image_t* image);
+// Level 0 is the image itself
+const image_t* image_level(const image_t* image, int32_t level);
+// GL pixel format for a channel count, 0 if unsupported
+uint32_t image_format(int32_t channels);
+// GL internal format of a compressed image, 0 if it isn't
+uint32_t compressed_format(image_compression_t compression);
+// GL internal format and pixel type of an uncompressed image
+uint32_t internal_format(const image_t* image);
+uint32_t pixel_type(const image_t* image);
+uint16_t half_from_float(float value);
+float half_to_float(uint16_t half);
+// Turns a half float image into bytes for code that only handles those, HDR
+// images are tone mapped the way the shader shows them at zero exposure
+int image_to_unorm8(image_t* image);
+// How long the most recent decode_image and texture upload took, on any thread
+double last_decode_ms();
+double last_upload_ms();
+// Ends an upload that started at trace_now() == start, for uploads not made by upload_image
+void record_upload(uint64_t start);
+
+// Must be called on the thread owning the GL context
+void set_texture_params(int32_t mip_count);
+uint32_t upload_image(const image_t* image);
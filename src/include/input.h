@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define INPUT_QUEUE_SIZE 64
+
+typedef enum action_t {
+	ACTION_FULLSCREEN,
+	ACTION_NEXT,
+	ACTION_PREVIOUS,
+	ACTION_RESET,
+	ACTION_ROTATE_CLOCKWISE,
+	ACTION_ROTATE_ANTICLOCKWISE,
+	ACTION_GRID,
+	ACTION_OPEN,
+	ACTION_UP,
+	ACTION_DOWN,
+	ACTION_HUD,
+	ACTION_BRIGHTER,
+	ACTION_DARKER,
+	ACTION_EXPOSURE_RESET
+} action_t;
+
+typedef struct input_event_t {
+	action_t action;
+	// glfwGetTime() when the key event arrived
+	double time;
+} input_event_t;
+
+// Actions from the key callback, applied by the main loop before it draws.
+// Callbacks run on the main thread, so there is no locking.
+typedef struct input_queue_t {
+	input_event_t events[INPUT_QUEUE_SIZE];
+	size_t head;
+	size_t count;
+	// Applied but not on screen yet, only kept when measuring latency
+	input_event_t presenting[INPUT_QUEUE_SIZE];
+	size_t presenting_count;
+	bool measure_latency;
+	uint64_t dropped;
+} input_queue_t;
+
+const char* action_name(action_t action);
+void input_queue_init(input_queue_t* queue, bool measure_latency);
+// Key repeats are dropped while the same action is still queued, so holding a
+// key never builds a backlog behind a slow image switch
+void input_push(input_queue_t* queue, action_t action, double time, bool repeat);
+bool input_pop(input_queue_t* queue, input_event_t* event);
+// The effect of the event is in the next frame presented
+void input_applied(input_queue_t* queue, const input_event_t* event);
+// Logs the latency of every applied event, call after the frame is on screen
+void input_presented(input_queue_t* queue, double time);
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "image.h"
+
+// Smaller images decode on one thread, splitting them saves less than it costs
+#define JPEG_PARALLEL_MIN_PIXELS (4 * 1024 * 1024)
+#define MAX_JPEG_THREADS 16
+// Bands per thread, so threads that get through theirs early pick up more
+#define JPEG_BANDS_PER_THREAD 4
+
+bool is_jpeg(const unsigned char* data, size_t size);
+// Smallest of 1/1, 1/2, 1/4 or 1/8 that still covers the size the image is
+// shown at when fitted into max_width x max_height, 1 if either is 0
+int32_t jpeg_scale_denom(int32_t width, int32_t height, int32_t max_width, int32_t max_height);
+// Decodes through libjpeg's scaled IDCT, so pixels are only ever produced at
+// the reduced size. Returns -1 for anything libjpeg can't turn into
+// grayscale or RGB, callers fall back to stb then. Large images with restart
+// markers are decoded on jpeg_threads() threads.
+int decode_jpeg(const unsigned char* data, size_t size, int32_t max_width, int32_t max_height, image_t* image);
+// Sequential JPEGs with restart markers are cut at the markers that start an
+// MCU row into bands, each decoded as a JPEG of its own straight into its
+// rows of the image. Anything else, or threads of 1, decodes serially.
+int decode_jpeg_threads(const unsigned char* data, size_t size, int32_t max_width, int32_t max_height, size_t threads,
+                        image_t* image);
+size_t jpeg_threads();
+// MCUs between restart markers, 0 when there are none or the file can't be split at them
+int32_t jpeg_restart_interval(const unsigned char* data, size_t size);
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct md5_t {
+	uint32_t state[4];
+	uint64_t length;
+	unsigned char buffer[64];
+} md5_t;
+
+void md5_init(md5_t* md5);
+void md5_update(md5_t* md5, const void* data, size_t size);
+void md5_final(md5_t* md5, unsigned char digest[16]);
+// 32 lowercase hex digits and a NUL
+void md5_hex(const void* data, size_t size, char hex[33]);
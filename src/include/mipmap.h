@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "image.h"
+
+typedef enum mip_isa_t {
+	MIP_SCALAR,
+	MIP_SSE2,
+	MIP_AVX2
+} mip_isa_t;
+
+// Best instruction set the CPU supports
+mip_isa_t mip_isa();
+const char* mip_isa_name(mip_isa_t isa);
+// 2x2 box filter, the last row/column is repeated for odd sizes
+int downsample_image(const image_t* src, image_t* dst, mip_isa_t isa);
+// Fills image->mips with every level down to 1x1
+int build_mipmaps(image_t* image);
+int build_mipmaps_isa(image_t* image, mip_isa_t isa);
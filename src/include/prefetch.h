@@ -0,0 +1,86 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "compress.h"
+#include "image.h"
+#include "dir_splore.h"
+
+typedef enum prefetch_state_t {
+	SLOT_EMPTY,
+	SLOT_LOADING,
+	SLOT_READY,
+	SLOT_FAILED
+} prefetch_state_t;
+
+typedef struct prefetch_slot_t {
+	prefetch_state_t state;
+	size_t index;
+	char* path;
+	image_t image;
+	// The file changed while it was being decoded
+	bool stale;
+} prefetch_slot_t;
+
+// Decodes the images around the current one on a worker thread, keeping them
+// in a ring of 2 * radius + 1 slots so switching images doesn't wait for stb.
+typedef struct prefetch_t {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+	prefetch_slot_t* slots;
+	size_t slot_count;
+	size_t radius;
+	// Owned by the main thread, only read under the lock
+	const path_table_t* paths;
+	size_t path_count;
+	size_t center;
+	int direction;
+	// Decode the center image too, it's normally taken synchronously
+	bool center_requested;
+	// Size images are fitted into, lets JPEGs be decoded at a reduced scale
+	int32_t max_width;
+	int32_t max_height;
+	// Full resolution decode of one image, jumps the queue
+	bool full_requested;
+	prefetch_slot_t full;
+	bool running;
+	// Stores large images as compressed blocks, NULL to keep them as decoded
+	compressor_t* compressor;
+	// Called from the worker after each decode, e.g. to wake the event loop
+	void (*notify)(void);
+	// Ready in the ring / still being decoded when asked for / not in the ring
+	uint64_t hits;
+	uint64_t late;
+	uint64_t misses;
+} prefetch_t;
+
+int prefetch_init(prefetch_t* prefetch, size_t radius, void (*notify)(void));
+void prefetch_destroy(prefetch_t* prefetch);
+void prefetch_set_paths(prefetch_t* prefetch, const path_table_t* paths);
+// The table given to prefetch_set_paths() may only change between these two
+// calls, which block the worker. Slots are matched to their new indices after.
+void prefetch_paths_begin(prefetch_t* prefetch);
+void prefetch_paths_end(prefetch_t* prefetch, size_t center);
+// Move the prefetch window, direction is +1 when moving forward, -1 backward
+void prefetch_update(prefetch_t* prefetch, size_t center, int direction);
+void prefetch_set_target(prefetch_t* prefetch, int32_t max_width, int32_t max_height);
+// Before the first prefetch_set_paths(), the compressor has to outlive the prefetcher
+void prefetch_set_compressor(prefetch_t* prefetch, compressor_t* compressor);
+// Drops decoded copies of path, it changed on disk
+void prefetch_invalidate(prefetch_t* prefetch, const char* path);
+// Hands over the decoded image at index, decoding it synchronously on a miss
+int prefetch_take(prefetch_t* prefetch, size_t index, image_t* image);
+// Decode the current image in the background as well, for prefetch_poll() to pick up
+void prefetch_request_center(prefetch_t* prefetch);
+// Hands over the decoded image at index without waiting. Returns 1 once it's
+// handed over, 0 while it's still being decoded and -1 if decoding failed.
+int prefetch_poll(prefetch_t* prefetch, size_t index, image_t* image);
+// Decode the image at index at full resolution in the background, replacing any earlier request
+void prefetch_request_full(prefetch_t* prefetch, size_t index);
+// Hands over the full resolution image once it's ready, returns like prefetch_poll()
+int prefetch_poll_full(prefetch_t* prefetch, size_t index, image_t* image);
@@ -2,3 +2,5 @@
 #include <stdint.h>
 
 uint32_t get_shader();
+uint32_t get_grid_shader();
+uint32_t get_hud_shader();
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bytes read from a file to tell its format
+#define SNIFF_BYTES 16
+
+typedef enum image_type_t {
+	// Needs a look at the contents
+	TYPE_UNKNOWN,
+	TYPE_NOT_IMAGE,
+	TYPE_PNG,
+	TYPE_JPEG,
+	TYPE_GIF,
+	TYPE_BMP,
+	TYPE_TGA,
+	TYPE_PSD,
+	TYPE_HDR,
+	TYPE_PIC,
+	TYPE_PNM
+} image_type_t;
+
+typedef struct sniff_stats_t {
+	uint64_t probes;
+	uint64_t cache_hits;
+} sniff_stats_t;
+
+// Formats stb can decode, by extension. Extensions of common non-image files
+// are TYPE_NOT_IMAGE, anything else is TYPE_UNKNOWN.
+image_type_t sniff_extension(const char* name);
+// Format by signature, TGA has none and is only recognised by extension
+image_type_t sniff_bytes(const unsigned char* data, size_t size);
+// Reads the start of each file in directory (which ends with a separator) on
+// up to threads workers. Results are cached by file identity and modification
+// time, so scanning the same files again doesn't touch them.
+void sniff_files(const char* directory, const char* const* names, size_t count, image_type_t* types, size_t threads);
+size_t sniff_threads();
+sniff_stats_t sniff_stats();
+void sniff_cache_clear();
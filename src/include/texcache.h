@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct texture_entry_t {
+	char* path;
+	// Of the file when it was read, a rewrite during the decode makes the entry stale
+	int64_t mtime;
+	uint32_t texture;
+	int32_t width;
+	int32_t height;
+	int32_t full_width;
+	int32_t full_height;
+	size_t bytes;
+	// Tone mapped when drawn, see image_t
+	bool hdr;
+	uint64_t last_used;
+} texture_entry_t;
+
+// Uploaded textures keyed by path and modification time, evicted least
+// recently used first once the resident size goes over the byte budget.
+// Only touch it from the thread owning the GL context.
+typedef struct texture_cache_t {
+	texture_entry_t* entries;
+	size_t count;
+	size_t capacity;
+	size_t budget;
+	size_t resident_bytes;
+	uint64_t tick;
+	uint32_t current;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+} texture_cache_t;
+
+void texture_cache_init(texture_cache_t* cache, size_t budget);
+void texture_cache_destroy(texture_cache_t* cache);
+// Looks up an up to date texture for path and makes it the current one
+bool texture_cache_get(texture_cache_t* cache, const char* path, texture_entry_t* entry);
+// Takes ownership of the texture in entry, replacing any texture for the same
+// path, and evicts down to the budget. A replaced texture that is still
+// displayed stays until something else is. Returns -1 when the entry couldn't
+// be added, the texture has been deleted then unless it's the displayed one.
+int texture_cache_put(texture_cache_t* cache, const char* path, const texture_entry_t* entry);
+// Drops the texture for path unless it's the displayed one, which is replaced by the next put
+void texture_cache_invalidate(texture_cache_t* cache, const char* path);
+// The displayed texture is never evicted
+void texture_cache_set_current(texture_cache_t* cache, uint32_t texture);
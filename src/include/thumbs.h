@@ -0,0 +1,69 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "image.h"
+
+// Longest side of a freedesktop "normal" thumbnail
+#define THUMB_SIZE 128
+
+typedef struct thumb_job_t {
+	char* path;
+	uint64_t tag;
+} thumb_job_t;
+
+typedef struct thumb_result_t {
+	char* path;
+	// Passed to thumbnailer_request()
+	uint64_t tag;
+	// Bottom up like decode_image(), no pixels if the file couldn't be read
+	image_t image;
+	// Came from the disk cache
+	bool hit;
+} thumb_result_t;
+
+// Makes thumbnails on a pool of worker threads and shares them with other
+// programs through the freedesktop cache in ~/.cache/thumbnails. A cached
+// thumbnail is only used while its Thumb::URI and Thumb::MTime still match
+// the file, otherwise it's made again and overwritten. Requests are served
+// newest first, so what is on screen now comes before what scrolled past.
+typedef struct thumbnailer_t {
+	pthread_t* threads;
+	size_t thread_count;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	// Both end with a separator, NULL when there is nowhere to cache
+	char* cache_dir;
+	char* fail_dir;
+	// Popped from the end
+	thumb_job_t* jobs;
+	size_t job_count;
+	size_t job_capacity;
+	thumb_result_t* results;
+	size_t result_count;
+	size_t result_capacity;
+	// Called from a worker after each thumbnail, e.g. to wake the event loop
+	void (*notify)(void);
+	bool cancel;
+	// Read from the cache / decoded, scaled and saved / unreadable or recorded as failed before
+	uint64_t hits;
+	uint64_t generated;
+	uint64_t failed;
+} thumbnailer_t;
+
+// threads 0 uses one per core
+int thumbnailer_init(thumbnailer_t* thumbnailer, size_t threads, void (*notify)(void));
+void thumbnailer_destroy(thumbnailer_t* thumbnailer);
+int thumbnailer_request(thumbnailer_t* thumbnailer, const char* path, uint64_t tag);
+// Forgets the requests no worker has started on
+void thumbnailer_cancel_pending(thumbnailer_t* thumbnailer);
+bool thumbnailer_poll(thumbnailer_t* thumbnailer, thumb_result_t* result);
+void thumb_result_free(thumb_result_t* result);
+
+// Escaped "file://" URI of the absolute path, the thumbnail is named after its MD5. free() it
+char* thumbnail_uri(const char* path);
+// $XDG_CACHE_HOME/thumbnails/ or ~/.cache/thumbnails/, free() it
+char* thumbnail_cache_root();
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "image.h"
+
+#define TILE_SIZE 1024
+// Tiles overlap their neighbours by a texel on each side, which linear
+// filtering reads at the edges instead of clamping, so no seams show
+#define TILE_STRIDE (TILE_SIZE - 2)
+// Images with more pixels than this are tiled even if they'd fit in one texture
+#define TILED_MIN_PIXELS (64 * 1024 * 1024)
+#define TILE_UPLOADS_PER_FRAME 8
+#define MAX_TILE_LEVELS 32
+
+typedef struct tile_level_t {
+	const image_t* image;
+	int32_t columns;
+	int32_t rows;
+	uint32_t* textures;
+} tile_level_t;
+
+// An image drawn as a grid of TILE_SIZE textures. The image and its mipmaps
+// are kept on the CPU, only the tiles of the level matching the zoom that
+// intersect the window are resident on the GPU. The coarsest level is a
+// single tile that is always resident and drawn underneath as a fallback.
+typedef struct tiled_image_t {
+	image_t image;
+	tile_level_t levels[MAX_TILE_LEVELS];
+	int32_t level_count;
+	int32_t width;
+	int32_t height;
+	size_t resident_bytes;
+} tiled_image_t;
+
+// Placement of the image on screen, as set up by the glViewport calls in controls.c
+typedef struct tile_view_t {
+	int32_t x;
+	int32_t y;
+	int32_t width;
+	int32_t height;
+	int32_t rotation;
+	int32_t fb_width;
+	int32_t fb_height;
+} tile_view_t;
+
+// Must be called with the GL context current
+bool needs_tiling(const image_t* image);
+// Takes ownership of the pixels and mipmaps
+int tiled_image_init(tiled_image_t* tiled, image_t* image);
+void tiled_image_destroy(tiled_image_t* tiled);
+// Returns true if visible tiles are still missing and another frame should be drawn
+bool draw_tiled_image(tiled_image_t* tiled, const tile_view_t* view, int32_t tile_uniform, int32_t tile_uv_uniform);
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Events kept per thread, the oldest are overwritten once it's full
+#define TRACE_EVENTS 65536
+
+// Set once by trace_init() before any other thread starts, read without locking
+extern bool trace_enabled;
+
+// Enables tracing when IMEYE_TRACE names the file to write it to. Call first
+// thing in main(): SIGUSR1, which writes the trace so far, is blocked for every
+// thread started after it and handled by a thread of its own.
+void trace_init();
+// Writes the trace and frees it, after every recording thread has been joined
+void trace_shutdown();
+// Chrome trace event JSON, opened by chrome://tracing and ui.perfetto.dev
+void trace_dump();
+
+uint64_t trace_now();
+void trace_record(const char* name, uint64_t start, uint64_t end);
+void trace_set_thread_name(const char* name);
+
+// Names are kept by pointer, so they must be string literals or outlive the
+// trace. Disabled, each call is a test of trace_enabled.
+static inline uint64_t trace_begin() {
+	return __builtin_expect(trace_enabled, 0) ? trace_now() : 0;
+}
+
+static inline void trace_end(const char* name, uint64_t start) {
+	if (__builtin_expect(trace_enabled, 0)) {
+		trace_record(name, start, trace_now());
+	}
+}
+
+// A point in time rather than a span, e.g. a key press
+static inline void trace_instant(const char* name) {
+	if (__builtin_expect(trace_enabled, 0)) {
+		uint64_t now = trace_now();
+		trace_record(name, now, now);
+	}
+}
+
+static inline void trace_thread_name(const char* name) {
+	if (__builtin_expect(trace_enabled, 0)) {
+		trace_set_thread_name(name);
+	}
+}
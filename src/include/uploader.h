@@ -0,0 +1,57 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "image.h"
+
+#define UPLOAD_PBO_COUNT 3
+#define UPLOAD_PBO_SIZE (4 * 1024 * 1024)
+
+typedef struct upload_result_t {
+	char* path;
+	uint32_t texture;
+	int32_t width;
+	int32_t height;
+	int32_t full_width;
+	int32_t full_height;
+	size_t bytes;
+	bool hdr;
+	int64_t mtime;
+} upload_result_t;
+
+// Streams decoded images into textures on a hidden window whose context is
+// shared with the main one, through a ring of pixel buffer objects. The main
+// thread picks the texture up once its fence has signalled, so a large upload
+// never blocks presenting frames.
+typedef struct uploader_t {
+	GLFWwindow* context;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	bool running;
+	// Newest request, replacing any request the worker hasn't started yet
+	bool pending;
+	char* pending_path;
+	image_t pending_image;
+	// Set when a newer request should abort the upload in flight
+	bool cancel;
+	bool finished;
+	upload_result_t result;
+	GLsync fence;
+	GLuint pbos[UPLOAD_PBO_COUNT];
+	GLsync pbo_fences[UPLOAD_PBO_COUNT];
+	size_t pbo_size;
+} uploader_t;
+
+// Call on the main thread after GLEW has been initialised
+int uploader_init(uploader_t* uploader, GLFWwindow* share);
+void uploader_destroy(uploader_t* uploader);
+// Takes ownership of the pixels
+void uploader_submit(uploader_t* uploader, const char* path, image_t* image);
+// Returns true once a submitted texture is complete, the caller owns result.
+// An upload that failed comes back with texture 0.
+bool uploader_poll(uploader_t* uploader, upload_result_t* result);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "dir_splore.h"
+
+// Follows changes to a directory with inotify (Linux only). A worker thread
+// blocks on the inotify descriptor and queues the events, the main thread
+// applies everything queued since its last call in one pass, so a burst of
+// thousands of events costs one merge instead of one per event.
+typedef struct dir_watch_t {
+	int fd;
+	int wd;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	// Ends with a separator, new files without a known extension are sniffed in it
+	char* directory;
+	// Names prefixed with '+' when written or moved in and '-' when deleted or moved out, in arrival order
+	path_table_t events;
+	void (*notify)(void);
+	bool cancel;
+	bool overflowed;
+	bool started;
+	// Only touched by the main thread. After the kernel dropped events the
+	// directory is listed again and the table reconciled with the listing.
+	bool stale;
+	bool rescanning;
+	dir_scan_t rescan;
+	path_table_t rescanned;
+} dir_watch_t;
+
+int dir_watch_start(dir_watch_t* watch, const char* directory, void (*notify)(void));
+void dir_watch_destroy(dir_watch_t* watch);
+bool dir_watch_ready(dir_watch_t* watch);
+// Inserts and removes entries of table in sorted position, keep is never
+// removed. Names of existing entries that were written again are added to
+// rewritten. Returns true if the entries changed. When events were dropped a
+// rescan is started here, and a later call swaps its listing in.
+bool dir_watch_apply(dir_watch_t* watch, path_table_t* table, const char* keep, path_table_t* rewritten);
@@ -0,0 +1,87 @@
+#include "input.h"
+
+#include <stdio.h>
+#include <string.h>
+
+const char* action_name(action_t action) {
+	switch (action) {
+		case ACTION_FULLSCREEN:
+			return "fullscreen";
+		case ACTION_NEXT:
+			return "next";
+		case ACTION_PREVIOUS:
+			return "previous";
+		case ACTION_RESET:
+			return "reset";
+		case ACTION_ROTATE_CLOCKWISE:
+			return "rotate-cw";
+		case ACTION_ROTATE_ANTICLOCKWISE:
+			return "rotate-ccw";
+		case ACTION_GRID:
+			return "grid";
+		case ACTION_OPEN:
+			return "open";
+		case ACTION_UP:
+			return "up";
+		case ACTION_DOWN:
+			return "down";
+		case ACTION_HUD:
+			return "hud";
+		case ACTION_BRIGHTER:
+			return "brighter";
+		case ACTION_DARKER:
+			return "darker";
+		case ACTION_EXPOSURE_RESET:
+			return "exposure-reset";
+	}
+	return "unknown";
+}
+
+void input_queue_init(input_queue_t* queue, bool measure_latency) {
+	memset(queue, 0, sizeof(*queue));
+	queue->measure_latency = measure_latency;
+}
+
+void input_push(input_queue_t* queue, action_t action, double time, bool repeat) {
+	if (repeat) {
+		for (size_t i = 0; i < queue->count; i++) {
+			if (queue->events[(queue->head + i) % INPUT_QUEUE_SIZE].action == action) {
+				queue->dropped++;
+				return;
+			}
+		}
+	}
+	if (queue->count == INPUT_QUEUE_SIZE) {
+		queue->dropped++;
+		return;
+	}
+	input_event_t* event = &queue->events[(queue->head + queue->count) % INPUT_QUEUE_SIZE];
+	event->action = action;
+	event->time = time;
+	queue->count++;
+}
+
+bool input_pop(input_queue_t* queue, input_event_t* event) {
+	if (queue->count == 0) {
+		return false;
+	}
+	*event = queue->events[queue->head];
+	queue->head = (queue->head + 1) % INPUT_QUEUE_SIZE;
+	queue->count--;
+	return true;
+}
+
+void input_applied(input_queue_t* queue, const input_event_t* event) {
+	if (!queue->measure_latency || queue->presenting_count == INPUT_QUEUE_SIZE) {
+		return;
+	}
+	queue->presenting[queue->presenting_count++] = *event;
+}
+
+void input_presented(input_queue_t* queue, double time) {
+	for (size_t i = 0; i < queue->presenting_count; i++) {
+		const input_event_t* event = &queue->presenting[i];
+		fprintf(stderr, "latency %-10s %7.2f ms\n", action_name(event->action), (time - event->time) * 1e3);
+	}
+	queue->presenting_count = 0;
+}
@@ -0,0 +1,493 @@
+#include "jpeg.h"
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+// jpeglib.h expects FILE and size_t to already be declared
+#include <jpeglib.h>
+
+#include "cpu.h"
+#include "trace.h"
+
+typedef struct jpeg_error_t {
+	struct jpeg_error_mgr manager;
+	jmp_buf jump;
+} jpeg_error_t;
+
+static void error_exit(j_common_ptr cinfo) {
+	jpeg_error_t* error = (jpeg_error_t*)cinfo->err;
+	longjmp(error->jump, 1);
+}
+
+static void output_message(j_common_ptr cinfo) {
+	// Warnings about corrupt data are not worth a line on stderr each
+	(void)cinfo;
+}
+
+bool is_jpeg(const unsigned char* data, size_t size) {
+	return size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+}
+
+int32_t jpeg_scale_denom(int32_t width, int32_t height, int32_t max_width, int32_t max_height) {
+	if (max_width <= 0 || max_height <= 0 || width <= 0 || height <= 0) {
+		return 1;
+	}
+	float scale = 1.0f;
+	if (width > max_width) {
+		scale = (float)max_width / width;
+	}
+	if (height > max_height && (float)max_height / height < scale) {
+		scale = (float)max_height / height;
+	}
+
+	int32_t denom = 8;
+	while (denom > 1 && denom * scale > 1.0f) {
+		denom /= 2;
+	}
+	return denom;
+}
+
+static int decode_serial(const unsigned char* data, size_t size, int32_t max_width, int32_t max_height, image_t* image) {
+	struct jpeg_decompress_struct cinfo;
+	jpeg_error_t error;
+	unsigned char* volatile pixels = NULL;
+
+	cinfo.err = jpeg_std_error(&error.manager);
+	error.manager.error_exit = error_exit;
+	error.manager.output_message = output_message;
+	if (setjmp(error.jump) != 0) {
+		jpeg_destroy_decompress(&cinfo);
+		free(pixels);
+		return -1;
+	}
+
+	jpeg_create_decompress(&cinfo);
+	jpeg_mem_src(&cinfo, data, size);
+	jpeg_read_header(&cinfo, TRUE);
+	if (cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK) {
+		jpeg_destroy_decompress(&cinfo);
+		return -1;
+	}
+
+	cinfo.out_color_space = cinfo.num_components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = jpeg_scale_denom(cinfo.image_width, cinfo.image_height, max_width, max_height);
+	jpeg_start_decompress(&cinfo);
+
+	size_t stride = (size_t)cinfo.output_width * cinfo.output_components;
+	pixels = malloc(stride * cinfo.output_height);
+	if (pixels == NULL) {
+		jpeg_destroy_decompress(&cinfo);
+		return -1;
+	}
+	// Bottom row first, like stbi_set_flip_vertically_on_load(1)
+	while (cinfo.output_scanline < cinfo.output_height) {
+		JSAMPROW row = pixels + (cinfo.output_height - 1 - cinfo.output_scanline) * stride;
+		jpeg_read_scanlines(&cinfo, &row, 1);
+	}
+
+	jpeg_finish_decompress(&cinfo);
+
+	image->pixels = pixels;
+	image->width = cinfo.output_width;
+	image->height = cinfo.output_height;
+	image->channels = cinfo.output_components;
+	image->full_width = cinfo.image_width;
+	image->full_height = cinfo.image_height;
+	jpeg_destroy_decompress(&cinfo);
+	return 0;
+}
+
+// Where a sequential JPEG's single scan is and how it's cut into MCUs
+typedef struct jpeg_layout_t {
+	// Offset of the SOF marker, and of the first byte after the SOS header
+	size_t sof;
+	size_t entropy;
+	int32_t width;
+	int32_t height;
+	int32_t mcu_height;
+	int32_t mcus_per_row;
+	int32_t mcu_rows;
+	int32_t restart_interval;
+	// Chroma is upsampled from the rows above and below, across band edges too
+	bool context;
+} jpeg_layout_t;
+
+static int32_t read_u16(const unsigned char* data) {
+	return (data[0] << 8) | data[1];
+}
+
+// Only baseline and extended sequential Huffman JPEGs with every component in
+// one scan are understood, the rest is left to the serial decoder
+static int parse_layout(const unsigned char* data, size_t size, jpeg_layout_t* layout) {
+	memset(layout, 0, sizeof(*layout));
+	int32_t components = 0;
+	int32_t h_max = 1, v_max = 1;
+	int32_t v_factors[4] = {0};
+	size_t pos = 2;
+	while (pos + 4 <= size) {
+		if (data[pos] != 0xFF) {
+			return -1;
+		}
+		unsigned char marker = data[pos + 1];
+		if (marker == 0xFF) {
+			pos++;
+			continue;
+		}
+		if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {
+			pos += 2;
+			continue;
+		}
+		size_t length = read_u16(data + pos + 2);
+		if (marker == 0xD9 || length < 2 || pos + 2 + length > size) {
+			return -1;
+		}
+		const unsigned char* segment = data + pos + 4;
+		if (marker == 0xC0 || marker == 0xC1) {
+			components = length >= 8 ? segment[5] : 0;
+			if (segment[0] != 8 || (components != 1 && components != 3) || length < 8 + 3 * (size_t)components) {
+				return -1;
+			}
+			layout->sof = pos;
+			layout->height = read_u16(segment + 1);
+			layout->width = read_u16(segment + 3);
+			for (int32_t i = 0; i < components; i++) {
+				int32_t h = segment[6 + 3 * i + 1] >> 4;
+				int32_t v = segment[6 + 3 * i + 1] & 15;
+				h_max = h > h_max ? h : h_max;
+				v_max = v > v_max ? v : v_max;
+				v_factors[i] = v;
+			}
+		} else if ((marker >= 0xC2 && marker <= 0xCF) && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+			// Progressive, lossless, hierarchical or arithmetic coded
+			return -1;
+		} else if (marker == 0xDD && length >= 4) {
+			layout->restart_interval = read_u16(segment);
+		} else if (marker == 0xDA) {
+			if (components == 0 || length < 3 || segment[0] != components) {
+				return -1;
+			}
+			layout->entropy = pos + 2 + length;
+			break;
+		}
+		pos += 2 + length;
+	}
+	// A height of 0 comes in a DNL marker after the scan
+	if (layout->entropy == 0 || layout->width == 0 || layout->height == 0) {
+		return -1;
+	}
+
+	// A single component scan has one block per MCU, whatever its sampling factors
+	int32_t mcu_width = components == 1 ? 8 : 8 * h_max;
+	layout->mcu_height = components == 1 ? 8 : 8 * v_max;
+	layout->mcus_per_row = (layout->width + mcu_width - 1) / mcu_width;
+	layout->mcu_rows = (layout->height + layout->mcu_height - 1) / layout->mcu_height;
+	for (int32_t i = 0; i < components && components > 1; i++) {
+		layout->context = layout->context || v_factors[i] < v_max;
+	}
+	return 0;
+}
+
+int32_t jpeg_restart_interval(const unsigned char* data, size_t size) {
+	jpeg_layout_t layout;
+	if (!is_jpeg(data, size) || parse_layout(data, size, &layout) != 0) {
+		return 0;
+	}
+	return layout.restart_interval;
+}
+
+// Finds every RST marker, which must count up one interval at a time, and the EOI after the last
+static int find_restarts(const unsigned char* data, size_t size, size_t start, size_t* markers, size_t count,
+			 size_t* end) {
+	size_t found = 0;
+	size_t pos = start;
+	for (;;) {
+		const unsigned char* ff = memchr(data + pos, 0xFF, size - pos);
+		if (ff == NULL || ff + 1 >= data + size) {
+			return -1;
+		}
+		pos = ff - data;
+		unsigned char marker = data[pos + 1];
+		if (marker == 0x00) {
+			// A stuffed 0xFF byte of data
+			pos += 2;
+		} else if (marker == 0xFF) {
+			pos++;
+		} else if (marker >= 0xD0 && marker <= 0xD7) {
+			if (found == count || marker != 0xD0 + found % 8) {
+				return -1;
+			}
+			markers[found++] = pos;
+			pos += 2;
+		} else if (marker == 0xD9) {
+			*end = pos;
+			return found == count ? 0 : -1;
+		} else {
+			return -1;
+		}
+	}
+}
+
+typedef struct jpeg_band_t {
+	// A complete JPEG of the rows the band decodes
+	unsigned char* data;
+	size_t size;
+	// Decoded rows to throw away before the band's own, which are an MCU row above it
+	int32_t skip;
+	// Rows of the output image the band fills
+	int32_t top;
+	int32_t rows;
+} jpeg_band_t;
+
+typedef struct jpeg_split_t {
+	jpeg_band_t* bands;
+	size_t count;
+	size_t next;
+	int32_t denom;
+	int32_t width;
+	int32_t height;
+	int32_t channels;
+	unsigned char* pixels;
+	bool failed;
+	pthread_mutex_t lock;
+} jpeg_split_t;
+
+static int decode_band(const jpeg_split_t* split, const jpeg_band_t* band) {
+	struct jpeg_decompress_struct cinfo;
+	jpeg_error_t error;
+	size_t stride = (size_t)split->width * split->channels;
+	unsigned char* volatile scratch = NULL;
+
+	cinfo.err = jpeg_std_error(&error.manager);
+	error.manager.error_exit = error_exit;
+	error.manager.output_message = output_message;
+	if (setjmp(error.jump) != 0) {
+		jpeg_destroy_decompress(&cinfo);
+		free(scratch);
+		return -1;
+	}
+	jpeg_create_decompress(&cinfo);
+	jpeg_mem_src(&cinfo, band->data, band->size);
+	jpeg_read_header(&cinfo, TRUE);
+	cinfo.out_color_space = cinfo.num_components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = split->denom;
+	jpeg_start_decompress(&cinfo);
+	scratch = malloc(stride);
+	if (scratch == NULL || (int32_t)cinfo.output_width != split->width || cinfo.output_components != split->channels ||
+	    (int32_t)cinfo.output_height < band->skip + band->rows) {
+		jpeg_destroy_decompress(&cinfo);
+		free(scratch);
+		return -1;
+	}
+	// Bottom row first, like the serial decode
+	while ((int32_t)cinfo.output_scanline < band->skip + band->rows) {
+		int32_t line = (int32_t)cinfo.output_scanline - band->skip;
+		JSAMPROW row = line < 0 ? scratch : split->pixels + (size_t)(split->height - 1 - band->top - line) * stride;
+		jpeg_read_scanlines(&cinfo, &row, 1);
+	}
+	// Rows below the band only gave the last rows their chroma
+	jpeg_destroy_decompress(&cinfo);
+	free(scratch);
+	return 0;
+}
+
+static void* band_worker(void* arg) {
+	jpeg_split_t* split = arg;
+	for (;;) {
+		pthread_mutex_lock(&split->lock);
+		size_t band = split->next++;
+		bool stop = split->failed;
+		pthread_mutex_unlock(&split->lock);
+		if (stop || band >= split->count) {
+			break;
+		}
+		uint64_t span = trace_begin();
+		int result = decode_band(split, &split->bands[band]);
+		trace_end("jpeg_band", span);
+		if (result != 0) {
+			pthread_mutex_lock(&split->lock);
+			split->failed = true;
+			pthread_mutex_unlock(&split->lock);
+		}
+	}
+	return NULL;
+}
+
+static void* band_thread(void* arg) {
+	trace_thread_name("jpeg");
+	return band_worker(arg);
+}
+
+static int32_t gcd(int32_t a, int32_t b) {
+	while (b != 0) {
+		int32_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+// Copies the headers with the band's height, then the band's intervals with
+// their restart markers numbered from RST0 again
+static int make_band(const unsigned char* data, const jpeg_layout_t* layout, const size_t* markers, size_t first,
+		     size_t last, size_t intervals, size_t end, int32_t height, jpeg_band_t* band) {
+	size_t from = first == 0 ? layout->entropy : markers[first - 1] + 2;
+	size_t to = last == intervals ? end : markers[last - 1];
+	band->size = layout->entropy + (to - from) + 2;
+	band->data = malloc(band->size);
+	if (band->data == NULL) {
+		return -1;
+	}
+	memcpy(band->data, data, layout->entropy);
+	band->data[layout->sof + 5] = (unsigned char)(height >> 8);
+	band->data[layout->sof + 6] = (unsigned char)height;
+	memcpy(band->data + layout->entropy, data + from, to - from);
+	for (size_t i = first; i + 1 < last; i++) {
+		band->data[layout->entropy + (markers[i] - from) + 1] = (unsigned char)(0xD0 + (i - first) % 8);
+	}
+	band->data[band->size - 2] = 0xFF;
+	band->data[band->size - 1] = 0xD9;
+	return 0;
+}
+
+static int split_bands(const unsigned char* data, size_t size, const jpeg_layout_t* layout, size_t threads,
+		       jpeg_split_t* split) {
+	// Bands start at markers that are also the start of an MCU row
+	int32_t interval = layout->restart_interval;
+	int64_t unit_mcus = (int64_t)interval / gcd(interval, layout->mcus_per_row) * layout->mcus_per_row;
+	int64_t unit_rows = unit_mcus / layout->mcus_per_row;
+	size_t unit_intervals = unit_mcus / interval;
+	if (unit_rows >= layout->mcu_rows) {
+		return -1;
+	}
+	size_t units = (layout->mcu_rows + unit_rows - 1) / unit_rows;
+	size_t intervals = ((size_t)layout->mcus_per_row * layout->mcu_rows + interval - 1) / interval;
+	size_t* markers = malloc((intervals - 1) * sizeof(size_t));
+	size_t end;
+	if (markers == NULL || find_restarts(data, size, layout->entropy, markers, intervals - 1, &end) != 0) {
+		free(markers);
+		return -1;
+	}
+
+	split->count = units < threads * JPEG_BANDS_PER_THREAD ? units : threads * JPEG_BANDS_PER_THREAD;
+	split->bands = calloc(split->count, sizeof(jpeg_band_t));
+	if (split->bands == NULL) {
+		free(markers);
+		return -1;
+	}
+	int32_t unit_height = (int32_t)unit_rows * layout->mcu_height;
+	for (size_t i = 0; i < split->count; i++) {
+		size_t own_first = i * units / split->count;
+		size_t own_last = (i + 1) * units / split->count;
+		// One unit either side when chroma rows are shared across the edge
+		size_t first = layout->context && own_first > 0 ? own_first - 1 : own_first;
+		size_t last = layout->context && own_last < units ? own_last + 1 : own_last;
+		int32_t top = (int32_t)first * unit_height;
+		int32_t bottom = (int32_t)last * unit_height < layout->height ? (int32_t)last * unit_height : layout->height;
+		size_t last_interval = last * unit_intervals < intervals ? last * unit_intervals : intervals;
+		jpeg_band_t* band = &split->bands[i];
+		if (make_band(data, layout, markers, first * unit_intervals, last_interval, intervals, end, bottom - top,
+			      band) != 0) {
+			free(markers);
+			return -1;
+		}
+		// MCU rows are at least 8 pixels, so band edges scale down to whole rows
+		band->skip = (int32_t)(own_first - first) * unit_height / split->denom;
+		band->top = (int32_t)own_first * unit_height / split->denom;
+		band->rows = own_last == units ? split->height - band->top
+					       : (int32_t)own_last * unit_height / split->denom - band->top;
+	}
+	free(markers);
+	return 0;
+}
+
+static void free_bands(jpeg_split_t* split) {
+	for (size_t i = 0; split->bands != NULL && i < split->count; i++) {
+		free(split->bands[i].data);
+	}
+	free(split->bands);
+}
+
+static int decode_parallel(const unsigned char* data, size_t size, int32_t max_width, int32_t max_height, size_t threads,
+			   image_t* image) {
+	jpeg_layout_t layout;
+	if (parse_layout(data, size, &layout) != 0 || layout.restart_interval == 0) {
+		return -1;
+	}
+	jpeg_split_t split = {
+		.denom = jpeg_scale_denom(layout.width, layout.height, max_width, max_height),
+		.channels = data[layout.sof + 9] == 1 ? 1 : 3,
+	};
+	split.width = (layout.width + split.denom - 1) / split.denom;
+	split.height = (layout.height + split.denom - 1) / split.denom;
+	if ((size_t)split.width * split.height < JPEG_PARALLEL_MIN_PIXELS) {
+		return -1;
+	}
+	if (threads > MAX_JPEG_THREADS) {
+		threads = MAX_JPEG_THREADS;
+	}
+	uint64_t span = trace_begin();
+	int result = split_bands(data, size, &layout, threads, &split);
+	trace_end("jpeg_split", span);
+	if (result != 0) {
+		free_bands(&split);
+		return -1;
+	}
+	if (threads > split.count) {
+		threads = split.count;
+	}
+	split.pixels = malloc((size_t)split.width * split.height * split.channels);
+	if (split.pixels == NULL) {
+		free_bands(&split);
+		return -1;
+	}
+
+	// The calling thread is one of the workers
+	pthread_mutex_init(&split.lock, NULL);
+	pthread_t workers[MAX_JPEG_THREADS];
+	size_t started = 0;
+	for (size_t i = 1; i < threads; i++) {
+		if (pthread_create(&workers[started], NULL, band_thread, &split) == 0) {
+			started++;
+		}
+	}
+	band_worker(&split);
+	for (size_t i = 0; i < started; i++) {
+		pthread_join(workers[i], NULL);
+	}
+	pthread_mutex_destroy(&split.lock);
+	free_bands(&split);
+	if (split.failed) {
+		free(split.pixels);
+		return -1;
+	}
+
+	image->pixels = split.pixels;
+	image->width = split.width;
+	image->height = split.height;
+	image->channels = split.channels;
+	image->full_width = layout.width;
+	image->full_height = layout.height;
+	return 0;
+}
+
+size_t jpeg_threads() {
+	size_t cpus = cpu_count();
+	return cpus < MAX_JPEG_THREADS ? cpus : MAX_JPEG_THREADS;
+}
+
+int decode_jpeg_threads(const unsigned char* data, size_t size, int32_t max_width, int32_t max_height, size_t threads,
+                        image_t* image) {
+	*image = (image_t){0};
+	if (threads > 1 && decode_parallel(data, size, max_width, max_height, threads, image) == 0) {
+		return 0;
+	}
+	return decode_serial(data, size, max_width, max_height, image);
+}
+
+int decode_jpeg(const unsigned char* data, size_t size, int32_t max_width, int32_t max_height, image_t* image) {
+	return decode_jpeg_threads(data, size, max_width, max_height, jpeg_threads(), image);
+}
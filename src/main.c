@@ -1,7 +1,6 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
 #include <stdbool.h>
 #include <string.h>
 
@@ -18,9 +17,23 @@
 #include "dir_splore.h"
 #include "icon.h"
 #include "controls.h"
+#include "prefetch.h"
+#include "texcache.h"
+#include "uploader.h"
+#include "tiles.h"
+#include "input.h"
+#include "animation.h"
+#include "thumbs.h"
+#include "grid.h"
+#include "hud.h"
+#include "compress.h"
+#include "trace.h"
 
 #define MARGIN 100
-#define FPS 10
+// How often to check for the full resolution decode while refining
+#define REFINE_POLL_SECONDS 0.05
+#define PREFETCH_RADIUS 2
+#define TEXTURE_BUDGET_MB 512
 
 float vertices[20] = {
     // Position		    //Tex coords
@@ -29,6 +42,8 @@ float vertices[20] = {
 unsigned int indices[6] = {0, 3, 1, 1, 3, 2};
 
 app_data_t app_data = {0};
+input_queue_t input;
+hud_t hud;
 GLFWmonitor* monitor = NULL;
 
 display_scale_t display_scale = (display_scale_t){
@@ -43,6 +58,12 @@ void glfw_resize_callback(GLFWwindow* window, int width, int height) {
     app_data.v_x = (width - app_data.im_width) / 2;
     app_data.v_y = (height - app_data.im_height) / 2;
     glViewport(app_data.v_x, app_data.v_y, app_data.im_width, app_data.im_height);
+    app_data.dirty = true;
+}
+
+void glfw_refresh_callback(GLFWwindow* window) {
+    (void)window;
+    app_data.dirty = true;
 }
 
 void glfw_scroll_callback(GLFWwindow* window, double xoffset, double yoffset) {
@@ -54,6 +75,7 @@ void glfw_scroll_callback(GLFWwindow* window, double xoffset, double yoffset) {
     } else if (yoffset < 0) {
         app_data.scroll = -1;
     }
+    app_data.dirty = true;
 }
 
 #define MAX_KEYS 1024
@@ -67,7 +89,7 @@ void glfw_key_callback(GLFWwindow* window, int key, int scancode, int action, in
         glfwSetWindowShouldClose(window, GL_TRUE);
     }
 
-    app_data.scale = 1.0f;
+    app_data.dirty = true;
     if (key >= 0 && key < MAX_KEYS) {
         if (action == GLFW_PRESS) {
             key_states[key] = true;
@@ -75,39 +97,115 @@ void glfw_key_callback(GLFWwindow* window, int key, int scancode, int action, in
             key_states[key] = false;
         }
     }
-
-    // Fullscreen
-    if (key == GLFW_KEY_F && action == GLFW_PRESS) {
-        fullscreen(&app_data, window, monitor);
-        usleep(100000);
-    }
-
-    // Next image
-    if (key == GLFW_KEY_RIGHT && action == GLFW_PRESS) {
-        switch_image(NEXT, &app_data, window);
-        usleep(100000);
-    }
-
-    // Previous image
-    if (key == GLFW_KEY_LEFT && action == GLFW_PRESS) {
-        switch_image(PREVIOUS, &app_data, window);
-        usleep(100000);
+    if (action == GLFW_RELEASE) {
+        return;
     }
 
-    // Reset viewer
-    if (key == GLFW_KEY_R && action == GLFW_PRESS) {
-        reset_viewer(&app_data);
-        usleep(100000);
+    // Queued for the main loop, holding a key repeats everything but fullscreen and reset
+    bool repeat = action == GLFW_REPEAT;
+    double time = glfwGetTime();
+    if (key == GLFW_KEY_F && !repeat) {
+        input_push(&input, ACTION_FULLSCREEN, time, false);
+    } else if (key == GLFW_KEY_G && !repeat) {
+        input_push(&input, ACTION_GRID, time, false);
+    } else if (key == GLFW_KEY_ENTER && !repeat) {
+        input_push(&input, ACTION_OPEN, time, false);
+    } else if (key == GLFW_KEY_H && !repeat) {
+        input_push(&input, ACTION_HUD, time, false);
+    } else if (key == GLFW_KEY_EQUAL) {
+        input_push(&input, ACTION_BRIGHTER, time, repeat);
+    } else if (key == GLFW_KEY_MINUS) {
+        input_push(&input, ACTION_DARKER, time, repeat);
+    } else if (key == GLFW_KEY_0 && !repeat) {
+        input_push(&input, ACTION_EXPOSURE_RESET, time, false);
+    } else if (key == GLFW_KEY_UP && app_data.in_grid) {
+        // Zooms through key_states outside the grid
+        input_push(&input, ACTION_UP, time, repeat);
+    } else if (key == GLFW_KEY_DOWN && app_data.in_grid) {
+        input_push(&input, ACTION_DOWN, time, repeat);
+    } else if (key == GLFW_KEY_RIGHT) {
+        input_push(&input, ACTION_NEXT, time, repeat);
+    } else if (key == GLFW_KEY_LEFT) {
+        input_push(&input, ACTION_PREVIOUS, time, repeat);
+    } else if (key == GLFW_KEY_R && !repeat) {
+        input_push(&input, ACTION_RESET, time, false);
+    } else if (key == GLFW_KEY_E) {
+        input_push(&input, ACTION_ROTATE_CLOCKWISE, time, repeat);
+    } else if (key == GLFW_KEY_Q) {
+        input_push(&input, ACTION_ROTATE_ANTICLOCKWISE, time, repeat);
     }
+}
 
-    // Rotate
-    if (key_states[GLFW_KEY_E]) {
-        rotate(CLOCKWISE, &app_data);
-        usleep(100000);
-    }
-    if (key_states[GLFW_KEY_Q]) {
-        rotate(ANTICLOCKWISE, &app_data);
-        usleep(100000);
+static void apply_input(GLFWwindow* window) {
+    input_event_t event;
+    while (input_pop(&input, &event)) {
+        trace_instant(action_name(event.action));
+        switch (event.action) {
+            case ACTION_FULLSCREEN:
+                fullscreen(&app_data, window, monitor);
+                break;
+            case ACTION_NEXT:
+                if (app_data.in_grid) {
+                    grid_view_move(app_data.grid, app_data.images, 1, 0);
+                } else {
+                    switch_image(NEXT, &app_data, window);
+                }
+                break;
+            case ACTION_PREVIOUS:
+                if (app_data.in_grid) {
+                    grid_view_move(app_data.grid, app_data.images, -1, 0);
+                } else {
+                    switch_image(PREVIOUS, &app_data, window);
+                }
+                break;
+            case ACTION_RESET:
+                if (!app_data.in_grid) {
+                    reset_viewer(&app_data);
+                }
+                break;
+            case ACTION_ROTATE_CLOCKWISE:
+                if (!app_data.in_grid) {
+                    rotate(CLOCKWISE, &app_data);
+                }
+                break;
+            case ACTION_ROTATE_ANTICLOCKWISE:
+                if (!app_data.in_grid) {
+                    rotate(ANTICLOCKWISE, &app_data);
+                }
+                break;
+            case ACTION_GRID:
+                toggle_grid(&app_data);
+                break;
+            case ACTION_OPEN:
+                if (app_data.in_grid) {
+                    toggle_grid(&app_data);
+                }
+                break;
+            case ACTION_UP:
+                if (app_data.in_grid) {
+                    grid_view_move(app_data.grid, app_data.images, 0, -1);
+                }
+                break;
+            case ACTION_DOWN:
+                if (app_data.in_grid) {
+                    grid_view_move(app_data.grid, app_data.images, 0, 1);
+                }
+                break;
+            case ACTION_HUD:
+                hud.visible = !hud.visible && hud.program != 0;
+                break;
+            case ACTION_BRIGHTER:
+                adjust_exposure(&app_data, 1);
+                break;
+            case ACTION_DARKER:
+                adjust_exposure(&app_data, -1);
+                break;
+            case ACTION_EXPOSURE_RESET:
+                adjust_exposure(&app_data, 0);
+                break;
+        }
+        input_applied(&input, &event);
+        app_data.dirty = true;
     }
 }
 
@@ -119,6 +217,8 @@ int main(int argc, char** argv) {
     } else {
         filename = argv[1];
     }
+    // Before any thread starts, they inherit its signal mask
+    trace_init();
 
     if (!glfwInit()) {
         return -1;
@@ -128,15 +228,6 @@ int main(int argc, char** argv) {
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
-    uint32_t texture = get_image(filename, &app_data.im_width, &app_data.im_height);
-
-    if (app_data.im_width == 0 || app_data.im_height == 0) {
-        fprintf(stderr, "Failed to load image: %s\n", filename);
-        return -1;
-    }
-
-    fprintf(stdout, "Image size: %dx%d\n", app_data.im_width, app_data.im_height);
-
     int32_t display_width = 0, display_height = 0;
     monitor = glfwGetPrimaryMonitor();
 
@@ -156,6 +247,19 @@ int main(int argc, char** argv) {
         return -1;
     }
 
+    // Images never fit into more than the whole monitor (in fullscreen), so JPEGs can be decoded down to that
+    int32_t fit_width = display_width + MARGIN;
+    int32_t fit_height = display_height + MARGIN;
+
+    // Only the header is read here, the window opens while the prefetcher decodes the pixels
+    if (probe_image(filename, &app_data.im_width, &app_data.im_height) != 0) {
+        return -1;
+    }
+    app_data.full_width = app_data.im_width;
+    app_data.texture_width = app_data.im_width;
+
+    fprintf(stdout, "Image size: %dx%d\n", app_data.im_width, app_data.im_height);
+
     // Scale the image to fit the display
     float scale = 1.0f;
 
@@ -201,6 +305,8 @@ int main(int argc, char** argv) {
     stbi_set_flip_vertically_on_load(true);
 
     glfwMakeContextCurrent(window);
+    // Frames are only drawn when something changed, and then no faster than the display refreshes
+    glfwSwapInterval(1);
 
     // Focus the window
     glfwRequestWindowAttention(window);
@@ -241,16 +347,66 @@ int main(int argc, char** argv) {
     glVertexAttribPointer(tex_attrib, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 5, (void*)(sizeof(float) * 3));
     glEnableVertexAttribArray(tex_attrib);
 
-    int w, h;
-    texture = get_image(filename, &w, &h);
+    // Resident texture budget, IMEYE_TEXTURE_BUDGET_MB overrides it
+    size_t texture_budget = TEXTURE_BUDGET_MB;
+    const char* budget_env = getenv("IMEYE_TEXTURE_BUDGET_MB");
+    if (budget_env != NULL) {
+        texture_budget = strtoul(budget_env, NULL, 10);
+    }
+
+    texture_cache_t textures;
+    texture_cache_init(&textures, texture_budget * 1024 * 1024);
+    app_data.textures = &textures;
+
+    uploader_t uploader;
+    if (uploader_init(&uploader, window) != 0) {
+        return -1;
+    }
+    app_data.uploader = &uploader;
+
+    // The rest of the directory is merged in around the opened image as the scan finds it
+    path_table_t images;
+    if (path_table_init(&images, filename) != 0) {
+        return -1;
+    }
+    app_data.images = &images;
+    app_data.image_index = 0;
+    // Spelled with the directory of the table, the cache and uploads are keyed by it
+    app_data.image_path = path_table_path(&images, 0);
+    if (app_data.image_path == NULL) {
+        return -1;
+    }
+
+    // Grey in the image's place until its pixels arrive
+    const unsigned char placeholder_pixel[4] = {48, 48, 48, 255};
+    GLuint placeholder;
+    glGenTextures(1, &placeholder);
+    glBindTexture(GL_TEXTURE_2D, placeholder);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder_pixel);
+    set_texture_params(0);
+    app_data.texture = placeholder;
+    app_data.loading = true;
+    app_data.decoding = true;
 
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture);
+    glBindTexture(GL_TEXTURE_2D, placeholder);
 
     GLint tex_uniform = glGetUniformLocation(shader_program, "image");
     glUniform1i(tex_uniform, 0);
 
     GLint rotation_uniform = glGetUniformLocation(shader_program, "rotation_angle");
+    GLint exposure_uniform = glGetUniformLocation(shader_program, "exposure");
+    GLint hdr_uniform = glGetUniformLocation(shader_program, "hdr");
+    GLint tile_uniform = glGetUniformLocation(shader_program, "tile");
+    glUniform4f(tile_uniform, 0.0f, 0.0f, 1.0f, 1.0f);
+    GLint tile_uv_uniform = glGetUniformLocation(shader_program, "tile_uv");
+    glUniform4f(tile_uv_uniform, 0.0f, 0.0f, 1.0f, 1.0f);
+
+    // The viewer works without it, H just does nothing
+    if (hud_init(&hud) != 0) {
+        fprintf(stderr, "Failed to create HUD\n");
+    }
+    glUseProgram(shader_program);
 
     glBindVertexArray(vao);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
@@ -259,56 +415,218 @@ int main(int argc, char** argv) {
     glfwSetFramebufferSizeCallback(window, glfw_resize_callback);
     glfwSetScrollCallback(window, glfw_scroll_callback);
     glfwSetKeyCallback(window, glfw_key_callback);
+    glfwSetWindowRefreshCallback(window, glfw_refresh_callback);
 
-    app_data.image_paths = list_images(filename);
+    // Number of images decoded ahead and behind, IMEYE_PREFETCH_RADIUS overrides it for tuning
+    size_t prefetch_radius = PREFETCH_RADIUS;
+    const char* radius_env = getenv("IMEYE_PREFETCH_RADIUS");
+    if (radius_env != NULL) {
+        prefetch_radius = strtoul(radius_env, NULL, 10);
+    }
 
-    if (app_data.image_paths == NULL) {
-        fprintf(stderr, "Failed to list app_data.image_paths\n");
+    prefetch_t prefetch;
+    if (prefetch_init(&prefetch, prefetch_radius, glfwPostEmptyEvent) != 0) {
+        fprintf(stderr, "Failed to start prefetcher\n");
         return -1;
     }
-
-    for (size_t i = 0; app_data.image_paths[i] != NULL; i++) {
-        app_data.image_count++;
-        if (strcmp(app_data.image_paths[i], filename) == 0) {
-            app_data.image_index = i;
+    app_data.prefetch = &prefetch;
+
+    // IMEYE_COMPRESS=1 keeps large images in VRAM as BC1/BC3 blocks
+    compressor_t compressor;
+    bool compressing = false;
+    const char* compress_env = getenv("IMEYE_COMPRESS");
+    if (compress_env != NULL && strcmp(compress_env, "0") != 0) {
+        GLint max_size = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+        if (!GLEW_EXT_texture_compression_s3tc) {
+            fprintf(stderr, "S3TC textures are not supported, images stay uncompressed\n");
+        } else if (compressor_init(&compressor, max_size, NULL) == 0) {
+            // IMEYE_BLOCK_CACHE_MB caps the blocks kept on disk
+            const char* limit_env = getenv("IMEYE_BLOCK_CACHE_MB");
+            if (limit_env != NULL) {
+                compressor.cache_limit = (uint64_t)strtoul(limit_env, NULL, 10) * 1024 * 1024;
+            }
+            compressing = true;
+            prefetch_set_compressor(&prefetch, &compressor);
         }
     }
+    prefetch_set_target(&prefetch, fit_width, fit_height);
+    prefetch_set_paths(&prefetch, &images);
+    prefetch_update(&prefetch, app_data.image_index, 1);
+    prefetch_request_center(&prefetch);
+
+    // Watch before scanning so nothing created in between is missed
+    dir_watch_t watch;
+    if (dir_watch_start(&watch, images.directory, glfwPostEmptyEvent) == 0) {
+        app_data.watch = &watch;
+    }
+
+    dir_scan_t scan;
+    if (dir_scan_start(&scan, images.directory, glfwPostEmptyEvent) == 0) {
+        app_data.scan = &scan;
+    }
+
+    // IMEYE_LATENCY=1 logs the time from each key event to the frame showing its effect
+    const char* latency_env = getenv("IMEYE_LATENCY");
+    input_queue_init(&input, latency_env != NULL && strcmp(latency_env, "0") != 0);
+
+    view_motion_t motion;
+    view_motion_init(&motion);
 
-    float time_start = glfwGetTime();
+    app_data.dirty = true;
     while (!glfwWindowShouldClose(window)) {
-        glfwSwapBuffers(window);
-        glfwPollEvents();
-
-        glClear(GL_COLOR_BUFFER_BIT);
-
-        glUniform1f(rotation_uniform, (float)app_data.rotation);
-
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-
-        if (key_states[GLFW_KEY_UP]) {
-            zoom_(ZOOM_IN, &app_data);
-        } else if (key_states[GLFW_KEY_DOWN]) {
-            zoom_(ZOOM_OUT, &app_data);
-        } else if (key_states[GLFW_KEY_D]) {
-            move(RIGHT, &app_data);
-        } else if (key_states[GLFW_KEY_A]) {
-            move(LEFT, &app_data);
-        } else if (key_states[GLFW_KEY_W]) {
-            move(UP, &app_data);
-        } else if (key_states[GLFW_KEY_S]) {
-            move(DOWN, &app_data);
+        double loop_start = glfwGetTime();
+        poll_directory(&app_data);
+        poll_uploads(&app_data);
+        poll_animation(&app_data);
+        apply_input(window);
+
+        int32_t zoom = key_states[GLFW_KEY_UP] - key_states[GLFW_KEY_DOWN];
+        int32_t pan_x = key_states[GLFW_KEY_D] - key_states[GLFW_KEY_A];
+        int32_t pan_y = key_states[GLFW_KEY_W] - key_states[GLFW_KEY_S];
+        if (app_data.in_grid) {
+            // The wheel scrolls a row at a time and the image view holds still underneath
+            grid_view_scroll(app_data.grid, -app_data.scroll * GRID_CELL);
+            app_data.scroll = 0;
+            zoom = pan_x = pan_y = 0;
+            if (grid_view_poll(app_data.grid, &images)) {
+                app_data.dirty = true;
+            }
+        }
+        if (hud_due(&hud) > 0.0 && glfwGetTime() >= hud_due(&hud)) {
+            app_data.dirty = true;
+        }
+        // Runs at the refresh rate while moving, swapping paces it
+        if (view_motion_update(&motion, &app_data, zoom, pan_x, pan_y, glfwGetTime())) {
+            app_data.dirty = true;
         }
 
+        if (app_data.dirty) {
+            app_data.dirty = false;
+            uint64_t frame_start = trace_begin();
+            int fb_width, fb_height;
+            glfwGetFramebufferSize(window, &fb_width, &fb_height);
+
+            hud_frame_begin(&hud, loop_start);
+
+            if (app_data.in_grid) {
+                grid_view_draw(app_data.grid, &images, fb_width, fb_height);
+            } else {
+                // The grid binds its own program and vertex array
+                glUseProgram(shader_program);
+                glBindVertexArray(vao);
+                glClear(GL_COLOR_BUFFER_BIT);
+                glUniform1f(rotation_uniform, (float)app_data.rotation);
+                glUniform1f(exposure_uniform, app_data.exposure);
+                glUniform1i(hdr_uniform, app_data.hdr);
+
+                if (app_data.tiled != NULL) {
+                    tile_view_t view = {
+                        .x = app_data.v_x,
+                        .y = app_data.v_y,
+                        .width = app_data.im_width,
+                        .height = app_data.im_height,
+                        .rotation = app_data.rotation,
+                        .fb_width = fb_width,
+                        .fb_height = fb_height,
+                    };
+                    // Keep drawing until every visible tile is resident
+                    app_data.dirty = draw_tiled_image(app_data.tiled, &view, tile_uniform, tile_uv_uniform);
+                } else {
+                    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+                }
+            }
+            // Drawn outside the timed part, the overlay doesn't count itself
+            hud_frame_end(&hud);
+            hud_draw(&hud, &app_data, fb_width, fb_height);
+            uint64_t swap_start = trace_begin();
+            glfwSwapBuffers(window);
+            trace_end("swap", swap_start);
+            // A switch to an image that is still uploading isn't visible yet
+            if (input.presenting_count > 0 && !app_data.loading) {
+                glFinish();
+                input_presented(&input, glfwGetTime());
+            }
+            trace_end("frame", frame_start);
+        }
         app_data.scroll = 0;
 
-        float time_end = glfwGetTime();
-        float time_diff = time_end - time_start;
-        if (time_diff < 1.0f / FPS) {
-            usleep((1.0f / FPS - time_diff) * 1000000);
+        // Sleep in the event queue until there is something to draw, the uploader posts an empty event when done
+        double frame_due = app_data.gif != NULL && !app_data.in_grid ? gif_player_due(app_data.gif) : 0.0;
+        double hud_refresh = hud_due(&hud);
+        if (hud_refresh > 0.0 && (frame_due == 0.0 || hud_refresh < frame_due)) {
+            frame_due = hud_refresh;
+        }
+        uint64_t wait_start = trace_begin();
+        if (app_data.dirty) {
+            glfwPollEvents();
+        } else if (app_data.refining) {
+            glfwWaitEventsTimeout(REFINE_POLL_SECONDS);
+        } else if (frame_due > 0.0) {
+            // Until the next GIF frame or HUD refresh is due
+            double wait = frame_due - glfwGetTime();
+            if (wait > 0.0) {
+                glfwWaitEventsTimeout(wait);
+            } else {
+                glfwPollEvents();
+            }
+        } else {
+            glfwWaitEvents();
+        }
+        trace_end("wait", wait_start);
+    }
+
+    // IMEYE_STATS=1 prints the prefetch, cache and compression counters on exit
+    const char* stats_env = getenv("IMEYE_STATS");
+    bool stats = stats_env != NULL && strcmp(stats_env, "0") != 0;
+    if (stats) {
+        printf("Prefetch: %lu hits, %lu late, %lu misses\n", (unsigned long)prefetch.hits, (unsigned long)prefetch.late,
+               (unsigned long)prefetch.misses);
+    }
+    if (app_data.scan != NULL) {
+        dir_scan_destroy(app_data.scan);
+    }
+    if (app_data.watch != NULL) {
+        dir_watch_destroy(app_data.watch);
+    }
+    stop_animation(&app_data);
+    prefetch_destroy(&prefetch);
+    if (compressing) {
+        if (stats) {
+            printf("Compression: %lu encoded, %lu from cache, %.1f MB -> %.1f MB\n", (unsigned long)compressor.encoded,
+                   (unsigned long)compressor.cache_hits, compressor.raw_bytes / (1024.0 * 1024.0),
+                   compressor.compressed_bytes / (1024.0 * 1024.0));
         }
+        compressor_destroy(&compressor);
+    }
+    uploader_destroy(&uploader);
+    if (app_data.grid != NULL) {
+        grid_view_destroy(app_data.grid);
+        free(app_data.grid);
+        if (stats) {
+            printf("Thumbnails: %lu cached, %lu generated, %lu failed\n", (unsigned long)app_data.thumbnailer->hits,
+                   (unsigned long)app_data.thumbnailer->generated, (unsigned long)app_data.thumbnailer->failed);
+        }
+        thumbnailer_destroy(app_data.thumbnailer);
+        free(app_data.thumbnailer);
+    }
+    if (app_data.tiled != NULL) {
+        tiled_image_destroy(app_data.tiled);
+        free(app_data.tiled);
+    }
+    if (stats) {
+        printf("Textures: %.1f MB resident, %lu hits, %lu misses, %lu evictions\n",
+               textures.resident_bytes / (1024.0 * 1024.0), (unsigned long)textures.hits, (unsigned long)textures.misses,
+               (unsigned long)textures.evictions);
     }
+    texture_cache_destroy(&textures);
+    glDeleteTextures(1, &placeholder);
+    hud_destroy(&hud);
 
     glfwTerminate();
+    path_table_destroy(&images);
+    free(app_data.image_path);
     free(app_data.title);
+    trace_shutdown();
     return 0;
 }
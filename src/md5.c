@@ -0,0 +1,115 @@
+#include "md5.h"
+
+#include <string.h>
+
+// RFC 1321, only used to name thumbnails so speed doesn't matter much
+static const uint32_t sines[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const uint8_t shifts[64] = {
+	7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+	5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+	4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+	6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+static void md5_block(md5_t* md5, const unsigned char* block) {
+	uint32_t words[16];
+	for (int i = 0; i < 16; i++) {
+		words[i] = (uint32_t)block[i * 4] | (uint32_t)block[i * 4 + 1] << 8 | (uint32_t)block[i * 4 + 2] << 16 |
+			(uint32_t)block[i * 4 + 3] << 24;
+	}
+	uint32_t a = md5->state[0], b = md5->state[1], c = md5->state[2], d = md5->state[3];
+	for (int i = 0; i < 64; i++) {
+		uint32_t f;
+		int g;
+		if (i < 16) {
+			f = (b & c) | (~b & d);
+			g = i;
+		} else if (i < 32) {
+			f = (d & b) | (~d & c);
+			g = (5 * i + 1) % 16;
+		} else if (i < 48) {
+			f = b ^ c ^ d;
+			g = (3 * i + 5) % 16;
+		} else {
+			f = c ^ (b | ~d);
+			g = (7 * i) % 16;
+		}
+		f += a + sines[i] + words[g];
+		a = d;
+		d = c;
+		c = b;
+		b += f << shifts[i] | f >> (32 - shifts[i]);
+	}
+	md5->state[0] += a;
+	md5->state[1] += b;
+	md5->state[2] += c;
+	md5->state[3] += d;
+}
+
+void md5_init(md5_t* md5) {
+	md5->state[0] = 0x67452301;
+	md5->state[1] = 0xefcdab89;
+	md5->state[2] = 0x98badcfe;
+	md5->state[3] = 0x10325476;
+	md5->length = 0;
+}
+
+void md5_update(md5_t* md5, const void* data, size_t size) {
+	const unsigned char* bytes = data;
+	size_t used = md5->length % 64;
+	md5->length += size;
+	if (used > 0) {
+		size_t take = 64 - used < size ? 64 - used : size;
+		memcpy(md5->buffer + used, bytes, take);
+		bytes += take;
+		size -= take;
+		if (used + take < 64) {
+			return;
+		}
+		md5_block(md5, md5->buffer);
+	}
+	for (; size >= 64; bytes += 64, size -= 64) {
+		md5_block(md5, bytes);
+	}
+	memcpy(md5->buffer, bytes, size);
+}
+
+void md5_final(md5_t* md5, unsigned char digest[16]) {
+	uint64_t bits = md5->length * 8;
+	unsigned char padding[72] = {0x80};
+	size_t used = md5->length % 64;
+	size_t pad = used < 56 ? 56 - used : 120 - used;
+	for (int i = 0; i < 8; i++) {
+		padding[pad + i] = (unsigned char)(bits >> (8 * i));
+	}
+	md5_update(md5, padding, pad + 8);
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < 4; j++) {
+			digest[i * 4 + j] = (unsigned char)(md5->state[i] >> (8 * j));
+		}
+	}
+}
+
+void md5_hex(const void* data, size_t size, char hex[33]) {
+	static const char digits[] = "0123456789abcdef";
+	md5_t md5;
+	unsigned char digest[16];
+	md5_init(&md5);
+	md5_update(&md5, data, size);
+	md5_final(&md5, digest);
+	for (int i = 0; i < 16; i++) {
+		hex[i * 2] = digits[digest[i] >> 4];
+		hex[i * 2 + 1] = digits[digest[i] & 15];
+	}
+	hex[32] = '\0';
+}
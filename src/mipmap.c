@@ -0,0 +1,311 @@
+#include "mipmap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define MIP_X86 1
+#include <immintrin.h>
+#endif
+
+// Each kernel handles the first `pairs` output pixels, where both source columns exist
+typedef void (*mip_kernel_t)(const uint8_t* row0, const uint8_t* row1, uint8_t* out, int32_t pairs);
+
+static void downsample_scalar(const uint8_t* row0, const uint8_t* row1, uint8_t* out, int32_t from, int32_t src_width,
+			      int32_t dst_width, int32_t channels) {
+	for (int32_t x = from; x < dst_width; x++) {
+		int32_t x0 = 2 * x * channels;
+		int32_t x1 = 2 * x + 1 < src_width ? x0 + channels : x0;
+		for (int32_t k = 0; k < channels; k++) {
+			out[x * channels + k] = (row0[x0 + k] + row0[x1 + k] + row1[x0 + k] + row1[x1 + k] + 2) >> 2;
+		}
+	}
+}
+
+// Averaged in float, halves have no integer shortcut
+static void downsample_half_scalar(const uint8_t* row0, const uint8_t* row1, uint8_t* out, int32_t from,
+				   int32_t src_width, int32_t dst_width, int32_t channels) {
+	const uint16_t* a = (const uint16_t*)row0;
+	const uint16_t* b = (const uint16_t*)row1;
+	uint16_t* dst = (uint16_t*)out;
+	for (int32_t x = from; x < dst_width; x++) {
+		int32_t x0 = 2 * x * channels;
+		int32_t x1 = 2 * x + 1 < src_width ? x0 + channels : x0;
+		for (int32_t k = 0; k < channels; k++) {
+			float sum = half_to_float(a[x0 + k]) + half_to_float(a[x1 + k]) + half_to_float(b[x0 + k]) +
+				    half_to_float(b[x1 + k]);
+			dst[x * channels + k] = half_from_float(sum * 0.25f);
+		}
+	}
+}
+
+#ifdef MIP_X86
+
+// Averages 2x8 four byte pixels (a0 a1 over b0 b1) into four
+static inline __m128i average_rgba(__m128i a0, __m128i a1, __m128i b0, __m128i b1) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi16(2);
+	// Vertical sums, two source pixels per register
+	__m128i v0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+	__m128i v1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+	__m128i v2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+	__m128i v3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+	// Horizontal sums of neighbouring pixels
+	__m128i s0 = _mm_add_epi16(_mm_unpacklo_epi64(v0, v1), _mm_unpackhi_epi64(v0, v1));
+	__m128i s1 = _mm_add_epi16(_mm_unpacklo_epi64(v2, v3), _mm_unpackhi_epi64(v2, v3));
+	s0 = _mm_srli_epi16(_mm_add_epi16(s0, round), 2);
+	s1 = _mm_srli_epi16(_mm_add_epi16(s1, round), 2);
+	return _mm_packus_epi16(s0, s1);
+}
+
+// Four output pixels per iteration
+static void downsample_rgba_sse2(const uint8_t* row0, const uint8_t* row1, uint8_t* out, int32_t pairs) {
+	int32_t x = 0;
+	for (; x + 4 <= pairs; x += 4) {
+		__m128i a0 = _mm_loadu_si128((const __m128i*)(row0 + x * 8));
+		__m128i a1 = _mm_loadu_si128((const __m128i*)(row0 + x * 8 + 16));
+		__m128i b0 = _mm_loadu_si128((const __m128i*)(row1 + x * 8));
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(row1 + x * 8 + 16));
+		_mm_storeu_si128((__m128i*)(out + x * 4), average_rgba(a0, a1, b0, b1));
+	}
+	downsample_scalar(row0, row1, out, x, 2 * pairs, pairs, 4);
+}
+
+// Four output pixels per iteration, RGB is spread out to RGBX and packed back with byte shuffles
+__attribute__((target("ssse3"))) static void downsample_rgb_ssse3(const uint8_t* row0, const uint8_t* row1, uint8_t* out,
+								  int32_t pairs) {
+	const __m128i expand = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m128i compact = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	int32_t x = 0;
+	// The second load of each row reads four bytes past the eight pixels used
+	for (; x + 5 <= pairs; x += 4) {
+		const uint8_t* p0 = row0 + x * 6;
+		const uint8_t* p1 = row1 + x * 6;
+		__m128i a0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)p0), expand);
+		__m128i a1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p0 + 12)), expand);
+		__m128i b0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)p1), expand);
+		__m128i b1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p1 + 12)), expand);
+		__m128i rgb = _mm_shuffle_epi8(average_rgba(a0, a1, b0, b1), compact);
+		_mm_storel_epi64((__m128i*)(out + x * 3), rgb);
+		int32_t tail = _mm_cvtsi128_si32(_mm_srli_si128(rgb, 8));
+		memcpy(out + x * 3 + 8, &tail, sizeof(tail));
+	}
+	downsample_scalar(row0, row1, out, x, 2 * pairs, pairs, 3);
+}
+
+// Eight output pixels per iteration
+static void downsample_gray_sse2(const uint8_t* row0, const uint8_t* row1, uint8_t* out, int32_t pairs) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi16(1);
+	const __m128i round = _mm_set1_epi16(2);
+	int32_t x = 0;
+	for (; x + 8 <= pairs; x += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(row0 + x * 2));
+		__m128i b = _mm_loadu_si128((const __m128i*)(row1 + x * 2));
+		__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+		__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+		__m128i sum = _mm_packs_epi32(_mm_madd_epi16(lo, ones), _mm_madd_epi16(hi, ones));
+		sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+		_mm_storel_epi64((__m128i*)(out + x), _mm_packus_epi16(sum, sum));
+	}
+	downsample_scalar(row0, row1, out, x, 2 * pairs, pairs, 1);
+}
+
+// Eight output pixels per iteration
+__attribute__((target("avx2"))) static void downsample_rgba_avx2(const uint8_t* row0, const uint8_t* row1, uint8_t* out,
+								  int32_t pairs) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i round = _mm256_set1_epi16(2);
+	int32_t x = 0;
+	for (; x + 8 <= pairs; x += 8) {
+		__m256i a0 = _mm256_loadu_si256((const __m256i*)(row0 + x * 8));
+		__m256i a1 = _mm256_loadu_si256((const __m256i*)(row0 + x * 8 + 32));
+		__m256i b0 = _mm256_loadu_si256((const __m256i*)(row1 + x * 8));
+		__m256i b1 = _mm256_loadu_si256((const __m256i*)(row1 + x * 8 + 32));
+		__m256i v0 = _mm256_add_epi16(_mm256_unpacklo_epi8(a0, zero), _mm256_unpacklo_epi8(b0, zero));
+		__m256i v1 = _mm256_add_epi16(_mm256_unpackhi_epi8(a0, zero), _mm256_unpackhi_epi8(b0, zero));
+		__m256i v2 = _mm256_add_epi16(_mm256_unpacklo_epi8(a1, zero), _mm256_unpacklo_epi8(b1, zero));
+		__m256i v3 = _mm256_add_epi16(_mm256_unpackhi_epi8(a1, zero), _mm256_unpackhi_epi8(b1, zero));
+		__m256i s0 = _mm256_add_epi16(_mm256_unpacklo_epi64(v0, v1), _mm256_unpackhi_epi64(v0, v1));
+		__m256i s1 = _mm256_add_epi16(_mm256_unpacklo_epi64(v2, v3), _mm256_unpackhi_epi64(v2, v3));
+		s0 = _mm256_srli_epi16(_mm256_add_epi16(s0, round), 2);
+		s1 = _mm256_srli_epi16(_mm256_add_epi16(s1, round), 2);
+		// Packing works per 128 bit lane, put the 64 bit groups back in order
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(s0, s1), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i*)(out + x * 4), packed);
+	}
+	downsample_rgba_sse2(row0 + x * 8, row1 + x * 8, out + x * 4, pairs - x);
+}
+
+// Thirty two output pixels per iteration
+__attribute__((target("avx2"))) static void downsample_gray_avx2(const uint8_t* row0, const uint8_t* row1, uint8_t* out,
+								  int32_t pairs) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i ones = _mm256_set1_epi16(1);
+	const __m256i round = _mm256_set1_epi16(2);
+	int32_t x = 0;
+	for (; x + 32 <= pairs; x += 32) {
+		__m256i sums[2];
+		for (int32_t i = 0; i < 2; i++) {
+			__m256i a = _mm256_loadu_si256((const __m256i*)(row0 + x * 2 + i * 32));
+			__m256i b = _mm256_loadu_si256((const __m256i*)(row1 + x * 2 + i * 32));
+			__m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+			__m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+			__m256i sum = _mm256_packs_epi32(_mm256_madd_epi16(lo, ones), _mm256_madd_epi16(hi, ones));
+			sums[i] = _mm256_srli_epi16(_mm256_add_epi16(sum, round), 2);
+		}
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(sums[0], sums[1]), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i*)(out + x), packed);
+	}
+	downsample_gray_sse2(row0 + x * 2, row1 + x * 2, out + x, pairs - x);
+}
+
+// Two output pixels per iteration, F16C came with the same CPUs as AVX2
+__attribute__((target("avx,f16c"))) static void downsample_half_rgba_f16c(const uint8_t* row0, const uint8_t* row1,
+									 uint8_t* out, int32_t pairs) {
+	const uint16_t* a = (const uint16_t*)row0;
+	const uint16_t* b = (const uint16_t*)row1;
+	uint16_t* dst = (uint16_t*)out;
+	const __m256 quarter = _mm256_set1_ps(0.25f);
+	int32_t x = 0;
+	for (; x + 2 <= pairs; x += 2) {
+		// Four source pixels of each row, the first output pixel's pair in the low half
+		__m256 a0 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(a + x * 8)));
+		__m256 a1 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(a + x * 8 + 8)));
+		__m256 b0 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(b + x * 8)));
+		__m256 b1 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(b + x * 8 + 8)));
+		__m256 v0 = _mm256_add_ps(a0, b0);
+		__m256 v1 = _mm256_add_ps(a1, b1);
+		// Left plus right pixel of each pair, both outputs in one register
+		__m256 sum = _mm256_add_ps(_mm256_permute2f128_ps(v0, v1, 0x20), _mm256_permute2f128_ps(v0, v1, 0x31));
+		__m128i halves = _mm256_cvtps_ph(_mm256_mul_ps(sum, quarter), _MM_FROUND_TO_NEAREST_INT);
+		_mm_storeu_si128((__m128i*)(dst + x * 4), halves);
+	}
+	downsample_half_scalar(row0, row1, out, x, 2 * pairs, pairs, 4);
+}
+
+#endif
+
+mip_isa_t mip_isa() {
+#ifdef MIP_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return MIP_AVX2;
+	}
+	return MIP_SSE2;
+#else
+	return MIP_SCALAR;
+#endif
+}
+
+const char* mip_isa_name(mip_isa_t isa) {
+	switch (isa) {
+		case MIP_SSE2:
+			return "sse2";
+		case MIP_AVX2:
+			return "avx2";
+		default:
+			return "scalar";
+	}
+}
+
+static mip_kernel_t pick_kernel(const image_t* image, mip_isa_t isa) {
+	int32_t channels = image->channels;
+#ifdef MIP_X86
+	if (image->sample == IMAGE_HALF) {
+		return isa == MIP_AVX2 && channels == 4 ? downsample_half_rgba_f16c : NULL;
+	}
+	// Every AVX2 CPU has SSSE3 as well
+	if (isa == MIP_AVX2 && channels == 3) {
+		return downsample_rgb_ssse3;
+	}
+	if (isa == MIP_AVX2) {
+		return channels == 4 ? downsample_rgba_avx2 : channels == 1 ? downsample_gray_avx2 : NULL;
+	}
+	if (isa == MIP_SSE2) {
+		return channels == 4 ? downsample_rgba_sse2 : channels == 1 ? downsample_gray_sse2 : NULL;
+	}
+#else
+	(void)channels;
+	(void)isa;
+#endif
+	return NULL;
+}
+
+int downsample_image(const image_t* src, image_t* dst, mip_isa_t isa) {
+	dst->width = src->width > 1 ? (src->width + 1) / 2 : 1;
+	dst->height = src->height > 1 ? (src->height + 1) / 2 : 1;
+	dst->channels = src->channels;
+	dst->sample = src->sample;
+	dst->hdr = src->hdr;
+	dst->full_width = src->full_width;
+	dst->full_height = src->full_height;
+	dst->mips = NULL;
+	dst->mip_count = 0;
+	dst->pixels = malloc(image_size(dst));
+	if (dst->pixels == NULL) {
+		return -1;
+	}
+
+	// Two channel images are rare enough to stay scalar
+	mip_kernel_t kernel = pick_kernel(src, isa);
+	int32_t pairs = src->width / 2;
+	size_t stride = (size_t)src->width * pixel_size(src);
+	size_t dst_stride = (size_t)dst->width * pixel_size(dst);
+	for (int32_t y = 0; y < dst->height; y++) {
+		const uint8_t* row0 = src->pixels + (size_t)(2 * y) * stride;
+		const uint8_t* row1 = 2 * y + 1 < src->height ? row0 + stride : row0;
+		uint8_t* out = dst->pixels + (size_t)y * dst_stride;
+		int32_t done = 0;
+		if (kernel != NULL) {
+			kernel(row0, row1, out, pairs);
+			done = pairs;
+		}
+		if (src->sample == IMAGE_HALF) {
+			downsample_half_scalar(row0, row1, out, done, src->width, dst->width, src->channels);
+		} else {
+			downsample_scalar(row0, row1, out, done, src->width, dst->width, src->channels);
+		}
+	}
+	return 0;
+}
+
+int build_mipmaps_isa(image_t* image, mip_isa_t isa) {
+	// Left empty rather than undefined when there's nothing to build or building fails
+	image->mips = NULL;
+	image->mip_count = 0;
+	int32_t count = 0;
+	for (int32_t w = image->width, h = image->height; w > 1 || h > 1; count++) {
+		w = w > 1 ? (w + 1) / 2 : 1;
+		h = h > 1 ? (h + 1) / 2 : 1;
+	}
+	if (count == 0) {
+		return 0;
+	}
+
+	image_t* mips = calloc(count, sizeof(image_t));
+	if (mips == NULL) {
+		return -1;
+	}
+	for (int32_t i = 0; i < count; i++) {
+		if (downsample_image(i == 0 ? image : &mips[i - 1], &mips[i], isa) != 0) {
+			for (int32_t j = 0; j < i; j++) {
+				free(mips[j].pixels);
+			}
+			free(mips);
+			return -1;
+		}
+	}
+	image->mips = mips;
+	image->mip_count = count;
+	return 0;
+}
+
+int build_mipmaps(image_t* image) {
+	uint64_t start = trace_begin();
+	int result = build_mipmaps_isa(image, mip_isa());
+	trace_end("mipmaps", start);
+	return result;
+}
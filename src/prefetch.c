@@ -0,0 +1,436 @@
+#include "prefetch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "file_map.h"
+#include "mipmap.h"
+#include "trace.h"
+
+static size_t wrap_index(const prefetch_t* prefetch, size_t center, int64_t offset) {
+	int64_t count = (int64_t)prefetch->path_count;
+	int64_t index = ((int64_t)center + offset) % count;
+	if (index < 0) {
+		index += count;
+	}
+	return (size_t)index;
+}
+
+static size_t window_radius(const prefetch_t* prefetch) {
+	// Don't wrap around onto the same images from both sides
+	size_t radius = prefetch->radius;
+	if (prefetch->path_count > 0 && 2 * radius + 1 > prefetch->path_count) {
+		radius = (prefetch->path_count - 1) / 2;
+	}
+	return radius;
+}
+
+static bool in_window(const prefetch_t* prefetch, size_t index) {
+	if (prefetch->path_count == 0) {
+		return false;
+	}
+	size_t radius = window_radius(prefetch);
+	for (size_t k = 0; k <= radius; k++) {
+		if (wrap_index(prefetch, prefetch->center, k) == index || wrap_index(prefetch, prefetch->center, -(int64_t)k) == index) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static prefetch_slot_t* find_slot(prefetch_t* prefetch, size_t index) {
+	for (size_t i = 0; i < prefetch->slot_count; i++) {
+		prefetch_slot_t* slot = &prefetch->slots[i];
+		if (slot->state != SLOT_EMPTY && slot->index == index && path_table_is(prefetch->paths, index, slot->path)) {
+			return slot;
+		}
+	}
+	return NULL;
+}
+
+static void clear_slot(prefetch_slot_t* slot) {
+	free_image(&slot->image);
+	free(slot->path);
+	slot->path = NULL;
+	slot->state = SLOT_EMPTY;
+}
+
+// Next image to decode: ahead in the direction of travel first, then behind
+static bool next_job(prefetch_t* prefetch, size_t* index) {
+	if (prefetch->path_count == 0) {
+		return false;
+	}
+	if (prefetch->center_requested) {
+		if (find_slot(prefetch, prefetch->center) == NULL) {
+			*index = prefetch->center;
+			return true;
+		}
+		prefetch->center_requested = false;
+	}
+	size_t radius = window_radius(prefetch);
+	for (size_t pass = 0; pass < 2; pass++) {
+		int64_t sign = pass == 0 ? prefetch->direction : -prefetch->direction;
+		for (size_t k = 1; k <= radius; k++) {
+			size_t candidate = wrap_index(prefetch, prefetch->center, sign * (int64_t)k);
+			if (find_slot(prefetch, candidate) == NULL) {
+				*index = candidate;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static prefetch_slot_t* free_slot(prefetch_t* prefetch) {
+	for (size_t i = 0; i < prefetch->slot_count; i++) {
+		if (prefetch->slots[i].state == SLOT_EMPTY) {
+			return &prefetch->slots[i];
+		}
+	}
+	for (size_t i = 0; i < prefetch->slot_count; i++) {
+		prefetch_slot_t* slot = &prefetch->slots[i];
+		if (slot->state != SLOT_LOADING && !in_window(prefetch, slot->index)) {
+			clear_slot(slot);
+			return slot;
+		}
+	}
+	return NULL;
+}
+
+// The mip chain is built here too so the main thread only has to upload it.
+// With a compressor, blocks cached for the file are used instead of decoding.
+// The mtime is taken first, a rewrite while decoding then leaves it out of date.
+static int decode_levels(compressor_t* compressor, const char* path, int32_t max_width, int32_t max_height,
+                         image_t* image) {
+	int64_t mtime = file_mtime(path);
+	unsigned char key[16];
+	bool keyed = compressor != NULL && block_key(path, key) == 0;
+	compress_report_t report;
+	if (keyed && compressor_load(compressor, key, image, &report) == 0) {
+		print_compress_report(path, &report);
+		image->mtime = mtime;
+		return 0;
+	}
+
+	int result = decode_image(path, max_width, max_height, image);
+	if (result == 0 && build_mipmaps(image) != 0) {
+		fprintf(stderr, "Failed to build mipmaps for %s\n", path);
+	}
+	if (result == 0 && compressor != NULL && compressor_compress(compressor, keyed ? key : NULL, image, &report) == 0) {
+		print_compress_report(path, &report);
+	}
+	if (result == 0) {
+		image->mtime = mtime;
+	}
+	return result;
+}
+
+static void decode_full(prefetch_t* prefetch) {
+	prefetch_slot_t* slot = &prefetch->full;
+	prefetch->full_requested = false;
+	slot->state = SLOT_LOADING;
+	slot->stale = false;
+	char* path = strdup(slot->path);
+	pthread_mutex_unlock(&prefetch->lock);
+
+	image_t image = {0};
+	int result = decode_levels(prefetch->compressor, path, 0, 0, &image);
+	free(path);
+
+	pthread_mutex_lock(&prefetch->lock);
+	// Superseded by another request while decoding
+	if (prefetch->full_requested) {
+		free_image(&image);
+		return;
+	}
+	// The file changed while decoding, decode it again
+	if (slot->stale) {
+		free_image(&image);
+		prefetch->full_requested = true;
+		return;
+	}
+	slot->image = image;
+	slot->state = result == 0 ? SLOT_READY : SLOT_FAILED;
+	if (prefetch->notify != NULL) {
+		prefetch->notify();
+	}
+}
+
+static void* prefetch_worker(void* arg) {
+	prefetch_t* prefetch = arg;
+	trace_thread_name("prefetch");
+	pthread_mutex_lock(&prefetch->lock);
+	while (prefetch->running) {
+		if (prefetch->full_requested) {
+			decode_full(prefetch);
+			continue;
+		}
+
+		size_t index;
+		prefetch_slot_t* slot = NULL;
+		if (next_job(prefetch, &index)) {
+			slot = free_slot(prefetch);
+		}
+		if (slot == NULL) {
+			pthread_cond_wait(&prefetch->wake, &prefetch->lock);
+			continue;
+		}
+
+		if (index == prefetch->center) {
+			prefetch->center_requested = false;
+		}
+		slot->state = SLOT_LOADING;
+		slot->index = index;
+		slot->path = path_table_path(prefetch->paths, index);
+		image_t image = {0};
+		int result;
+		// Decoded again when the file changes meanwhile, prefetch_take() may be waiting for it
+		do {
+			slot->stale = false;
+			char* path = slot->path;
+			int32_t max_width = prefetch->max_width;
+			int32_t max_height = prefetch->max_height;
+			pthread_mutex_unlock(&prefetch->lock);
+
+			free_image(&image);
+			result = decode_levels(prefetch->compressor, path, max_width, max_height, &image);
+
+			pthread_mutex_lock(&prefetch->lock);
+		} while (slot->stale && prefetch->running);
+		slot->image = image;
+		slot->state = result == 0 ? SLOT_READY : SLOT_FAILED;
+		pthread_cond_broadcast(&prefetch->done);
+		if (prefetch->notify != NULL) {
+			prefetch->notify();
+		}
+	}
+	pthread_mutex_unlock(&prefetch->lock);
+	return NULL;
+}
+
+int prefetch_init(prefetch_t* prefetch, size_t radius, void (*notify)(void)) {
+	memset(prefetch, 0, sizeof(*prefetch));
+	prefetch->radius = radius;
+	prefetch->notify = notify;
+	prefetch->slot_count = 2 * radius + 1;
+	prefetch->direction = 1;
+	prefetch->slots = calloc(prefetch->slot_count, sizeof(prefetch_slot_t));
+	if (prefetch->slots == NULL) {
+		return -1;
+	}
+
+	pthread_mutex_init(&prefetch->lock, NULL);
+	pthread_cond_init(&prefetch->wake, NULL);
+	pthread_cond_init(&prefetch->done, NULL);
+	prefetch->running = true;
+	if (pthread_create(&prefetch->thread, NULL, prefetch_worker, prefetch) != 0) {
+		fprintf(stderr, "Failed to start prefetch thread\n");
+		prefetch->running = false;
+		return -1;
+	}
+	return 0;
+}
+
+void prefetch_destroy(prefetch_t* prefetch) {
+	pthread_mutex_lock(&prefetch->lock);
+	bool running = prefetch->running;
+	prefetch->running = false;
+	pthread_cond_broadcast(&prefetch->wake);
+	pthread_mutex_unlock(&prefetch->lock);
+	if (running) {
+		pthread_join(prefetch->thread, NULL);
+	}
+
+	for (size_t i = 0; i < prefetch->slot_count; i++) {
+		clear_slot(&prefetch->slots[i]);
+	}
+	clear_slot(&prefetch->full);
+	free(prefetch->slots);
+	pthread_cond_destroy(&prefetch->done);
+	pthread_cond_destroy(&prefetch->wake);
+	pthread_mutex_destroy(&prefetch->lock);
+}
+
+void prefetch_set_paths(prefetch_t* prefetch, const path_table_t* paths) {
+	pthread_mutex_lock(&prefetch->lock);
+	prefetch->paths = paths;
+	prefetch->path_count = paths->count;
+	if (prefetch->center >= paths->count) {
+		prefetch->center = 0;
+	}
+	pthread_cond_signal(&prefetch->wake);
+	pthread_mutex_unlock(&prefetch->lock);
+}
+
+void prefetch_paths_begin(prefetch_t* prefetch) {
+	pthread_mutex_lock(&prefetch->lock);
+}
+
+static void reindex_slot(prefetch_t* prefetch, prefetch_slot_t* slot) {
+	if (slot->state == SLOT_EMPTY || slot->path == NULL) {
+		return;
+	}
+	// Gone from the table, SIZE_MAX is never in the window so the slot gets reused
+	size_t index = path_table_find(prefetch->paths, slot->path);
+	slot->index = index < prefetch->paths->count ? index : SIZE_MAX;
+}
+
+void prefetch_paths_end(prefetch_t* prefetch, size_t center) {
+	prefetch->path_count = prefetch->paths->count;
+	for (size_t i = 0; i < prefetch->slot_count; i++) {
+		reindex_slot(prefetch, &prefetch->slots[i]);
+	}
+	reindex_slot(prefetch, &prefetch->full);
+	prefetch->center = center < prefetch->path_count ? center : 0;
+	pthread_cond_signal(&prefetch->wake);
+	pthread_mutex_unlock(&prefetch->lock);
+}
+
+void prefetch_update(prefetch_t* prefetch, size_t center, int direction) {
+	pthread_mutex_lock(&prefetch->lock);
+	prefetch->center = center;
+	prefetch->direction = direction < 0 ? -1 : 1;
+	pthread_cond_signal(&prefetch->wake);
+	pthread_mutex_unlock(&prefetch->lock);
+}
+
+void prefetch_invalidate(prefetch_t* prefetch, const char* path) {
+	pthread_mutex_lock(&prefetch->lock);
+	// A decode in flight may have read either version, the worker redoes it
+	for (size_t i = 0; i < prefetch->slot_count; i++) {
+		prefetch_slot_t* slot = &prefetch->slots[i];
+		if (slot->state == SLOT_LOADING && strcmp(slot->path, path) == 0) {
+			slot->stale = true;
+		} else if (slot->state != SLOT_EMPTY && strcmp(slot->path, path) == 0) {
+			clear_slot(slot);
+		}
+	}
+	prefetch_slot_t* full = &prefetch->full;
+	if (full->state == SLOT_LOADING && !prefetch->full_requested && strcmp(full->path, path) == 0) {
+		full->stale = true;
+	} else if (full->state != SLOT_EMPTY && full->state != SLOT_LOADING && strcmp(full->path, path) == 0) {
+		clear_slot(full);
+	}
+	pthread_cond_signal(&prefetch->wake);
+	pthread_mutex_unlock(&prefetch->lock);
+}
+
+int prefetch_take(prefetch_t* prefetch, size_t index, image_t* image) {
+	pthread_mutex_lock(&prefetch->lock);
+	prefetch_slot_t* slot = find_slot(prefetch, index);
+	if (slot != NULL && slot->state == SLOT_LOADING) {
+		prefetch->late++;
+		while (slot->state == SLOT_LOADING) {
+			pthread_cond_wait(&prefetch->done, &prefetch->lock);
+		}
+	} else if (slot != NULL) {
+		prefetch->hits++;
+	}
+
+	if (slot != NULL) {
+		// The displayed image no longer needs its slot, hand the pixels over
+		int result = slot->state == SLOT_READY ? 0 : -1;
+		*image = slot->image;
+		slot->image.pixels = NULL;
+		slot->image.mips = NULL;
+		slot->image.mip_count = 0;
+		clear_slot(slot);
+		pthread_cond_signal(&prefetch->wake);
+		pthread_mutex_unlock(&prefetch->lock);
+		return result;
+	}
+
+	prefetch->misses++;
+	char* miss_path = path_table_path(prefetch->paths, index);
+	int32_t max_width = prefetch->max_width;
+	int32_t max_height = prefetch->max_height;
+	pthread_mutex_unlock(&prefetch->lock);
+	if (miss_path == NULL) {
+		return -1;
+	}
+	int result = decode_levels(prefetch->compressor, miss_path, max_width, max_height, image);
+	free(miss_path);
+	return result;
+}
+
+void prefetch_request_center(prefetch_t* prefetch) {
+	pthread_mutex_lock(&prefetch->lock);
+	prefetch->center_requested = true;
+	pthread_cond_signal(&prefetch->wake);
+	pthread_mutex_unlock(&prefetch->lock);
+}
+
+int prefetch_poll(prefetch_t* prefetch, size_t index, image_t* image) {
+	pthread_mutex_lock(&prefetch->lock);
+	prefetch_slot_t* slot = find_slot(prefetch, index);
+	if (slot == NULL || slot->state == SLOT_LOADING) {
+		pthread_mutex_unlock(&prefetch->lock);
+		return 0;
+	}
+	int result = slot->state == SLOT_READY ? 1 : -1;
+	*image = slot->image;
+	slot->image.pixels = NULL;
+	slot->image.mips = NULL;
+	slot->image.mip_count = 0;
+	clear_slot(slot);
+	pthread_cond_signal(&prefetch->wake);
+	pthread_mutex_unlock(&prefetch->lock);
+	return result;
+}
+
+void prefetch_set_compressor(prefetch_t* prefetch, compressor_t* compressor) {
+	pthread_mutex_lock(&prefetch->lock);
+	prefetch->compressor = compressor;
+	pthread_mutex_unlock(&prefetch->lock);
+}
+
+void prefetch_set_target(prefetch_t* prefetch, int32_t max_width, int32_t max_height) {
+	pthread_mutex_lock(&prefetch->lock);
+	if (prefetch->max_width != max_width || prefetch->max_height != max_height) {
+		// Anything already decoded was sized for the old target
+		for (size_t i = 0; i < prefetch->slot_count; i++) {
+			if (prefetch->slots[i].state != SLOT_LOADING) {
+				clear_slot(&prefetch->slots[i]);
+			}
+		}
+	}
+	prefetch->max_width = max_width;
+	prefetch->max_height = max_height;
+	pthread_cond_signal(&prefetch->wake);
+	pthread_mutex_unlock(&prefetch->lock);
+}
+
+void prefetch_request_full(prefetch_t* prefetch, size_t index) {
+	pthread_mutex_lock(&prefetch->lock);
+	prefetch_slot_t* slot = &prefetch->full;
+	if (slot->state != SLOT_LOADING) {
+		clear_slot(slot);
+	} else {
+		// The worker still uses the old path, it notices full_requested and drops its result
+		free(slot->path);
+	}
+	slot->index = index;
+	slot->path = path_table_path(prefetch->paths, index);
+	slot->state = SLOT_LOADING;
+	prefetch->full_requested = true;
+	pthread_cond_signal(&prefetch->wake);
+	pthread_mutex_unlock(&prefetch->lock);
+}
+
+int prefetch_poll_full(prefetch_t* prefetch, size_t index, image_t* image) {
+	pthread_mutex_lock(&prefetch->lock);
+	prefetch_slot_t* slot = &prefetch->full;
+	if (prefetch->full_requested || slot->state == SLOT_LOADING || slot->state == SLOT_EMPTY || slot->index != index) {
+		pthread_mutex_unlock(&prefetch->lock);
+		return 0;
+	}
+	int result = slot->state == SLOT_READY ? 1 : -1;
+	*image = slot->image;
+	slot->image.pixels = NULL;
+	slot->image.mips = NULL;
+	slot->image.mip_count = 0;
+	clear_slot(slot);
+	pthread_mutex_unlock(&prefetch->lock);
+	return result;
+}
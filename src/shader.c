@@ -9,6 +9,8 @@ const char* vert_shad =
     "layout (location = 1) in vec2 texCoord;\n"
     "out vec2 TexCoords;\n"
     "uniform float rotation_angle;\n"
+    "uniform vec4 tile;\n"
+    "uniform vec4 tile_uv;\n"
     "void main()\n"
     "{\n"
     "   float rad = radians(rotation_angle);\n"
@@ -18,28 +20,107 @@ const char* vert_shad =
     "       0.0, 0.0, 1.0, 0.0,\n"
     "       0.0, 0.0, 0.0, 1.0\n"
     "   );\n"
-    "   vec4 pos = rotation * vec4(vertex, 1.0);\n"
-    "   TexCoords = texCoord;\n"
+    "   vec4 pos = rotation * vec4(vertex.xy * tile.zw + tile.xy, vertex.z, 1.0);\n"
+    "   TexCoords = texCoord * tile_uv.zw + tile_uv.xy;\n"
     "   gl_Position = pos;\n"
     "}";
 
+// Exposure is in stops. HDR images are linear radiance, scaled, tone mapped
+// with Reinhard and gamma encoded here; everything else is already encoded
+// for display and only goes through linear light when the exposure is changed.
 const char* frag_shad =
 	"#version 330 core\n"
 	"in vec2 TexCoords;\n"
 	"out vec4 color;\n"
 	"uniform sampler2D image;\n"
+	"uniform float exposure;\n"
+	"uniform bool hdr;\n"
 	"void main()\n"
 	"{   \n"
 	"vec4 texColor = texture(image, TexCoords);\n"
 	"if (texColor.a < 0.1)\n"
 	"discard;\n"
-	"color = texColor;\n"
+	"vec3 rgb = max(texColor.rgb, vec3(0.0));\n"
+	"if (hdr) {\n"
+	"   rgb *= exp2(exposure);\n"
+	"   rgb = pow(rgb / (1.0 + rgb), vec3(1.0 / 2.2));\n"
+	"} else if (exposure != 0.0) {\n"
+	"   rgb = pow(pow(rgb, vec3(2.2)) * exp2(exposure), vec3(1.0 / 2.2));\n"
+	"}\n"
+	"color = vec4(rgb, texColor.a);\n"
 "}";
 
 
-uint32_t get_shader(){
+// Thumbnail cells placed in pixels from the top left, one instance each
+const char* grid_vert_shad =
+	"#version 330 core\n"
+	"layout (location = 0) in vec2 corner;\n"
+	"layout (location = 1) in vec4 cell;\n"
+	"layout (location = 2) in vec4 thumb;\n"
+	"out vec3 TexCoords;\n"
+	"uniform vec2 viewport;\n"
+	"void main()\n"
+	"{\n"
+	"   vec2 pixel = cell.xy + corner * cell.zw;\n"
+	"   TexCoords = vec3(corner.x * thumb.x, (1.0 - corner.y) * thumb.y, thumb.z);\n"
+	"   gl_Position = vec4(pixel.x / viewport.x * 2.0 - 1.0, 1.0 - pixel.y / viewport.y * 2.0, 0.0, 1.0);\n"
+	"}";
+
+// Negative layers have no thumbnail: -1 is a cell still loading, -2 the selection frame
+const char* grid_frag_shad =
+	"#version 330 core\n"
+	"in vec3 TexCoords;\n"
+	"out vec4 color;\n"
+	"uniform sampler2DArray thumbs;\n"
+	"void main()\n"
+	"{\n"
+	"   if (TexCoords.z < -1.5) {\n"
+	"       color = vec4(0.35, 0.55, 0.9, 1.0);\n"
+	"   } else if (TexCoords.z < -0.5) {\n"
+	"       color = vec4(0.15, 0.15, 0.15, 1.0);\n"
+	"   } else {\n"
+	"       color = texture(thumbs, TexCoords);\n"
+	"   }\n"
+	"}";
+
+// One character cell per instance: column, row and glyph. Cells are 6x9 font
+// pixels, the 5x7 glyph with a pixel of spacing right of it, above and below.
+const char* hud_vert_shad =
+	"#version 330 core\n"
+	"layout (location = 0) in uvec4 cell;\n"
+	"flat out int glyph;\n"
+	"out vec2 FontPixel;\n"
+	"uniform vec2 viewport;\n"
+	"uniform float scale;\n"
+	"void main()\n"
+	"{\n"
+	"   vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);\n"
+	"   FontPixel = corner * vec2(6.0, 9.0);\n"
+	"   vec2 pixel = (vec2(cell.xy) * vec2(6.0, 9.0) + FontPixel) * scale;\n"
+	"   glyph = int(cell.z);\n"
+	"   gl_Position = vec4(pixel.x / viewport.x * 2.0 - 1.0, 1.0 - pixel.y / viewport.y * 2.0, 0.0, 1.0);\n"
+	"}";
+
+// Glyphs sit side by side in one row of the font texture, the rest of the cell is the translucent panel
+const char* hud_frag_shad =
+	"#version 330 core\n"
+	"flat in int glyph;\n"
+	"in vec2 FontPixel;\n"
+	"out vec4 color;\n"
+	"uniform sampler2D font;\n"
+	"void main()\n"
+	"{\n"
+	"   ivec2 p = ivec2(FontPixel);\n"
+	"   float lit = 0.0;\n"
+	"   if (p.x < 5 && p.y >= 1 && p.y < 8) {\n"
+	"       lit = texelFetch(font, ivec2(glyph * 5 + p.x, p.y - 1), 0).r;\n"
+	"   }\n"
+	"   color = mix(vec4(0.0, 0.0, 0.0, 0.65), vec4(1.0), lit);\n"
+	"}";
+
+static uint32_t build_program(const char* vertex_source, const char* fragment_source) {
 	GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertex_shader, 1, &vert_shad, NULL);
+	glShaderSource(vertex_shader, 1, &vertex_source, NULL);
 	glCompileShader(vertex_shader);
 
 	GLint vertex_shader_compile_status;
@@ -50,7 +131,7 @@ uint32_t get_shader(){
 	}
 
 	GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fragment_shader, 1, &frag_shad, NULL);
+	glShaderSource(fragment_shader, 1, &fragment_source, NULL);
 	glCompileShader(fragment_shader);
 
 	GLint fragment_shader_compile_status;
@@ -78,3 +159,14 @@ uint32_t get_shader(){
 	return shader_program;
 }
 
+uint32_t get_shader(){
+	return build_program(vert_shad, frag_shad);
+}
+
+uint32_t get_grid_shader() {
+	return build_program(grid_vert_shad, grid_frag_shad);
+}
+
+uint32_t get_hud_shader() {
+	return build_program(hud_vert_shad, hud_frag_shad);
+}
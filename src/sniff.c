@@ -0,0 +1,305 @@
+#include "sniff.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "trace.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#define O_CLOEXEC 0
+#else
+#define O_BINARY 0
+#endif
+
+#define MAX_SNIFF_THREADS 8
+// Below this many files per thread the threads cost more than they save
+#define FILES_PER_THREAD 64
+#define SNIFF_PATH_MAX 4096
+
+typedef struct extension_t {
+	const char* extension;
+	image_type_t type;
+} extension_t;
+
+static const extension_t extensions[] = {
+	{"png", TYPE_PNG}, {"jpg", TYPE_JPEG}, {"jpeg", TYPE_JPEG}, {"jpe", TYPE_JPEG}, {"gif", TYPE_GIF},
+	{"bmp", TYPE_BMP}, {"tga", TYPE_TGA}, {"psd", TYPE_PSD}, {"hdr", TYPE_HDR}, {"pic", TYPE_PIC},
+	{"pnm", TYPE_PNM}, {"ppm", TYPE_PNM}, {"pgm", TYPE_PNM},
+	// Never worth opening
+	{"txt", TYPE_NOT_IMAGE}, {"md", TYPE_NOT_IMAGE}, {"json", TYPE_NOT_IMAGE}, {"xml", TYPE_NOT_IMAGE},
+	{"xmp", TYPE_NOT_IMAGE}, {"html", TYPE_NOT_IMAGE}, {"log", TYPE_NOT_IMAGE}, {"pdf", TYPE_NOT_IMAGE},
+	{"zip", TYPE_NOT_IMAGE}, {"gz", TYPE_NOT_IMAGE}, {"tar", TYPE_NOT_IMAGE}, {"mp4", TYPE_NOT_IMAGE},
+	{"mov", TYPE_NOT_IMAGE}, {"mkv", TYPE_NOT_IMAGE}, {"avi", TYPE_NOT_IMAGE}, {"mp3", TYPE_NOT_IMAGE},
+	{"wav", TYPE_NOT_IMAGE}, {"part", TYPE_NOT_IMAGE}, {"tmp", TYPE_NOT_IMAGE}, {"swp", TYPE_NOT_IMAGE},
+};
+
+static bool equal_ignore_case(const char* a, const char* b) {
+	for (; *a != '\0' && *b != '\0'; a++, b++) {
+		char x = *a >= 'A' && *a <= 'Z' ? *a - 'A' + 'a' : *a;
+		if (x != *b) {
+			return false;
+		}
+	}
+	return *a == *b;
+}
+
+image_type_t sniff_extension(const char* name) {
+	const char* dot = strrchr(name, '.');
+	if (dot == NULL || dot == name) {
+		return TYPE_UNKNOWN;
+	}
+	for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+		if (equal_ignore_case(dot + 1, extensions[i].extension)) {
+			return extensions[i].type;
+		}
+	}
+	return TYPE_UNKNOWN;
+}
+
+static bool starts_with(const unsigned char* data, size_t size, const char* magic, size_t length) {
+	return size >= length && memcmp(data, magic, length) == 0;
+}
+
+image_type_t sniff_bytes(const unsigned char* data, size_t size) {
+	if (starts_with(data, size, "\x89PNG\r\n\x1a\n", 8)) {
+		return TYPE_PNG;
+	}
+	if (starts_with(data, size, "\xff\xd8\xff", 3)) {
+		return TYPE_JPEG;
+	}
+	if (starts_with(data, size, "GIF87a", 6) || starts_with(data, size, "GIF89a", 6)) {
+		return TYPE_GIF;
+	}
+	if (starts_with(data, size, "BM", 2) && size >= 14) {
+		return TYPE_BMP;
+	}
+	if (starts_with(data, size, "8BPS", 4)) {
+		return TYPE_PSD;
+	}
+	if (starts_with(data, size, "#?RADIANCE", 10) || starts_with(data, size, "#?RGBE", 6)) {
+		return TYPE_HDR;
+	}
+	if (starts_with(data, size, "\x53\x80\xf6\x34", 4)) {
+		return TYPE_PIC;
+	}
+	// stb only reads the binary variants
+	if (size >= 3 && data[0] == 'P' && (data[1] == '5' || data[1] == '6') &&
+	    (data[2] == ' ' || data[2] == '\t' || data[2] == '\n' || data[2] == '\r')) {
+		return TYPE_PNM;
+	}
+	return TYPE_NOT_IMAGE;
+}
+
+// Probe results keyed by a hash of the path, device/inode, size and modification time
+typedef struct sniff_entry_t {
+	uint64_t key;
+	uint64_t inode;
+	int64_t mtime;
+	int64_t size;
+	image_type_t type;
+} sniff_entry_t;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static sniff_entry_t* cache_entries = NULL;
+static size_t cache_capacity = 0;
+static size_t cache_count = 0;
+static sniff_stats_t stats = {0};
+
+static uint64_t hash_path(const char* directory, const char* name) {
+	uint64_t hash = 14695981039346656037ull;
+	for (const char* c = directory; *c != '\0'; c++) {
+		hash = (hash ^ (unsigned char)*c) * 1099511628211ull;
+	}
+	for (const char* c = name; *c != '\0'; c++) {
+		hash = (hash ^ (unsigned char)*c) * 1099511628211ull;
+	}
+	// 0 marks an empty slot
+	return hash != 0 ? hash : 1;
+}
+
+static int64_t stat_mtime(const struct stat* st) {
+#if defined(_WIN32) || defined(_WIN64)
+	return (int64_t)st->st_mtime * 1000000000;
+#else
+	return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+#endif
+}
+
+static sniff_entry_t* cache_slot(sniff_entry_t* entries, size_t capacity, uint64_t key) {
+	size_t i = key & (capacity - 1);
+	while (entries[i].key != 0 && entries[i].key != key) {
+		i = (i + 1) & (capacity - 1);
+	}
+	return &entries[i];
+}
+
+static bool cache_lookup(const sniff_entry_t* probe, image_type_t* type) {
+	pthread_mutex_lock(&cache_lock);
+	bool hit = false;
+	if (cache_capacity > 0) {
+		sniff_entry_t* entry = cache_slot(cache_entries, cache_capacity, probe->key);
+		if (entry->key == probe->key && entry->inode == probe->inode && entry->mtime == probe->mtime &&
+		    entry->size == probe->size) {
+			*type = entry->type;
+			hit = true;
+			stats.cache_hits++;
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return hit;
+}
+
+static void cache_store(const sniff_entry_t* probe) {
+	pthread_mutex_lock(&cache_lock);
+	stats.probes++;
+	// Keep the load under 3/4
+	if ((cache_count + 1) * 4 > cache_capacity * 3) {
+		size_t capacity = cache_capacity == 0 ? 1024 : cache_capacity * 2;
+		sniff_entry_t* entries = calloc(capacity, sizeof(sniff_entry_t));
+		if (entries == NULL) {
+			pthread_mutex_unlock(&cache_lock);
+			return;
+		}
+		for (size_t i = 0; i < cache_capacity; i++) {
+			if (cache_entries[i].key != 0) {
+				*cache_slot(entries, capacity, cache_entries[i].key) = cache_entries[i];
+			}
+		}
+		free(cache_entries);
+		cache_entries = entries;
+		cache_capacity = capacity;
+	}
+	sniff_entry_t* entry = cache_slot(cache_entries, cache_capacity, probe->key);
+	if (entry->key == 0) {
+		cache_count++;
+	}
+	*entry = *probe;
+	pthread_mutex_unlock(&cache_lock);
+}
+
+static image_type_t sniff_file(const char* directory, const char* name) {
+	char path[SNIFF_PATH_MAX];
+	if ((size_t)snprintf(path, sizeof(path), "%s%s", directory, name) >= sizeof(path)) {
+		return TYPE_NOT_IMAGE;
+	}
+	struct stat st;
+	// Never open FIFOs or devices, reading them could block forever
+	if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+		return TYPE_NOT_IMAGE;
+	}
+	sniff_entry_t probe = {
+		.key = hash_path(directory, name),
+		.inode = ((uint64_t)st.st_dev << 32) ^ (uint64_t)st.st_ino,
+		.mtime = stat_mtime(&st),
+		.size = st.st_size,
+	};
+	image_type_t type;
+	if (cache_lookup(&probe, &type)) {
+		return type;
+	}
+
+	unsigned char header[SNIFF_BYTES];
+	ssize_t size = -1;
+	int fd = open(path, O_RDONLY | O_BINARY | O_CLOEXEC);
+	if (fd >= 0) {
+		size = read(fd, header, sizeof(header));
+		close(fd);
+	}
+	probe.type = size > 0 ? sniff_bytes(header, size) : TYPE_NOT_IMAGE;
+	cache_store(&probe);
+	return probe.type;
+}
+
+typedef struct sniff_job_t {
+	const char* directory;
+	const char* const* names;
+	image_type_t* types;
+	size_t count;
+	size_t next;
+	pthread_mutex_t lock;
+} sniff_job_t;
+
+static void* sniff_worker(void* arg) {
+	sniff_job_t* job = arg;
+	for (;;) {
+		// Small chunks keep the threads busy when some files are slow to open
+		pthread_mutex_lock(&job->lock);
+		size_t start = job->next;
+		job->next += 16;
+		pthread_mutex_unlock(&job->lock);
+		if (start >= job->count) {
+			break;
+		}
+		size_t end = start + 16 < job->count ? start + 16 : job->count;
+		uint64_t span = trace_begin();
+		for (size_t i = start; i < end; i++) {
+			job->types[i] = sniff_file(job->directory, job->names[i]);
+		}
+		trace_end("sniff", span);
+	}
+	return NULL;
+}
+
+// Only spawned threads are named, the calling thread keeps its own name
+static void* sniff_thread(void* arg) {
+	trace_thread_name("sniff");
+	return sniff_worker(arg);
+}
+
+size_t sniff_threads() {
+	size_t cpus = cpu_count();
+	return cpus < MAX_SNIFF_THREADS ? cpus : MAX_SNIFF_THREADS;
+}
+
+void sniff_files(const char* directory, const char* const* names, size_t count, image_type_t* types, size_t threads) {
+	sniff_job_t job = {
+		.directory = directory,
+		.names = names,
+		.types = types,
+		.count = count,
+	};
+	pthread_mutex_init(&job.lock, NULL);
+	if (threads > count / FILES_PER_THREAD) {
+		threads = count / FILES_PER_THREAD;
+	}
+	if (threads > MAX_SNIFF_THREADS) {
+		threads = MAX_SNIFF_THREADS;
+	}
+
+	// The calling thread is one of the workers
+	pthread_t workers[MAX_SNIFF_THREADS];
+	size_t started = 0;
+	for (size_t i = 1; i < threads; i++) {
+		if (pthread_create(&workers[started], NULL, sniff_thread, &job) == 0) {
+			started++;
+		}
+	}
+	sniff_worker(&job);
+	for (size_t i = 0; i < started; i++) {
+		pthread_join(workers[i], NULL);
+	}
+	pthread_mutex_destroy(&job.lock);
+}
+
+sniff_stats_t sniff_stats() {
+	pthread_mutex_lock(&cache_lock);
+	sniff_stats_t result = stats;
+	pthread_mutex_unlock(&cache_lock);
+	return result;
+}
+
+void sniff_cache_clear() {
+	pthread_mutex_lock(&cache_lock);
+	free(cache_entries);
+	cache_entries = NULL;
+	cache_capacity = 0;
+	cache_count = 0;
+	stats = (sniff_stats_t){0};
+	pthread_mutex_unlock(&cache_lock);
+}
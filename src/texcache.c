@@ -0,0 +1,138 @@
+#include "texcache.h"
+
+#include <GL/glew.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "file_map.h"
+
+static void remove_entry(texture_cache_t* cache, size_t i) {
+	texture_entry_t* entry = &cache->entries[i];
+	glDeleteTextures(1, &entry->texture);
+	cache->resident_bytes -= entry->bytes;
+	free(entry->path);
+	cache->entries[i] = cache->entries[--cache->count];
+}
+
+// The displayed texture can't be deleted yet, it loses its path so lookups
+// skip it and is evicted like any other once something else is shown
+static void drop_entry(texture_cache_t* cache, size_t i) {
+	if (cache->entries[i].texture != cache->current) {
+		remove_entry(cache, i);
+		return;
+	}
+	free(cache->entries[i].path);
+	cache->entries[i].path = NULL;
+}
+
+static bool has_path(const texture_entry_t* entry, const char* path) {
+	return entry->path != NULL && strcmp(entry->path, path) == 0;
+}
+
+static void evict(texture_cache_t* cache, uint32_t keep) {
+	while (cache->resident_bytes > cache->budget) {
+		size_t oldest = cache->count;
+		for (size_t i = 0; i < cache->count; i++) {
+			if (cache->entries[i].texture == cache->current || cache->entries[i].texture == keep) {
+				continue;
+			}
+			if (oldest == cache->count || cache->entries[i].last_used < cache->entries[oldest].last_used) {
+				oldest = i;
+			}
+		}
+		// Only the displayed and the new texture are left, keep them even if they are over budget
+		if (oldest == cache->count) {
+			break;
+		}
+		remove_entry(cache, oldest);
+		cache->evictions++;
+	}
+}
+
+void texture_cache_init(texture_cache_t* cache, size_t budget) {
+	memset(cache, 0, sizeof(*cache));
+	cache->budget = budget;
+}
+
+void texture_cache_destroy(texture_cache_t* cache) {
+	while (cache->count > 0) {
+		remove_entry(cache, cache->count - 1);
+	}
+	free(cache->entries);
+	cache->entries = NULL;
+	cache->capacity = 0;
+}
+
+bool texture_cache_get(texture_cache_t* cache, const char* path, texture_entry_t* entry) {
+	for (size_t i = 0; i < cache->count; i++) {
+		if (!has_path(&cache->entries[i], path)) {
+			continue;
+		}
+		if (cache->entries[i].mtime != file_mtime(path)) {
+			// The file changed on disk, drop the stale texture
+			drop_entry(cache, i);
+			break;
+		}
+		cache->entries[i].last_used = ++cache->tick;
+		cache->current = cache->entries[i].texture;
+		cache->hits++;
+		*entry = cache->entries[i];
+		return true;
+	}
+	cache->misses++;
+	return false;
+}
+
+int texture_cache_put(texture_cache_t* cache, const char* path, const texture_entry_t* entry) {
+	for (size_t i = 0; i < cache->count; i++) {
+		if (has_path(&cache->entries[i], path)) {
+			drop_entry(cache, i);
+			break;
+		}
+	}
+
+	char* copy = strdup(path);
+	if (copy != NULL && cache->count == cache->capacity) {
+		size_t capacity = cache->capacity == 0 ? 16 : cache->capacity * 2;
+		texture_entry_t* entries = realloc(cache->entries, capacity * sizeof(texture_entry_t));
+		if (entries == NULL) {
+			free(copy);
+			copy = NULL;
+		} else {
+			cache->entries = entries;
+			cache->capacity = capacity;
+		}
+	}
+	if (copy == NULL) {
+		fprintf(stderr, "Failed to grow texture cache\n");
+		if (entry->texture != cache->current) {
+			glDeleteTextures(1, &entry->texture);
+		}
+		return -1;
+	}
+
+	texture_entry_t* added = &cache->entries[cache->count++];
+	*added = *entry;
+	added->path = copy;
+	added->last_used = ++cache->tick;
+	cache->resident_bytes += added->bytes;
+	evict(cache, added->texture);
+	return 0;
+}
+
+void texture_cache_invalidate(texture_cache_t* cache, const char* path) {
+	for (size_t i = 0; i < cache->count; i++) {
+		if (has_path(&cache->entries[i], path)) {
+			if (cache->entries[i].texture != cache->current) {
+				remove_entry(cache, i);
+			}
+			return;
+		}
+	}
+}
+
+void texture_cache_set_current(texture_cache_t* cache, uint32_t texture) {
+	cache->current = texture;
+	evict(cache, 0);
+}
@@ -0,0 +1,600 @@
+#include "thumbs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stb/stb_image.h>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb/stb_image_write.h>
+
+#include "cpu.h"
+#include "md5.h"
+#include "trace.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#define realpath(path, resolved) _fullpath(resolved, path, 0)
+#endif
+
+// A thumbnail is a few KB, anything this big isn't one
+#define MAX_THUMBNAIL_BYTES (4 * 1024 * 1024)
+#define INITIAL_JOBS 256
+
+typedef enum thumb_outcome_t {
+	THUMB_HIT,
+	THUMB_GENERATED,
+	THUMB_FAILED,
+	// Failed on an earlier scan, its marker is already written
+	THUMB_FAILED_BEFORE
+} thumb_outcome_t;
+
+static const unsigned char png_signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+// Characters GLib leaves alone in the path of a file URI, which the thumbnail names of other programs hash
+static bool is_uri_safe(unsigned char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+		(c != '\0' && strchr("!$&'()*+,-./:=@_~", c) != NULL);
+}
+
+char* thumbnail_uri(const char* path) {
+	char* absolute = realpath(path, NULL);
+	if (absolute == NULL) {
+		return NULL;
+	}
+	size_t length = strlen(absolute);
+	char* uri = malloc(sizeof("file://") + 3 * length);
+	if (uri != NULL) {
+		char* out = uri + sprintf(uri, "file://");
+		for (const char* c = absolute; *c != '\0'; c++) {
+			unsigned char byte = *c == '\\' ? '/' : (unsigned char)*c;
+			if (is_uri_safe(byte)) {
+				*out++ = byte;
+			} else {
+				out += sprintf(out, "%%%02X", byte);
+			}
+		}
+		*out = '\0';
+	}
+	free(absolute);
+	return uri;
+}
+
+char* thumbnail_cache_root() {
+	const char* cache = getenv("XDG_CACHE_HOME");
+	const char* suffix = "/thumbnails/";
+	// Relative values are invalid per the base directory spec
+	if (cache == NULL || cache[0] != '/') {
+		cache = getenv("HOME");
+		suffix = "/.cache/thumbnails/";
+	}
+	if (cache == NULL || cache[0] == '\0') {
+		return NULL;
+	}
+	char* root = malloc(strlen(cache) + strlen(suffix) + 1);
+	if (root != NULL) {
+		sprintf(root, "%s%s", cache, suffix);
+	}
+	return root;
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+static char* cache_subdir(const char* root, const char* name) {
+	(void)root;
+	(void)name;
+	return NULL;
+}
+#else
+// Creates root/name/ and its parents, private to the user as the spec asks
+static char* cache_subdir(const char* root, const char* name) {
+	char* dir = malloc(strlen(root) + strlen(name) + 2);
+	if (dir == NULL) {
+		return NULL;
+	}
+	sprintf(dir, "%s%s/", root, name);
+	for (char* c = dir + 1; *c != '\0'; c++) {
+		if (*c != '/') {
+			continue;
+		}
+		*c = '\0';
+		struct stat st;
+		bool exists = stat(dir, &st) == 0 && S_ISDIR(st.st_mode);
+		if (!exists && mkdir(dir, 0700) != 0) {
+			fprintf(stderr, "Could not create thumbnail directory %s\n", dir);
+			free(dir);
+			return NULL;
+		}
+		*c = '/';
+	}
+	return dir;
+}
+#endif
+
+// Small files are read whole, missing ones are the common case and not worth a message
+static unsigned char* read_small_file(const char* path, size_t* size) {
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) {
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	long length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	unsigned char* data = length > 0 && length <= MAX_THUMBNAIL_BYTES ? malloc(length) : NULL;
+	if (data != NULL && fread(data, 1, length, file) != (size_t)length) {
+		free(data);
+		data = NULL;
+	}
+	fclose(file);
+	*size = length;
+	return data;
+}
+
+static uint32_t read_be32(const unsigned char* data) {
+	return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+}
+
+static void write_be32(unsigned char* data, uint32_t value) {
+	data[0] = value >> 24;
+	data[1] = value >> 16;
+	data[2] = value >> 8;
+	data[3] = value;
+}
+
+// The thumbnail is only valid for the file it was made from, as it was when it was made
+static bool thumbnail_matches(const unsigned char* data, size_t size, const char* uri, int64_t mtime) {
+	if (size < sizeof(png_signature) || memcmp(data, png_signature, sizeof(png_signature)) != 0) {
+		return false;
+	}
+	bool uri_matches = false;
+	bool mtime_matches = false;
+	size_t uri_length = strlen(uri);
+	// Other thumbnailers may put the text after the image data, so look at every chunk
+	for (size_t pos = sizeof(png_signature); pos + 12 <= size;) {
+		uint32_t length = read_be32(data + pos);
+		if (length > size - pos - 12) {
+			break;
+		}
+		const char* text = (const char*)data + pos + 8;
+		if (memcmp(data + pos + 4, "tEXt", 4) == 0) {
+			size_t keyword = strnlen(text, length);
+			const char* value = text + keyword + 1;
+			size_t value_length = keyword < length ? length - keyword - 1 : 0;
+			if (keyword == sizeof("Thumb::URI") - 1 && memcmp(text, "Thumb::URI", keyword) == 0) {
+				uri_matches = value_length == uri_length && memcmp(value, uri, uri_length) == 0;
+			} else if (keyword == sizeof("Thumb::MTime") - 1 && memcmp(text, "Thumb::MTime", keyword) == 0 &&
+			           value_length < 32) {
+				char number[32];
+				memcpy(number, value, value_length);
+				number[value_length] = '\0';
+				mtime_matches = strtoll(number, NULL, 10) == mtime;
+			}
+		}
+		pos += 12 + length;
+	}
+	return uri_matches && mtime_matches;
+}
+
+static int load_thumbnail(const char* thumb_path, const char* uri, int64_t mtime, image_t* image) {
+	size_t size;
+	unsigned char* data = read_small_file(thumb_path, &size);
+	if (data == NULL) {
+		return -1;
+	}
+	if (!thumbnail_matches(data, size, uri, mtime)) {
+		free(data);
+		return -1;
+	}
+	int w, h, channels;
+	stbi_set_flip_vertically_on_load_thread(1);
+	unsigned char* pixels = stbi_load_from_memory(data, (int)size, &w, &h, &channels, 0);
+	free(data);
+	if (pixels == NULL || image_format(channels) == 0) {
+		stbi_image_free(pixels);
+		return -1;
+	}
+	memset(image, 0, sizeof(*image));
+	image->pixels = pixels;
+	image->width = w;
+	image->height = h;
+	image->channels = channels;
+	image->full_width = w;
+	image->full_height = h;
+	return 0;
+}
+
+static bool fail_recorded(const char* fail_path, const char* uri, int64_t mtime) {
+	size_t size;
+	unsigned char* data = read_small_file(fail_path, &size);
+	bool recorded = data != NULL && thumbnail_matches(data, size, uri, mtime);
+	free(data);
+	return recorded;
+}
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void build_crc_table() {
+	for (uint32_t n = 0; n < 256; n++) {
+		uint32_t c = n;
+		for (int k = 0; k < 8; k++) {
+			c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		}
+		crc_table[n] = c;
+	}
+}
+
+static uint32_t png_crc(const unsigned char* data, size_t size) {
+	pthread_once(&crc_once, build_crc_table);
+	uint32_t crc = 0xffffffff;
+	for (size_t i = 0; i < size; i++) {
+		crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return crc ^ 0xffffffff;
+}
+
+typedef struct text_chunk_t {
+	const char* keyword;
+	char value[4096 * 3 + 16];
+} text_chunk_t;
+
+// Writes through a temporary file and a rename, so readers never see half a thumbnail
+static int write_file_atomic(const char* path, const unsigned char* data, size_t size) {
+	char* temp = malloc(strlen(path) + sizeof(".XXXXXX"));
+	if (temp == NULL) {
+		return -1;
+	}
+	sprintf(temp, "%s.XXXXXX", path);
+#if defined(_WIN32) || defined(_WIN64)
+	int result = -1;
+	(void)data;
+	(void)size;
+#else
+	int fd = mkstemp(temp);
+	int result = fd >= 0 ? 0 : -1;
+	if (fd >= 0) {
+		if (fchmod(fd, 0600) != 0 || write(fd, data, size) != (ssize_t)size) {
+			result = -1;
+		}
+		close(fd);
+		if (result == 0 && rename(temp, path) != 0) {
+			result = -1;
+		}
+		if (result != 0) {
+			unlink(temp);
+		}
+	}
+#endif
+	free(temp);
+	return result;
+}
+
+// stb writes the pixels, the tEXt chunks the spec needs go in right after IHDR
+static int save_thumbnail(const char* thumb_path, const unsigned char* pixels, int32_t width, int32_t height,
+                          int32_t channels, const text_chunk_t* texts, size_t text_count) {
+	int png_size;
+	unsigned char* png = stbi_write_png_to_mem(pixels, width * channels, width, height, channels, &png_size);
+	// Signature and IHDR
+	const size_t header_size = sizeof(png_signature) + 25;
+	if (png == NULL || (size_t)png_size < header_size) {
+		free(png);
+		return -1;
+	}
+	size_t extra = 0;
+	for (size_t i = 0; i < text_count; i++) {
+		extra += 12 + strlen(texts[i].keyword) + 1 + strlen(texts[i].value);
+	}
+	unsigned char* file = malloc(png_size + extra);
+	if (file == NULL) {
+		free(png);
+		return -1;
+	}
+	memcpy(file, png, header_size);
+	unsigned char* out = file + header_size;
+	for (size_t i = 0; i < text_count; i++) {
+		size_t keyword = strlen(texts[i].keyword);
+		size_t value = strlen(texts[i].value);
+		write_be32(out, (uint32_t)(keyword + 1 + value));
+		memcpy(out + 4, "tEXt", 4);
+		memcpy(out + 8, texts[i].keyword, keyword + 1);
+		memcpy(out + 8 + keyword + 1, texts[i].value, value);
+		write_be32(out + 8 + keyword + 1 + value, png_crc(out + 4, 4 + keyword + 1 + value));
+		out += 12 + keyword + 1 + value;
+	}
+	memcpy(out, png + header_size, png_size - header_size);
+	free(png);
+	int result = write_file_atomic(thumb_path, file, png_size + extra);
+	free(file);
+	return result;
+}
+
+// Box filter down to fit THUMB_SIZE, written top down the way PNG stores rows
+static int scale_thumbnail(const image_t* image, image_t* thumb) {
+	int32_t w = image->width;
+	int32_t h = image->height;
+	int32_t channels = image->channels;
+	int32_t tw = w, th = h;
+	if (w >= h && w > THUMB_SIZE) {
+		tw = THUMB_SIZE;
+		th = (int32_t)((int64_t)h * THUMB_SIZE / w);
+	} else if (h > w && h > THUMB_SIZE) {
+		th = THUMB_SIZE;
+		tw = (int32_t)((int64_t)w * THUMB_SIZE / h);
+	}
+	tw = tw > 0 ? tw : 1;
+	th = th > 0 ? th : 1;
+	unsigned char* pixels = malloc((size_t)tw * th * channels);
+	if (pixels == NULL) {
+		return -1;
+	}
+	for (int32_t ty = 0; ty < th; ty++) {
+		int32_t y0 = (int32_t)((int64_t)ty * h / th);
+		int32_t y1 = (int32_t)((int64_t)(ty + 1) * h / th);
+		// The decoded image is bottom up
+		unsigned char* row = pixels + (size_t)(th - 1 - ty) * tw * channels;
+		for (int32_t tx = 0; tx < tw; tx++) {
+			int32_t x0 = (int32_t)((int64_t)tx * w / tw);
+			int32_t x1 = (int32_t)((int64_t)(tx + 1) * w / tw);
+			uint32_t sums[4] = {0};
+			for (int32_t y = y0; y < y1; y++) {
+				const unsigned char* src = image->pixels + ((size_t)y * w + x0) * channels;
+				for (int32_t x = x0; x < x1; x++, src += channels) {
+					for (int32_t c = 0; c < channels; c++) {
+						sums[c] += src[c];
+					}
+				}
+			}
+			uint32_t count = (uint32_t)(y1 - y0) * (uint32_t)(x1 - x0);
+			for (int32_t c = 0; c < channels; c++) {
+				row[tx * channels + c] = (unsigned char)((sums[c] + count / 2) / count);
+			}
+		}
+	}
+	memset(thumb, 0, sizeof(*thumb));
+	thumb->pixels = pixels;
+	thumb->width = tw;
+	thumb->height = th;
+	thumb->channels = channels;
+	thumb->full_width = image->full_width;
+	thumb->full_height = image->full_height;
+	return 0;
+}
+
+// Rows the other way round, in place
+static void flip_rows(image_t* image) {
+	size_t stride = (size_t)image->width * image->channels;
+	unsigned char* top = image->pixels;
+	unsigned char* bottom = image->pixels + (image->height - 1) * stride;
+	for (; top < bottom; top += stride, bottom -= stride) {
+		for (size_t i = 0; i < stride; i++) {
+			unsigned char temp = top[i];
+			top[i] = bottom[i];
+			bottom[i] = temp;
+		}
+	}
+}
+
+static thumb_outcome_t make_thumbnail(const thumbnailer_t* thumbnailer, const char* path, image_t* thumb) {
+	struct stat st;
+	char* uri = NULL;
+	if (stat(path, &st) != 0 || (uri = thumbnail_uri(path)) == NULL) {
+		return THUMB_FAILED;
+	}
+	int64_t mtime = (int64_t)st.st_mtime;
+	char name[33];
+	md5_hex(uri, strlen(uri), name);
+	char* thumb_path = NULL;
+	char* fail_path = NULL;
+	if (thumbnailer->cache_dir != NULL) {
+		thumb_path = malloc(strlen(thumbnailer->cache_dir) + sizeof(name) + sizeof(".png"));
+		fail_path = malloc(strlen(thumbnailer->fail_dir) + sizeof(name) + sizeof(".png"));
+		if (thumb_path != NULL && fail_path != NULL) {
+			sprintf(thumb_path, "%s%s.png", thumbnailer->cache_dir, name);
+			sprintf(fail_path, "%s%s.png", thumbnailer->fail_dir, name);
+		}
+	}
+
+	thumb_outcome_t outcome;
+	image_t image = {0};
+	if (thumb_path != NULL && fail_path != NULL && load_thumbnail(thumb_path, uri, mtime, thumb) == 0) {
+		outcome = THUMB_HIT;
+	} else if (thumb_path != NULL && fail_path != NULL && fail_recorded(fail_path, uri, mtime)) {
+		outcome = THUMB_FAILED_BEFORE;
+	} else if (decode_image(path, THUMB_SIZE, THUMB_SIZE, &image) == 0 && image_to_unorm8(&image) == 0 &&
+	           scale_thumbnail(&image, thumb) == 0) {
+		outcome = THUMB_GENERATED;
+	} else {
+		outcome = THUMB_FAILED;
+	}
+	free_image(&image);
+
+	if ((outcome == THUMB_GENERATED || outcome == THUMB_FAILED) && thumb_path != NULL && fail_path != NULL) {
+		text_chunk_t texts[6] = {
+			{"Thumb::URI", ""},
+			{"Thumb::MTime", ""},
+			{"Thumb::Size", ""},
+			{"Software", "imeye"},
+			{"Thumb::Image::Width", ""},
+			{"Thumb::Image::Height", ""},
+		};
+		snprintf(texts[0].value, sizeof(texts[0].value), "%s", uri);
+		snprintf(texts[1].value, sizeof(texts[1].value), "%lld", (long long)mtime);
+		snprintf(texts[2].value, sizeof(texts[2].value), "%lld", (long long)st.st_size);
+		if (outcome == THUMB_GENERATED) {
+			snprintf(texts[4].value, sizeof(texts[4].value), "%d", thumb->full_width);
+			snprintf(texts[5].value, sizeof(texts[5].value), "%d", thumb->full_height);
+			save_thumbnail(thumb_path, thumb->pixels, thumb->width, thumb->height, thumb->channels, texts, 6);
+			// Handed out bottom up like everything else decode_image() makes
+			flip_rows(thumb);
+		} else {
+			// Recorded so the next scan doesn't try to decode it again
+			const unsigned char empty[4] = {0};
+			save_thumbnail(fail_path, empty, 1, 1, 4, texts, 4);
+		}
+	} else if (outcome == THUMB_GENERATED) {
+		flip_rows(thumb);
+	}
+	free(thumb_path);
+	free(fail_path);
+	free(uri);
+	return outcome;
+}
+
+static void* thumb_worker(void* arg) {
+	thumbnailer_t* thumbnailer = arg;
+	trace_thread_name("thumbnail");
+	pthread_mutex_lock(&thumbnailer->lock);
+	while (!thumbnailer->cancel) {
+		if (thumbnailer->job_count == 0) {
+			pthread_cond_wait(&thumbnailer->wake, &thumbnailer->lock);
+			continue;
+		}
+		thumb_job_t job = thumbnailer->jobs[--thumbnailer->job_count];
+		pthread_mutex_unlock(&thumbnailer->lock);
+
+		thumb_result_t result = {.path = job.path, .tag = job.tag};
+		uint64_t start = trace_begin();
+		thumb_outcome_t outcome = make_thumbnail(thumbnailer, job.path, &result.image);
+		trace_end(outcome == THUMB_HIT ? "thumbnail_hit" : "thumbnail", start);
+		result.hit = outcome == THUMB_HIT;
+
+		pthread_mutex_lock(&thumbnailer->lock);
+		if (outcome == THUMB_HIT) {
+			thumbnailer->hits++;
+		} else if (outcome == THUMB_GENERATED) {
+			thumbnailer->generated++;
+		} else {
+			thumbnailer->failed++;
+		}
+		if (thumbnailer->result_count == thumbnailer->result_capacity) {
+			size_t capacity = thumbnailer->result_capacity == 0 ? INITIAL_JOBS : thumbnailer->result_capacity * 2;
+			thumb_result_t* results = realloc(thumbnailer->results, capacity * sizeof(thumb_result_t));
+			if (results == NULL) {
+				thumb_result_free(&result);
+				continue;
+			}
+			thumbnailer->results = results;
+			thumbnailer->result_capacity = capacity;
+		}
+		thumbnailer->results[thumbnailer->result_count++] = result;
+		pthread_mutex_unlock(&thumbnailer->lock);
+		if (thumbnailer->notify != NULL) {
+			thumbnailer->notify();
+		}
+		pthread_mutex_lock(&thumbnailer->lock);
+	}
+	pthread_mutex_unlock(&thumbnailer->lock);
+	return NULL;
+}
+
+int thumbnailer_init(thumbnailer_t* thumbnailer, size_t threads, void (*notify)(void)) {
+	memset(thumbnailer, 0, sizeof(*thumbnailer));
+	if (threads == 0) {
+		threads = cpu_count();
+	}
+	char* root = thumbnail_cache_root();
+	if (root != NULL) {
+		thumbnailer->cache_dir = cache_subdir(root, "normal");
+		thumbnailer->fail_dir = cache_subdir(root, "fail/imeye");
+		free(root);
+	}
+	if (thumbnailer->cache_dir == NULL || thumbnailer->fail_dir == NULL) {
+		fprintf(stderr, "Thumbnails won't be cached\n");
+		free(thumbnailer->cache_dir);
+		free(thumbnailer->fail_dir);
+		thumbnailer->cache_dir = NULL;
+		thumbnailer->fail_dir = NULL;
+	}
+
+	thumbnailer->notify = notify;
+	thumbnailer->threads = calloc(threads, sizeof(pthread_t));
+	if (thumbnailer->threads == NULL) {
+		return -1;
+	}
+	pthread_mutex_init(&thumbnailer->lock, NULL);
+	pthread_cond_init(&thumbnailer->wake, NULL);
+	for (size_t i = 0; i < threads; i++) {
+		if (pthread_create(&thumbnailer->threads[thumbnailer->thread_count], NULL, thumb_worker, thumbnailer) == 0) {
+			thumbnailer->thread_count++;
+		}
+	}
+	if (thumbnailer->thread_count == 0) {
+		fprintf(stderr, "Failed to start thumbnail threads\n");
+		thumbnailer_destroy(thumbnailer);
+		return -1;
+	}
+	return 0;
+}
+
+void thumbnailer_destroy(thumbnailer_t* thumbnailer) {
+	if (thumbnailer->threads == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&thumbnailer->lock);
+	thumbnailer->cancel = true;
+	pthread_cond_broadcast(&thumbnailer->wake);
+	pthread_mutex_unlock(&thumbnailer->lock);
+	for (size_t i = 0; i < thumbnailer->thread_count; i++) {
+		pthread_join(thumbnailer->threads[i], NULL);
+	}
+	thumbnailer_cancel_pending(thumbnailer);
+	for (size_t i = 0; i < thumbnailer->result_count; i++) {
+		thumb_result_free(&thumbnailer->results[i]);
+	}
+	free(thumbnailer->jobs);
+	free(thumbnailer->results);
+	free(thumbnailer->threads);
+	free(thumbnailer->cache_dir);
+	free(thumbnailer->fail_dir);
+	pthread_cond_destroy(&thumbnailer->wake);
+	pthread_mutex_destroy(&thumbnailer->lock);
+	thumbnailer->threads = NULL;
+}
+
+int thumbnailer_request(thumbnailer_t* thumbnailer, const char* path, uint64_t tag) {
+	char* copy = strdup(path);
+	if (copy == NULL) {
+		return -1;
+	}
+	pthread_mutex_lock(&thumbnailer->lock);
+	if (thumbnailer->job_count == thumbnailer->job_capacity) {
+		size_t capacity = thumbnailer->job_capacity == 0 ? INITIAL_JOBS : thumbnailer->job_capacity * 2;
+		thumb_job_t* jobs = realloc(thumbnailer->jobs, capacity * sizeof(thumb_job_t));
+		if (jobs == NULL) {
+			pthread_mutex_unlock(&thumbnailer->lock);
+			free(copy);
+			return -1;
+		}
+		thumbnailer->jobs = jobs;
+		thumbnailer->job_capacity = capacity;
+	}
+	thumbnailer->jobs[thumbnailer->job_count++] = (thumb_job_t){.path = copy, .tag = tag};
+	pthread_cond_signal(&thumbnailer->wake);
+	pthread_mutex_unlock(&thumbnailer->lock);
+	return 0;
+}
+
+void thumbnailer_cancel_pending(thumbnailer_t* thumbnailer) {
+	pthread_mutex_lock(&thumbnailer->lock);
+	for (size_t i = 0; i < thumbnailer->job_count; i++) {
+		free(thumbnailer->jobs[i].path);
+	}
+	thumbnailer->job_count = 0;
+	pthread_mutex_unlock(&thumbnailer->lock);
+}
+
+bool thumbnailer_poll(thumbnailer_t* thumbnailer, thumb_result_t* result) {
+	pthread_mutex_lock(&thumbnailer->lock);
+	bool ready = thumbnailer->result_count > 0;
+	if (ready) {
+		*result = thumbnailer->results[--thumbnailer->result_count];
+	}
+	pthread_mutex_unlock(&thumbnailer->lock);
+	return ready;
+}
+
+void thumb_result_free(thumb_result_t* result) {
+	free(result->path);
+	result->path = NULL;
+	free_image(&result->image);
+}
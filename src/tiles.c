@@ -0,0 +1,252 @@
+#include "tiles.h"
+
+#include <GL/glew.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mipmap.h"
+
+static int max_texture_size() {
+	GLint size = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &size);
+	return size;
+}
+
+bool needs_tiling(const image_t* image) {
+	int max_size = max_texture_size();
+	if (image->width > max_size || image->height > max_size) {
+		return true;
+	}
+	return (size_t)image->width * image->height > TILED_MIN_PIXELS;
+}
+
+static void free_level(tile_level_t* level) {
+	if (level->textures != NULL) {
+		for (int32_t i = 0; i < level->columns * level->rows; i++) {
+			if (level->textures[i] != 0) {
+				glDeleteTextures(1, &level->textures[i]);
+			}
+		}
+		free(level->textures);
+	}
+	level->textures = NULL;
+}
+
+int tiled_image_init(tiled_image_t* tiled, image_t* image) {
+	memset(tiled, 0, sizeof(*tiled));
+	tiled->width = image->width;
+	tiled->height = image->height;
+	tiled->image = *image;
+	image->pixels = NULL;
+	image->mips = NULL;
+	image->mip_count = 0;
+	// Normally built on the prefetch thread already
+	if (tiled->image.mip_count == 0 && build_mipmaps(&tiled->image) != 0) {
+		fprintf(stderr, "Failed to build tile levels\n");
+		free_image(&tiled->image);
+		return -1;
+	}
+
+	// Levels down to the first one that fits in a single tile
+	for (int32_t i = 0; i <= tiled->image.mip_count && i < MAX_TILE_LEVELS; i++) {
+		tile_level_t* level = &tiled->levels[tiled->level_count++];
+		level->image = image_level(&tiled->image, i);
+		level->columns = (level->image->width + TILE_STRIDE - 1) / TILE_STRIDE;
+		level->rows = (level->image->height + TILE_STRIDE - 1) / TILE_STRIDE;
+		level->textures = calloc((size_t)level->columns * level->rows, sizeof(uint32_t));
+		if (level->textures == NULL) {
+			tiled_image_destroy(tiled);
+			return -1;
+		}
+		if (level->columns == 1 && level->rows == 1) {
+			break;
+		}
+	}
+	return 0;
+}
+
+void tiled_image_destroy(tiled_image_t* tiled) {
+	for (int32_t i = 0; i < tiled->level_count; i++) {
+		free_level(&tiled->levels[i]);
+	}
+	free_image(&tiled->image);
+	tiled->level_count = 0;
+	tiled->resident_bytes = 0;
+}
+
+// Texels the tile is drawn over, x0 y0 x1 y1 in the level
+static void tile_texels(const tile_level_t* level, int32_t column, int32_t row, int32_t texels[4]) {
+	texels[0] = column * TILE_STRIDE;
+	texels[1] = row * TILE_STRIDE;
+	texels[2] = texels[0] + TILE_STRIDE < level->image->width ? texels[0] + TILE_STRIDE : level->image->width;
+	texels[3] = texels[1] + TILE_STRIDE < level->image->height ? texels[1] + TILE_STRIDE : level->image->height;
+}
+
+// The same grown by the overlap with the neighbouring tiles, what the texture holds
+static void tile_extent(const tile_level_t* level, int32_t column, int32_t row, int32_t extent[4]) {
+	tile_texels(level, column, row, extent);
+	extent[0] = extent[0] > 0 ? extent[0] - 1 : 0;
+	extent[1] = extent[1] > 0 ? extent[1] - 1 : 0;
+	extent[2] = extent[2] < level->image->width ? extent[2] + 1 : extent[2];
+	extent[3] = extent[3] < level->image->height ? extent[3] + 1 : extent[3];
+}
+
+static size_t tile_bytes(const tile_level_t* level, int32_t column, int32_t row) {
+	int32_t extent[4];
+	tile_extent(level, column, row, extent);
+	return (size_t)(extent[2] - extent[0]) * (extent[3] - extent[1]) * pixel_size(level->image);
+}
+
+static void upload_tile(tiled_image_t* tiled, tile_level_t* level, int32_t column, int32_t row) {
+	const image_t* image = level->image;
+	int32_t extent[4];
+	tile_extent(level, column, row, extent);
+	int32_t x = extent[0];
+	int32_t y = extent[1];
+	int32_t w = extent[2] - extent[0];
+	int32_t h = extent[3] - extent[1];
+	GLenum format = image_format(image->channels);
+
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+	// Upload straight out of the full image instead of copying the tile out first
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, image->width);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, x);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, y);
+	glTexImage2D(GL_TEXTURE_2D, 0, internal_format(image), w, h, 0, format, pixel_type(image), image->pixels);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+
+	level->textures[row * level->columns + column] = texture;
+	tiled->resident_bytes += tile_bytes(level, column, row);
+}
+
+static void evict_tile(tiled_image_t* tiled, tile_level_t* level, int32_t column, int32_t row) {
+	uint32_t* texture = &level->textures[row * level->columns + column];
+	if (*texture == 0) {
+		return;
+	}
+	glDeleteTextures(1, texture);
+	*texture = 0;
+	tiled->resident_bytes -= tile_bytes(level, column, row);
+}
+
+// Tile rectangle in the normalized device coordinates of the image viewport
+static void tile_rect(const tile_level_t* level, int32_t column, int32_t row, float rect[4]) {
+	int32_t texels[4];
+	tile_texels(level, column, row, texels);
+	float x0 = (float)texels[0] / level->image->width;
+	float y0 = (float)texels[1] / level->image->height;
+	float x1 = (float)texels[2] / level->image->width;
+	float y1 = (float)texels[3] / level->image->height;
+	rect[0] = x0 * 2.0f - 1.0f;
+	rect[1] = y0 * 2.0f - 1.0f;
+	rect[2] = x1 * 2.0f - 1.0f;
+	rect[3] = y1 * 2.0f - 1.0f;
+}
+
+// Whether the tile, rotated like the vertex shader does it, lands within margin pixels of the window
+static bool tile_visible(const tile_view_t* view, const float rect[4], float margin) {
+	int32_t rotation = ((view->rotation % 360) + 360) % 360;
+	float x0 = rect[0], y0 = rect[1], x1 = rect[2], y1 = rect[3];
+	float rx0, ry0, rx1, ry1;
+	switch (rotation) {
+		case 90:
+			rx0 = -y1, rx1 = -y0, ry0 = x0, ry1 = x1;
+			break;
+		case 180:
+			rx0 = -x1, rx1 = -x0, ry0 = -y1, ry1 = -y0;
+			break;
+		case 270:
+			rx0 = y0, rx1 = y1, ry0 = -x1, ry1 = -x0;
+			break;
+		default:
+			rx0 = x0, rx1 = x1, ry0 = y0, ry1 = y1;
+			break;
+	}
+	float wx0 = view->x + (rx0 + 1.0f) * 0.5f * view->width;
+	float wx1 = view->x + (rx1 + 1.0f) * 0.5f * view->width;
+	float wy0 = view->y + (ry0 + 1.0f) * 0.5f * view->height;
+	float wy1 = view->y + (ry1 + 1.0f) * 0.5f * view->height;
+	return wx1 >= -margin && wx0 <= view->fb_width + margin && wy1 >= -margin && wy0 <= view->fb_height + margin;
+}
+
+static int32_t pick_level(const tiled_image_t* tiled, const tile_view_t* view) {
+	int32_t rotation = ((view->rotation % 360) + 360) % 360;
+	int32_t on_screen = rotation == 90 || rotation == 270 ? view->height : view->width;
+	int32_t level = 0;
+	// Coarsest level that still has at least one texel per screen pixel
+	while (level + 1 < tiled->level_count && tiled->levels[level + 1].image->width >= on_screen) {
+		level++;
+	}
+	return level;
+}
+
+// The quad covers the tile's own texels, its texture coordinates are inset past the overlap
+static void draw_tile(tile_level_t* level, int32_t column, int32_t row, int32_t tile_uniform, int32_t tile_uv_uniform) {
+	float rect[4];
+	tile_rect(level, column, row, rect);
+	int32_t texels[4], extent[4];
+	tile_texels(level, column, row, texels);
+	tile_extent(level, column, row, extent);
+	float width = (float)(extent[2] - extent[0]);
+	float height = (float)(extent[3] - extent[1]);
+	glBindTexture(GL_TEXTURE_2D, level->textures[row * level->columns + column]);
+	glUniform4f(tile_uniform, (rect[0] + rect[2]) * 0.5f, (rect[1] + rect[3]) * 0.5f, (rect[2] - rect[0]) * 0.5f,
+		    (rect[3] - rect[1]) * 0.5f);
+	glUniform4f(tile_uv_uniform, (texels[0] - extent[0]) / width, (texels[1] - extent[1]) / height,
+		    (texels[2] - texels[0]) / width, (texels[3] - texels[1]) / height);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+}
+
+bool draw_tiled_image(tiled_image_t* tiled, const tile_view_t* view, int32_t tile_uniform, int32_t tile_uv_uniform) {
+	int32_t coarsest = tiled->level_count - 1;
+	tile_level_t* fallback = &tiled->levels[coarsest];
+	if (fallback->textures[0] == 0) {
+		upload_tile(tiled, fallback, 0, 0);
+	}
+	draw_tile(fallback, 0, 0, tile_uniform, tile_uv_uniform);
+
+	int32_t current = pick_level(tiled, view);
+	int32_t uploads = 0;
+	bool missing = false;
+	for (int32_t i = 0; i < coarsest; i++) {
+		tile_level_t* level = &tiled->levels[i];
+		for (int32_t row = 0; row < level->rows; row++) {
+			for (int32_t column = 0; column < level->columns; column++) {
+				float rect[4];
+				tile_rect(level, column, row, rect);
+				// Keep a one tile margin resident so small pans don't reupload
+				bool keep = i == current && tile_visible(view, rect, TILE_SIZE);
+				if (!keep) {
+					evict_tile(tiled, level, column, row);
+					continue;
+				}
+				if (!tile_visible(view, rect, 0.0f)) {
+					continue;
+				}
+				if (level->textures[row * level->columns + column] == 0) {
+					if (uploads == TILE_UPLOADS_PER_FRAME) {
+						missing = true;
+						continue;
+					}
+					upload_tile(tiled, level, column, row);
+					uploads++;
+				}
+				draw_tile(level, column, row, tile_uniform, tile_uv_uniform);
+			}
+		}
+	}
+	glUniform4f(tile_uniform, 0.0f, 0.0f, 1.0f, 1.0f);
+	glUniform4f(tile_uv_uniform, 0.0f, 0.0f, 1.0f, 1.0f);
+	return missing;
+}
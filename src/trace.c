@@ -0,0 +1,245 @@
+#include "trace.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct trace_event_t {
+	const char* name;
+	uint64_t start;
+	uint64_t end;
+} trace_event_t;
+
+// Written only by its own thread. count only grows, the dump reads the events
+// below it, so a thread still recording at worst loses a few to overwrites.
+// When the thread exits the buffer is released and the next thread with the
+// same name carries on in it, so short lived workers reuse a few buffers and
+// tids instead of each leaving one behind.
+typedef struct trace_buffer_t {
+	struct trace_buffer_t* next;
+	const char* name;
+	uint32_t tid;
+	bool released;
+	_Atomic uint64_t count;
+	trace_event_t events[TRACE_EVENTS];
+} trace_buffer_t;
+
+bool trace_enabled = false;
+
+static char* trace_path = NULL;
+static uint64_t trace_origin = 0;
+// Every thread's buffer, guarded by lock, which a dump holds throughout
+static trace_buffer_t* buffers = NULL;
+static uint32_t next_tid = 1;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread trace_buffer_t* thread_buffer = NULL;
+// Its destructor releases the buffer of an exiting thread
+static pthread_key_t buffer_key;
+
+#ifndef _WIN32
+static pthread_t signal_thread;
+static bool signal_thread_running = false;
+static atomic_bool stopping = false;
+
+static void* wait_for_signal(void* arg) {
+	sigset_t* set = arg;
+	for (;;) {
+		int signal;
+		if (sigwait(set, &signal) != 0 || atomic_load(&stopping)) {
+			break;
+		}
+		trace_dump();
+	}
+	return NULL;
+}
+#endif
+
+uint64_t trace_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void release_buffer(void* arg) {
+	trace_buffer_t* buffer = arg;
+	pthread_mutex_lock(&lock);
+	buffer->released = true;
+	pthread_mutex_unlock(&lock);
+}
+
+static bool same_name(const char* a, const char* b) {
+	return a == b || (a != NULL && b != NULL && strcmp(a, b) == 0);
+}
+
+// name is NULL for a thread that records before naming itself
+static trace_buffer_t* get_buffer(const char* name) {
+	if (thread_buffer != NULL) {
+		return thread_buffer;
+	}
+	pthread_mutex_lock(&lock);
+	trace_buffer_t* buffer = buffers;
+	while (buffer != NULL && !(buffer->released && same_name(buffer->name, name))) {
+		buffer = buffer->next;
+	}
+	if (buffer != NULL) {
+		buffer->released = false;
+	} else {
+		buffer = calloc(1, sizeof(trace_buffer_t));
+		if (buffer == NULL) {
+			pthread_mutex_unlock(&lock);
+			return NULL;
+		}
+		buffer->name = name;
+		buffer->tid = next_tid++;
+		buffer->next = buffers;
+		buffers = buffer;
+	}
+	pthread_mutex_unlock(&lock);
+	thread_buffer = buffer;
+	pthread_setspecific(buffer_key, buffer);
+	return buffer;
+}
+
+void trace_record(const char* name, uint64_t start, uint64_t end) {
+	trace_buffer_t* buffer = get_buffer(NULL);
+	if (buffer == NULL) {
+		return;
+	}
+	uint64_t count = atomic_load_explicit(&buffer->count, memory_order_relaxed);
+	trace_event_t* event = &buffer->events[count % TRACE_EVENTS];
+	event->name = name;
+	event->start = start;
+	event->end = end;
+	atomic_store_explicit(&buffer->count, count + 1, memory_order_release);
+}
+
+void trace_set_thread_name(const char* name) {
+	trace_buffer_t* buffer = get_buffer(name);
+	if (buffer != NULL && buffer->name != name) {
+		pthread_mutex_lock(&lock);
+		buffer->name = name;
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+void trace_init() {
+	const char* path = getenv("IMEYE_TRACE");
+	if (path == NULL || path[0] == '\0' || strcmp(path, "0") == 0) {
+		return;
+	}
+	trace_path = strdup(path);
+	if (trace_path == NULL) {
+		return;
+	}
+	if (pthread_key_create(&buffer_key, release_buffer) != 0) {
+		free(trace_path);
+		trace_path = NULL;
+		return;
+	}
+	trace_origin = trace_now();
+	trace_enabled = true;
+	trace_set_thread_name("main");
+
+#ifndef _WIN32
+	static sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	signal_thread_running = pthread_create(&signal_thread, NULL, wait_for_signal, &set) == 0;
+#endif
+}
+
+static void write_events(FILE* file, const trace_buffer_t* buffer, bool* first) {
+	uint64_t count = atomic_load_explicit(&((trace_buffer_t*)buffer)->count, memory_order_acquire);
+	uint64_t begin = count > TRACE_EVENTS ? count - TRACE_EVENTS : 0;
+	if (buffer->name != NULL) {
+		fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+		        *first ? "" : ",", buffer->tid, buffer->name);
+		*first = false;
+	}
+	for (uint64_t i = begin; i < count; i++) {
+		const trace_event_t* event = &buffer->events[i % TRACE_EVENTS];
+		// Microseconds, as the format expects
+		double start = (double)(event->start - trace_origin) / 1e3;
+		if (event->end == event->start) {
+			fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}", *first ? "" : ",",
+			        event->name, start, buffer->tid);
+		} else {
+			fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+			        *first ? "" : ",", event->name, start, (double)(event->end - event->start) / 1e3, buffer->tid);
+		}
+		*first = false;
+	}
+}
+
+void trace_dump() {
+	if (!trace_enabled) {
+		return;
+	}
+	// Written beside the target and renamed, so a viewer never opens half a file
+	size_t length = strlen(trace_path) + sizeof(".tmp");
+	char* temp = malloc(length);
+	if (temp == NULL) {
+		return;
+	}
+	snprintf(temp, length, "%s.tmp", trace_path);
+
+	pthread_mutex_lock(&lock);
+	FILE* file = fopen(temp, "w");
+	if (file == NULL) {
+		pthread_mutex_unlock(&lock);
+		fprintf(stderr, "Failed to write trace: %s\n", temp);
+		free(temp);
+		return;
+	}
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	bool first = true;
+	size_t events = 0;
+	for (const trace_buffer_t* buffer = buffers; buffer != NULL; buffer = buffer->next) {
+		write_events(file, buffer, &first);
+		uint64_t count = atomic_load(&((trace_buffer_t*)buffer)->count);
+		events += count < TRACE_EVENTS ? count : TRACE_EVENTS;
+	}
+	fprintf(file, "\n]}\n");
+	bool failed = ferror(file) != 0;
+	failed = fclose(file) != 0 || failed;
+	if (failed || rename(temp, trace_path) != 0) {
+		fprintf(stderr, "Failed to write trace: %s\n", trace_path);
+		remove(temp);
+	} else {
+		fprintf(stderr, "Trace: %zu events written to %s\n", events, trace_path);
+	}
+	pthread_mutex_unlock(&lock);
+	free(temp);
+}
+
+void trace_shutdown() {
+	if (!trace_enabled) {
+		return;
+	}
+#ifndef _WIN32
+	if (signal_thread_running) {
+		atomic_store(&stopping, true);
+		pthread_kill(signal_thread, SIGUSR1);
+		pthread_join(signal_thread, NULL);
+	}
+#endif
+	trace_dump();
+	trace_enabled = false;
+	// No destructor may run on a buffer freed below
+	pthread_key_delete(buffer_key);
+	pthread_mutex_lock(&lock);
+	while (buffers != NULL) {
+		trace_buffer_t* next = buffers->next;
+		free(buffers);
+		buffers = next;
+	}
+	pthread_mutex_unlock(&lock);
+	thread_buffer = NULL;
+	free(trace_path);
+	trace_path = NULL;
+}
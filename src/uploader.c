@@ -0,0 +1,277 @@
+#include "uploader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+static bool is_cancelled(uploader_t* uploader) {
+	pthread_mutex_lock(&uploader->lock);
+	bool cancel = uploader->cancel || !uploader->running;
+	pthread_mutex_unlock(&uploader->lock);
+	return cancel;
+}
+
+static void wait_fence(GLsync* fence) {
+	if (*fence == NULL) {
+		return;
+	}
+	while (glClientWaitSync(*fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {
+	}
+	glDeleteSync(*fence);
+	*fence = NULL;
+}
+
+// Streams one mip level through the buffer ring, returns false if cancelled or failed.
+// Compressed levels go a row of blocks, four rows of pixels, at a time.
+static bool stream_level(uploader_t* uploader, const image_t* level, int32_t index, size_t* pbo) {
+	GLenum format = image_format(level->channels);
+	GLenum type = pixel_type(level);
+	GLenum blocks = compressed_format(level->compression);
+	int32_t row_height = blocks != 0 ? 4 : 1;
+	int32_t rows_total = (level->height + row_height - 1) / row_height;
+	size_t stride = image_size(level) / rows_total;
+	size_t rows_per_chunk = uploader->pbo_size / stride;
+	if (rows_per_chunk == 0) {
+		rows_per_chunk = 1;
+	}
+
+	// A single row can be wider than the buffers
+	size_t chunk_size = rows_per_chunk * stride;
+	for (size_t i = 0; i < UPLOAD_PBO_COUNT && chunk_size > uploader->pbo_size; i++) {
+		wait_fence(&uploader->pbo_fences[i]);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploader->pbos[i]);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, chunk_size, NULL, GL_STREAM_DRAW);
+	}
+	if (chunk_size > uploader->pbo_size) {
+		uploader->pbo_size = chunk_size;
+	}
+
+	// Allocate the level, with no buffer bound so NULL isn't read as an offset into one
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	if (blocks != 0) {
+		glCompressedTexImage2D(GL_TEXTURE_2D, index, blocks, level->width, level->height, 0, (GLsizei)image_size(level),
+		                       NULL);
+	} else {
+		glTexImage2D(GL_TEXTURE_2D, index, internal_format(level), level->width, level->height, 0, format, type, NULL);
+	}
+	for (size_t y = 0; y < (size_t)rows_total; y += rows_per_chunk) {
+		if (is_cancelled(uploader)) {
+			return false;
+		}
+
+		size_t rows = rows_total - y < rows_per_chunk ? rows_total - y : rows_per_chunk;
+		size_t bytes = rows * stride;
+		// Don't overwrite a buffer the GPU may still be reading from
+		wait_fence(&uploader->pbo_fences[*pbo]);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploader->pbos[*pbo]);
+		void* dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+					     GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		if (dst == NULL) {
+			fprintf(stderr, "Failed to map upload buffer\n");
+			return false;
+		}
+		memcpy(dst, level->pixels + y * stride, bytes);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		if (blocks != 0) {
+			// Only the last row of blocks may stop short of a multiple of four
+			int32_t top = (int32_t)(y + rows) * 4 < level->height ? (int32_t)(y + rows) * 4 : level->height;
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, index, 0, (GLint)y * 4, level->width, top - (GLint)y * 4, blocks,
+			                          (GLsizei)bytes, (void*)0);
+		} else {
+			glTexSubImage2D(GL_TEXTURE_2D, index, 0, y, level->width, rows, format, type, (void*)0);
+		}
+		uploader->pbo_fences[*pbo] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		*pbo = (*pbo + 1) % UPLOAD_PBO_COUNT;
+	}
+	return true;
+}
+
+static uint32_t stream_image(uploader_t* uploader, const image_t* image) {
+	if (image_format(image->channels) == 0 && compressed_format(image->compression) == 0) {
+		fprintf(stderr, "Unsupported number of channels: %d\n", image->channels);
+		return 0;
+	}
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	set_texture_params(image->mip_count);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	size_t pbo = 0;
+	for (int32_t i = 0; i <= image->mip_count; i++) {
+		if (!stream_level(uploader, image_level(image, i), i, &pbo)) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			glDeleteTextures(1, &texture);
+			return 0;
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	return texture;
+}
+
+static void* upload_worker(void* arg) {
+	uploader_t* uploader = arg;
+	trace_thread_name("uploader");
+	glfwMakeContextCurrent(uploader->context);
+
+	glGenBuffers(UPLOAD_PBO_COUNT, uploader->pbos);
+	for (size_t i = 0; i < UPLOAD_PBO_COUNT; i++) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploader->pbos[i]);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, uploader->pbo_size, NULL, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	pthread_mutex_lock(&uploader->lock);
+	while (uploader->running) {
+		if (!uploader->pending) {
+			pthread_cond_wait(&uploader->wake, &uploader->lock);
+			continue;
+		}
+		char* path = uploader->pending_path;
+		image_t image = uploader->pending_image;
+		uploader->pending = false;
+		uploader->cancel = false;
+		pthread_mutex_unlock(&uploader->lock);
+
+		uint64_t start = trace_now();
+		uint32_t texture = stream_image(uploader, &image);
+		if (texture != 0) {
+			record_upload(start);
+		}
+		size_t bytes = image_memory(&image);
+		GLsync fence = NULL;
+		if (texture != 0) {
+			fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			// The fence has to reach the GPU before the main context can wait on it
+			glFlush();
+		}
+
+		free_image(&image);
+
+		pthread_mutex_lock(&uploader->lock);
+		// A failure is published too so the main thread stops waiting for the
+		// texture, a cancelled upload has a newer request behind it instead
+		if (texture != 0 || (!uploader->cancel && uploader->running)) {
+			// Nobody picked up the previous result, it's been superseded
+			if (uploader->finished) {
+				glDeleteTextures(1, &uploader->result.texture);
+				glDeleteSync(uploader->fence);
+				free(uploader->result.path);
+			}
+			uploader->finished = true;
+			uploader->fence = fence;
+			uploader->result = (upload_result_t){
+				.path = path,
+				.texture = texture,
+				.width = image.width,
+				.height = image.height,
+				.full_width = image.full_width,
+				.full_height = image.full_height,
+				.bytes = bytes,
+				.hdr = image.hdr,
+				.mtime = image.mtime,
+			};
+			glfwPostEmptyEvent();
+		} else {
+			free(path);
+		}
+	}
+	pthread_mutex_unlock(&uploader->lock);
+
+	for (size_t i = 0; i < UPLOAD_PBO_COUNT; i++) {
+		wait_fence(&uploader->pbo_fences[i]);
+	}
+	glDeleteBuffers(UPLOAD_PBO_COUNT, uploader->pbos);
+	glfwMakeContextCurrent(NULL);
+	return NULL;
+}
+
+int uploader_init(uploader_t* uploader, GLFWwindow* share) {
+	memset(uploader, 0, sizeof(*uploader));
+	uploader->pbo_size = UPLOAD_PBO_SIZE;
+
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	uploader->context = glfwCreateWindow(1, 1, "imeye upload", NULL, share);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+	if (uploader->context == NULL) {
+		fprintf(stderr, "Failed to create upload context\n");
+		return -1;
+	}
+
+	pthread_mutex_init(&uploader->lock, NULL);
+	pthread_cond_init(&uploader->wake, NULL);
+	uploader->running = true;
+	if (pthread_create(&uploader->thread, NULL, upload_worker, uploader) != 0) {
+		fprintf(stderr, "Failed to start upload thread\n");
+		uploader->running = false;
+		glfwDestroyWindow(uploader->context);
+		return -1;
+	}
+	return 0;
+}
+
+void uploader_destroy(uploader_t* uploader) {
+	pthread_mutex_lock(&uploader->lock);
+	bool running = uploader->running;
+	uploader->running = false;
+	pthread_cond_signal(&uploader->wake);
+	pthread_mutex_unlock(&uploader->lock);
+	if (!running) {
+		return;
+	}
+	pthread_join(uploader->thread, NULL);
+
+	if (uploader->pending) {
+		free(uploader->pending_path);
+		free_image(&uploader->pending_image);
+	}
+	if (uploader->finished) {
+		glDeleteSync(uploader->fence);
+		glDeleteTextures(1, &uploader->result.texture);
+		free(uploader->result.path);
+	}
+	glfwDestroyWindow(uploader->context);
+	pthread_cond_destroy(&uploader->wake);
+	pthread_mutex_destroy(&uploader->lock);
+}
+
+void uploader_submit(uploader_t* uploader, const char* path, image_t* image) {
+	pthread_mutex_lock(&uploader->lock);
+	if (uploader->pending) {
+		free(uploader->pending_path);
+		free_image(&uploader->pending_image);
+	}
+	uploader->pending = true;
+	uploader->pending_path = strdup(path);
+	uploader->pending_image = *image;
+	uploader->cancel = true;
+	image->pixels = NULL;
+	image->mips = NULL;
+	image->mip_count = 0;
+	pthread_cond_signal(&uploader->wake);
+	pthread_mutex_unlock(&uploader->lock);
+}
+
+bool uploader_poll(uploader_t* uploader, upload_result_t* result) {
+	pthread_mutex_lock(&uploader->lock);
+	if (!uploader->finished) {
+		pthread_mutex_unlock(&uploader->lock);
+		return false;
+	}
+	// A failed upload has no fence
+	if (uploader->fence != NULL) {
+		GLenum status = glClientWaitSync(uploader->fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+			pthread_mutex_unlock(&uploader->lock);
+			return false;
+		}
+		glDeleteSync(uploader->fence);
+		uploader->fence = NULL;
+	}
+	uploader->finished = false;
+	*result = uploader->result;
+	pthread_mutex_unlock(&uploader->lock);
+	return true;
+}
@@ -0,0 +1,325 @@
+#include "watcher.h"
+#include "sniff.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <limits.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define WATCH_BUFFER_SIZE (64 * 1024)
+// Every event takes at least its header
+#define WATCH_MAX_EVENTS (WATCH_BUFFER_SIZE / sizeof(struct inotify_event))
+
+typedef struct watch_entry_t {
+	const char* name;
+	image_type_t type;
+	bool written;
+} watch_entry_t;
+
+typedef struct watch_buffers_t {
+	char* events;
+	watch_entry_t* entries;
+	// Names that need their contents read, and what was found
+	const char** unknown;
+	image_type_t* types;
+} watch_buffers_t;
+
+static void free_buffers(watch_buffers_t* buffers) {
+	free(buffers->events);
+	free(buffers->entries);
+	free(buffers->unknown);
+	free(buffers->types);
+}
+
+static void* watch_worker(void* arg) {
+	dir_watch_t* watch = arg;
+	trace_thread_name("watch");
+	watch_buffers_t buffers = {
+		.events = malloc(WATCH_BUFFER_SIZE),
+		.entries = malloc(WATCH_MAX_EVENTS * sizeof(watch_entry_t)),
+		.unknown = malloc(WATCH_MAX_EVENTS * sizeof(const char*)),
+		.types = malloc(WATCH_MAX_EVENTS * sizeof(image_type_t)),
+	};
+	if (buffers.events == NULL || buffers.entries == NULL || buffers.unknown == NULL || buffers.types == NULL) {
+		free_buffers(&buffers);
+		return NULL;
+	}
+	for (;;) {
+		ssize_t size = read(watch->fd, buffers.events, WATCH_BUFFER_SIZE);
+		if (size <= 0) {
+			break;
+		}
+
+		size_t count = 0;
+		size_t unknown = 0;
+		bool overflowed = false;
+		for (ssize_t pos = 0; pos < size;) {
+			const struct inotify_event* event = (const struct inotify_event*)(buffers.events + pos);
+			pos += sizeof(struct inotify_event) + event->len;
+			if (event->mask & IN_Q_OVERFLOW) {
+				overflowed = true;
+			}
+			if (event->len == 0 || (event->mask & IN_ISDIR)) {
+				continue;
+			}
+			watch_entry_t* entry = &buffers.entries[count++];
+			entry->name = event->name;
+			// A file only counts once it's complete, renderers either close it or rename it into place
+			entry->written = event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO);
+			entry->type = sniff_extension(event->name);
+			if (entry->type == TYPE_UNKNOWN && entry->written) {
+				buffers.unknown[unknown++] = event->name;
+			}
+		}
+		// Reading files can take a while on a slow disk, the main thread must not wait on the lock meanwhile
+		if (unknown > 0) {
+			sniff_files(watch->directory, buffers.unknown, unknown, buffers.types, 1);
+			for (size_t i = 0, j = 0; i < count; i++) {
+				if (buffers.entries[i].type == TYPE_UNKNOWN && buffers.entries[i].written) {
+					buffers.entries[i].type = buffers.types[j++];
+				}
+			}
+		}
+
+		pthread_mutex_lock(&watch->lock);
+		bool cancel = watch->cancel;
+		watch->overflowed = watch->overflowed || overflowed;
+		for (size_t i = 0; i < count; i++) {
+			const watch_entry_t* entry = &buffers.entries[i];
+			// Removing a name that was never listed is harmless, its contents can't be checked anymore
+			if (entry->type == TYPE_NOT_IMAGE || (entry->type == TYPE_UNKNOWN && entry->written)) {
+				continue;
+			}
+			char name[NAME_MAX + 2];
+			name[0] = entry->written ? '+' : '-';
+			strncpy(name + 1, entry->name, NAME_MAX);
+			name[NAME_MAX + 1] = '\0';
+			path_table_add(&watch->events, name);
+		}
+		bool queued = watch->events.count > 0 || watch->overflowed;
+		pthread_mutex_unlock(&watch->lock);
+
+		if (cancel) {
+			break;
+		}
+		if (queued && watch->notify != NULL) {
+			watch->notify();
+		}
+	}
+	free_buffers(&buffers);
+	return NULL;
+}
+
+int dir_watch_start(dir_watch_t* watch, const char* directory, void (*notify)(void)) {
+	memset(watch, 0, sizeof(*watch));
+	watch->fd = inotify_init1(IN_CLOEXEC);
+	if (watch->fd < 0) {
+		perror("inotify_init1");
+		return -1;
+	}
+	watch->wd = inotify_add_watch(watch->fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+	if (watch->wd < 0) {
+		fprintf(stderr, "Could not watch directory %s\n", directory);
+		close(watch->fd);
+		return -1;
+	}
+	watch->directory = strdup(directory);
+	if (watch->directory == NULL) {
+		close(watch->fd);
+		return -1;
+	}
+	watch->notify = notify;
+	pthread_mutex_init(&watch->lock, NULL);
+	if (pthread_create(&watch->thread, NULL, watch_worker, watch) != 0) {
+		fprintf(stderr, "Failed to start directory watch thread\n");
+		pthread_mutex_destroy(&watch->lock);
+		free(watch->directory);
+		close(watch->fd);
+		return -1;
+	}
+	watch->started = true;
+	return 0;
+}
+
+void dir_watch_destroy(dir_watch_t* watch) {
+	if (!watch->started) {
+		return;
+	}
+	pthread_mutex_lock(&watch->lock);
+	watch->cancel = true;
+	pthread_mutex_unlock(&watch->lock);
+	// Removing the watch queues IN_IGNORED, which wakes the worker out of read()
+	inotify_rm_watch(watch->fd, watch->wd);
+	pthread_join(watch->thread, NULL);
+	close(watch->fd);
+	pthread_mutex_destroy(&watch->lock);
+	path_table_destroy(&watch->events);
+	if (watch->rescanning) {
+		dir_scan_destroy(&watch->rescan);
+		path_table_destroy(&watch->rescanned);
+	}
+	free(watch->directory);
+	watch->started = false;
+}
+#else
+int dir_watch_start(dir_watch_t* watch, const char* directory, void (*notify)(void)) {
+	(void)directory;
+	(void)notify;
+	memset(watch, 0, sizeof(*watch));
+	return -1;
+}
+
+void dir_watch_destroy(dir_watch_t* watch) {
+	(void)watch;
+}
+#endif
+
+bool dir_watch_ready(dir_watch_t* watch) {
+	if (!watch->started) {
+		return false;
+	}
+	pthread_mutex_lock(&watch->lock);
+	bool ready = watch->events.count > 0 || watch->overflowed;
+	pthread_mutex_unlock(&watch->lock);
+	if (watch->rescanning) {
+		ready = ready || dir_scan_ready(&watch->rescan) || dir_scan_done(&watch->rescan);
+	}
+	return ready || watch->stale;
+}
+
+typedef struct watch_event_t {
+	const char* name;
+	size_t order;
+} watch_event_t;
+
+static int compare_events(const void* a, const void* b) {
+	const watch_event_t* x = a;
+	const watch_event_t* y = b;
+	int result = strcmp(x->name + 1, y->name + 1);
+	if (result != 0) {
+		return result;
+	}
+	return (x->order > y->order) - (x->order < y->order);
+}
+
+static void apply_events(dir_watch_t* watch, path_table_t* events, path_table_t* table, const char* keep,
+                         path_table_t* rewritten) {
+	// Group the events per name, the last one decides
+	watch_event_t* sorted = malloc(events->count * sizeof(watch_event_t));
+	if (sorted == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < events->count; i++) {
+		sorted[i].name = path_table_name(events, i);
+		sorted[i].order = i;
+	}
+	qsort(sorted, events->count, sizeof(watch_event_t), compare_events);
+
+	path_table_t added = {0};
+	path_table_t removed = {0};
+	// Every name, listed or not, so a rescan in progress doesn't undo these once it's swapped in
+	path_table_t created = {0};
+	path_table_t deleted = {0};
+	for (size_t i = 0; i < events->count; i++) {
+		if (i + 1 < events->count && strcmp(sorted[i].name + 1, sorted[i + 1].name + 1) == 0) {
+			continue;
+		}
+		const char* name = sorted[i].name + 1;
+		bool listed = path_table_find(table, name) < table->count;
+		if (sorted[i].name[0] == '+') {
+			path_table_add(listed ? rewritten : &added, name);
+		} else if (listed && (keep == NULL || strcmp(name, keep) != 0)) {
+			path_table_add(&removed, name);
+		}
+		if (watch->rescanning) {
+			path_table_add(sorted[i].name[0] == '+' ? &created : &deleted, name);
+		}
+	}
+	free(sorted);
+
+	path_table_remove(table, &removed);
+	if (path_table_sort(&added) == 0) {
+		path_table_merge(table, &added);
+	}
+	path_table_remove(&watch->rescanned, &deleted);
+	if (path_table_sort(&created) == 0) {
+		path_table_merge(&watch->rescanned, &created);
+	}
+	path_table_destroy(&added);
+	path_table_destroy(&removed);
+	path_table_destroy(&created);
+	path_table_destroy(&deleted);
+}
+
+// Names missing from the listing are removed, names missing from table added
+static void finish_rescan(dir_watch_t* watch, path_table_t* table, const char* keep) {
+	if (dir_scan_ready(&watch->rescan)) {
+		dir_scan_merge(&watch->rescan, &watch->rescanned);
+	}
+	if (!dir_scan_done(&watch->rescan)) {
+		return;
+	}
+	pthread_mutex_lock(&watch->rescan.lock);
+	bool failed = watch->rescan.failed;
+	pthread_mutex_unlock(&watch->rescan.lock);
+	dir_scan_destroy(&watch->rescan);
+	watch->rescanning = false;
+	if (!failed) {
+		path_table_t removed = {0};
+		for (size_t i = 0; i < table->count; i++) {
+			const char* name = path_table_name(table, i);
+			bool found = path_table_find(&watch->rescanned, name) < watch->rescanned.count;
+			if (!found && (keep == NULL || strcmp(name, keep) != 0)) {
+				path_table_add(&removed, name);
+			}
+		}
+		// Only names the table lacks, merged duplicates would stay in its arena unreferenced
+		path_table_t added = {0};
+		for (size_t i = 0; i < watch->rescanned.count; i++) {
+			const char* name = path_table_name(&watch->rescanned, i);
+			if (path_table_find(table, name) == table->count) {
+				path_table_add(&added, name);
+			}
+		}
+		path_table_remove(table, &removed);
+		path_table_merge(table, &added);
+		path_table_destroy(&removed);
+		path_table_destroy(&added);
+	}
+	path_table_destroy(&watch->rescanned);
+}
+
+bool dir_watch_apply(dir_watch_t* watch, path_table_t* table, const char* keep, path_table_t* rewritten) {
+	// Take the queued events so the worker keeps going while they're applied
+	pthread_mutex_lock(&watch->lock);
+	path_table_t events = watch->events;
+	memset(&watch->events, 0, sizeof(watch->events));
+	watch->stale = watch->stale || watch->overflowed;
+	watch->overflowed = false;
+	pthread_mutex_unlock(&watch->lock);
+
+	uint64_t generation = table->generation;
+	// One listing at a time, events dropped during it get another one after
+	if (watch->stale && !watch->rescanning) {
+		memset(&watch->rescanned, 0, sizeof(watch->rescanned));
+		if (dir_scan_start(&watch->rescan, watch->directory, watch->notify) == 0) {
+			watch->rescanning = true;
+		} else {
+			fprintf(stderr, "Directory events were dropped, the list may be out of date\n");
+		}
+		watch->stale = false;
+	}
+	if (events.count > 0) {
+		apply_events(watch, &events, table, keep, rewritten);
+	}
+	path_table_destroy(&events);
+	if (watch->rescanning) {
+		finish_rescan(watch, table, keep);
+	}
+	return table->generation != generation;
+}